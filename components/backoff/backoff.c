@@ -0,0 +1,14 @@
+#include "backoff.h"
+#include "esp_random.h"
+
+uint32_t backoff_delay_ms(uint32_t attempt, uint32_t min_ms, uint32_t max_ms)
+{
+    uint32_t delay_ms = min_ms;
+    for (uint32_t i = 0; i < attempt && delay_ms < max_ms; ++i) {
+        delay_ms *= 2;
+    }
+    if (delay_ms > max_ms) {
+        delay_ms = max_ms;
+    }
+    return delay_ms + esp_random() % (delay_ms / 2 + 1);
+}
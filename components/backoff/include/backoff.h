@@ -0,0 +1,14 @@
+/* Retry delays shared by everything that talks to the network */
+#ifndef _BACKOFF_H_
+#define _BACKOFF_H_
+
+#include <stdint.h>
+
+/**
+ * Delay before the next try after `attempt` failed ones in a row, 0 gives min_ms.
+ * Doubles per attempt up to max_ms, then adds up to 50% random jitter so a fleet
+ * that lost the network together does not retry in step.
+ */
+uint32_t backoff_delay_ms(uint32_t attempt, uint32_t min_ms, uint32_t max_ms);
+
+#endif
@@ -1,4 +1,5 @@
 #include "bluetooth.h"
+#include "bt-parser.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -7,6 +8,7 @@
 #include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/stream_buffer.h"
 
 #include "nvs_init.h"
 #include "esp_log.h"
@@ -24,25 +26,16 @@
 #define SPP_SHOW_SPEED 1
 #define SPP_SHOW_MODE SPP_SHOW_DATA
 
-#define USERNAME_PREFIX "username{"
-#define USERNAME_POST "}username"
+#define BLUETOOTH_PROVISION_TIME_MS (120 * 1000)
 
-#define PASSWD_PREFIX "password{"
-#define PASSWD_POST "}password"
+#define BLUETOOTH_STREAM_LEN 512
+#define BLUETOOTH_READ_CHUNK 64
 
-#define AUTH_KEY_PREFIX "authkey{"
-#define AUTH_KEY_POST "}authkey"
-
-#define ID_PREFIX "id{"
-#define ID_POST "}id"
-
-#define BLUETOOTH_DATA_QUERY_TIME 120
-
-#define BLUETOOTH_MSG_MAX_LEN 304
-
-SemaphoreHandle_t bluetooth_semaphore = NULL;
-static volatile u_char bluetooth_written = 0;
-static char bluetooth_msg[BLUETOOTH_MSG_MAX_LEN] = {0};
+/* The SPP callback only copies the bytes into the stream buffer, bt_task parses them */
+static StreamBufferHandle_t bluetooth_stream = NULL;
+static StaticStreamBuffer_t bluetooth_stream_struct;
+static uint8_t bluetooth_stream_storage[BLUETOOTH_STREAM_LEN + 1];
+static uint32_t bluetooth_overruns = 0;
 static bool bluetooth_used = false;
 
 static const esp_spp_mode_t esp_spp_mode = ESP_SPP_MODE_CB;
@@ -96,9 +89,10 @@ static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
     case ESP_SPP_DATA_IND_EVT:
         ESP_LOGI(__func__, "ESP_SPP_DATA_IND_EVT len:%d handle:%d",
                  param->data_ind.len, param->data_ind.handle);
-        if (param->data_ind.len < BLUETOOTH_MSG_MAX_LEN) {
-            strcpy(bluetooth_msg, (char *) param->data_ind.data);
-            bluetooth_written = 1;
+        if (xStreamBufferSend(bluetooth_stream, param->data_ind.data, param->data_ind.len, 0)
+            != param->data_ind.len) {
+            bluetooth_overruns++;
+            ESP_LOGW(__func__, "Provisioning data lost, %u overruns", (unsigned) bluetooth_overruns);
         }
         break;
 
@@ -160,89 +154,54 @@ void esp_bt_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param)
     }
 }
 
-char* parse_string(const char* string, const char* prefix, const char* ender)
+static void stage_field(const bt_parser_t *parser, bt_field_t field, config_key_t key)
 {
-    char* str_start = strstr(string, prefix);
-    char* str_end = strstr(string ,ender);
-
-    if (str_start == NULL || str_end == NULL) {
-        return NULL;
-    }
-
-    str_start += strlen(USERNAME_PREFIX);
-    char* outstring = malloc(sizeof(char) * MAX_USERNAME_LENGTH);
-    char* outstring_start = outstring;
-    while (str_start < str_end) {
-        *outstring = *str_start;
-        ++str_start;
-        ++outstring;
+    const char *value = bt_parser_value(parser, field);
+    if (value != NULL) {
+        ESP_ERROR_CHECK(config_stage_str(key, value));
     }
-
-    *outstring = '\0';
-    return outstring_start;
-
-}
-
-char* parse_username(const char* string)
-{
-    return parse_string(string, USERNAME_PREFIX, USERNAME_POST);
-}
-
-char* parse_password(const char* string)
-{
-    return parse_string(string, PASSWD_PREFIX, PASSWD_POST);
-}
-
-char* parse_authkey(const char* string)
-{
-    return parse_string(string, AUTH_KEY_PREFIX, AUTH_KEY_POST);
-}
-
-char* parse_id(const char* string)
-{
-    return parse_string(string, ID_PREFIX, ID_POST);
 }
 
 void vSaveBluetoothCredientials(void *parameters)
 {
-    unsigned repeats = 0;
-    bool wifi_set = false;
-    bool auth_token_set = false;
-    bool id_set = false;
-
-    while (repeats < BLUETOOTH_DATA_QUERY_TIME &&
-           !(wifi_set && auth_token_set && id_set)) {
-
-        repeats++;
-
-        if (bluetooth_written) {
-            bluetooth_written = 0;
-            char* username = parse_username(bluetooth_msg);
-            char* passwd = parse_password(bluetooth_msg);
-            char* id = parse_id(bluetooth_msg);
-
-            if (username != NULL && passwd != NULL) {
-                save_wifi_credientials(username, passwd);
-                wifi_set = true;
-            }
-            char* auth_token = parse_authkey(bluetooth_msg);
-            if (auth_token != NULL) {
-                save_auth_token(auth_token);
-                auth_token_set = true;
-            }
-            if (id != NULL) {
-                save_unit_id(id);
-                id_set = true;
-            }
-
-            free(auth_token);
-            free(username);
-            free(passwd);
-            free(id);
-            memset(bluetooth_msg, 0, BLUETOOTH_MSG_MAX_LEN);
+    /**
+     * Blocks on the stream buffer, so a field is handled as soon as its last
+     * byte arrives. Fields may be split over any number of SPP packets.
+     * Everything received is committed in one go once all fields are in,
+     * or whatever arrived when the provisioning time runs out.
+     */
+    static bt_parser_t parser;
+    char chunk[BLUETOOTH_READ_CHUNK];
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(BLUETOOTH_PROVISION_TIME_MS);
+    TickType_t elapsed = 0;
+
+    bt_parser_init(&parser);
+    while (parser.received != BT_FIELDS_ALL && elapsed < timeout) {
+        size_t len = xStreamBufferReceive(bluetooth_stream, chunk, sizeof(chunk), timeout - elapsed);
+        uint32_t completed = bt_parser_feed(&parser, chunk, len);
+        if (completed) {
+            ESP_LOGI(__func__, "Received fields 0x%x", (unsigned) parser.received);
+        }
+        if (parser.overflowed) {
+            ESP_LOGW(__func__, "Fields 0x%x too long, ignored", (unsigned) parser.overflowed);
         }
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
+        elapsed = xTaskGetTickCount() - start;
+    }
+
+    config_begin();
+    // Wi-Fi credentials are only used as a pair.
+    if ((parser.received & BT_FIELD_BIT(BT_FIELD_USERNAME)) && (parser.received & BT_FIELD_BIT(BT_FIELD_PASSWORD))) {
+        stage_field(&parser, BT_FIELD_USERNAME, CFG_WIFI_USER);
+        stage_field(&parser, BT_FIELD_PASSWORD, CFG_WIFI_PASSWD);
+        printf("Saved wifi network: %s\n", bt_parser_value(&parser, BT_FIELD_USERNAME));
     }
+    stage_field(&parser, BT_FIELD_AUTHKEY, CFG_AUTH_TOKEN);
+    stage_field(&parser, BT_FIELD_ID, CFG_UNIT_ID);
+    ESP_ERROR_CHECK(config_commit());
+    // The parser held the secrets in plain text.
+    memset(&parser, 0, sizeof(parser));
+    memset(chunk, 0, sizeof(chunk));
 
     deinit_bluetooth();
     vTaskDelete(NULL);
@@ -285,6 +244,8 @@ void init_bluetooth(void)
     if  (esp_bt_controller_get_status() ==  ESP_BT_CONTROLLER_STATUS_ENABLED) {
         return;
     }
+    bluetooth_stream = xStreamBufferCreateStatic(BLUETOOTH_STREAM_LEN, 1, bluetooth_stream_storage,
+                                                 &bluetooth_stream_struct);
 
     char bda_str[18] = {0};
 
@@ -341,6 +302,7 @@ void init_bluetooth(void)
     bluetooth_used = true;
 
     ESP_LOGI(__func__, "Own address:[%s]", bda2str((uint8_t *)esp_bt_dev_get_address(), bda_str, sizeof(bda_str)));
-    xTaskCreate(vSaveBluetoothCredientials, "bt_task", 2048, NULL, 10, NULL);
+    xTaskCreatePinnedToCore(vSaveBluetoothCredientials, "bt_task", CONFIG_BT_TASK_STACK, NULL,
+                            CONFIG_BT_TASK_PRIORITY, NULL, CONFIG_NETWORK_TASK_CORE);
 
 }
@@ -0,0 +1,135 @@
+#include "bt-parser.h"
+
+#include <string.h>
+
+enum {
+    PARSE_NAME,     // Collecting a field name up to '{'
+    PARSE_VALUE,    // Copying the value
+    PARSE_CLOSE,    // Matching the "}name" that ends the value
+};
+
+static const char *field_names[BT_FIELD_COUNT] = {
+    [BT_FIELD_USERNAME] = "username",
+    [BT_FIELD_PASSWORD] = "password",
+    [BT_FIELD_AUTHKEY] = "authkey",
+    [BT_FIELD_ID] = "id",
+};
+
+void bt_parser_init(bt_parser_t *parser)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->state = PARSE_NAME;
+    parser->field = -1;
+}
+
+static int find_field(const char *name, size_t len)
+{
+    // The name is whatever was collected before '{', the field name is its tail.
+    for (int field = 0; field < BT_FIELD_COUNT; ++field) {
+        size_t field_len = strlen(field_names[field]);
+        if (field_len <= len && memcmp(field_names[field], name + len - field_len, field_len) == 0) {
+            return field;
+        }
+    }
+    return -1;
+}
+
+static void append_value(bt_parser_t *parser, char c)
+{
+    if (parser->value_len + 1 < STR_LENGTH) {
+        parser->values[parser->field][parser->value_len] = c;
+    } else {
+        parser->overflowed |= BT_FIELD_BIT(parser->field);
+    }
+    parser->value_len++;
+}
+
+static void start_name(bt_parser_t *parser, char c)
+{
+    parser->state = PARSE_NAME;
+    parser->field = -1;
+    parser->name_len = 0;
+    if (c != '}' && c != '{') {
+        parser->name[parser->name_len++] = c;
+    }
+}
+
+uint32_t bt_parser_feed(bt_parser_t *parser, const char *data, size_t len)
+{
+    /**
+     * One pass over the data, every byte is looked at once (a '}' that turns out
+     * to be part of the value is copied with the few name bytes matched after it).
+     * Returns the BT_FIELD_BIT of the fields completed by this call.
+     */
+    uint32_t completed = 0;
+
+    for (size_t i = 0; i < len; ++i) {
+        char c = data[i];
+
+        switch (parser->state) {
+        case PARSE_NAME:
+            if (c == '{') {
+                parser->field = find_field(parser->name, parser->name_len);
+                parser->name_len = 0;
+                if (parser->field >= 0) {
+                    parser->state = PARSE_VALUE;
+                    parser->value_len = 0;
+                    parser->overflowed &= ~BT_FIELD_BIT(parser->field);
+                }
+            } else if (parser->name_len < BT_FIELD_NAME_MAX) {
+                parser->name[parser->name_len++] = c;
+            } else {
+                // Not a name we know, keep the tail in case a name starts inside it.
+                memmove(parser->name, parser->name + 1, BT_FIELD_NAME_MAX - 1);
+                parser->name[BT_FIELD_NAME_MAX - 1] = c;
+            }
+            break;
+
+        case PARSE_VALUE:
+            if (c == '}') {
+                parser->state = PARSE_CLOSE;
+                parser->close_len = 0;
+            } else {
+                append_value(parser, c);
+            }
+            break;
+
+        case PARSE_CLOSE: {
+            const char *name = field_names[parser->field];
+            if (c == name[parser->close_len]) {
+                if (name[++parser->close_len] != '\0') {
+                    break;
+                }
+                if (!(parser->overflowed & BT_FIELD_BIT(parser->field))) {
+                    parser->values[parser->field][parser->value_len] = '\0';
+                    parser->received |= BT_FIELD_BIT(parser->field);
+                    completed |= BT_FIELD_BIT(parser->field);
+                }
+                start_name(parser, '}');
+                break;
+            }
+            // The '}' belonged to the value.
+            append_value(parser, '}');
+            for (size_t k = 0; k < parser->close_len; ++k) {
+                append_value(parser, name[k]);
+            }
+            if (c == '}') {
+                parser->close_len = 0;
+            } else {
+                parser->state = PARSE_VALUE;
+                append_value(parser, c);
+            }
+            break;
+        }
+        }
+    }
+    return completed;
+}
+
+const char *bt_parser_value(const bt_parser_t *parser, bt_field_t field)
+{
+    if (field >= BT_FIELD_COUNT || !(parser->received & BT_FIELD_BIT(field))) {
+        return NULL;
+    }
+    return parser->values[field];
+}
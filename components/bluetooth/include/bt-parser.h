@@ -0,0 +1,47 @@
+/* Parsing of the provisioning message received over bluetooth */
+#ifndef _BT_PARSER_H_
+#define _BT_PARSER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "nvs_init.h"
+
+/*
+ * A message is a sequence of fields framed as name{value}name, for example
+ * username{my wifi}usernamepassword{secret}passwordauthkey{...}authkeyid{...}id
+ * Anything between fields is ignored. A value may contain '}' as long as it is
+ * not followed by its own field name.
+ */
+#define BT_FIELD_NAME_MAX 16
+
+typedef enum {
+    BT_FIELD_USERNAME,
+    BT_FIELD_PASSWORD,
+    BT_FIELD_AUTHKEY,
+    BT_FIELD_ID,
+    BT_FIELD_COUNT
+} bt_field_t;
+
+#define BT_FIELD_BIT(field) (1UL << (field))
+#define BT_FIELDS_ALL (BT_FIELD_BIT(BT_FIELD_COUNT) - 1)
+
+typedef struct {
+    char values[BT_FIELD_COUNT][STR_LENGTH];  // NUL terminated once the field is complete
+    uint32_t received;                        // BT_FIELD_BIT of every complete field
+    uint32_t overflowed;                      // Fields dropped because the value was too long
+    /* Tokenizer state, kept between calls so fields can span packets */
+    uint8_t state;
+    int8_t field;
+    char name[BT_FIELD_NAME_MAX];
+    size_t name_len;
+    size_t value_len;
+    size_t close_len;                         // Characters of "}name" matched so far
+} bt_parser_t;
+
+void bt_parser_init(bt_parser_t *parser);
+uint32_t bt_parser_feed(bt_parser_t *parser, const char *data, size_t len);
+const char *bt_parser_value(const bt_parser_t *parser, bt_field_t field);
+
+#endif
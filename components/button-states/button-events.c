@@ -0,0 +1,79 @@
+#include "button-events.h"
+#include "sdkconfig.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifdef CONFIG_BUTTON_DEEP_SLEEP
+#include "esp_attr.h"
+/* Keep the ring in RTC memory so events survive deep sleep */
+#define EVENT_RING_ATTR RTC_DATA_ATTR
+#else
+#define EVENT_RING_ATTR
+#endif
+
+/* Events stay in the ring until the uploader consumes them, so a failed
+ * upload can be retried. When the ring is full the oldest event is
+ * overwritten and the sequence gap shows up on the server side. */
+static EVENT_RING_ATTR button_event_t events[BUTTON_EVENT_QUEUE_LEN];
+static EVENT_RING_ATTR size_t head = 0;
+static EVENT_RING_ATTR size_t count = 0;
+static EVENT_RING_ATTR uint32_t next_seq = 1;
+static EVENT_RING_ATTR uint32_t dropped = 0;
+static portMUX_TYPE events_lock = portMUX_INITIALIZER_UNLOCKED;
+
+uint32_t button_event_push(uint16_t slot, bool state, uint32_t timestamp)
+{
+    taskENTER_CRITICAL(&events_lock);
+    if (count == BUTTON_EVENT_QUEUE_LEN) {
+        head = (head + 1) % BUTTON_EVENT_QUEUE_LEN;
+        count--;
+        dropped++;
+    }
+    button_event_t *event = &events[(head + count) % BUTTON_EVENT_QUEUE_LEN];
+    event->seq = next_seq++;
+    event->timestamp = timestamp;
+    event->slot = slot;
+    event->state = state;
+    count++;
+    uint32_t seq = event->seq;
+    taskEXIT_CRITICAL(&events_lock);
+    return seq;
+}
+
+size_t button_events_peek(button_event_t *out, size_t max_events)
+{
+    taskENTER_CRITICAL(&events_lock);
+    size_t n = count < max_events ? count : max_events;
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = events[(head + i) % BUTTON_EVENT_QUEUE_LEN];
+    }
+    taskEXIT_CRITICAL(&events_lock);
+    return n;
+}
+
+void button_events_ack(uint32_t last_seq)
+{
+    // Acknowledge by sequence number, the ring may have been overwritten since the peek.
+    taskENTER_CRITICAL(&events_lock);
+    while (count > 0 && (int32_t)(events[head].seq - last_seq) <= 0) {
+        head = (head + 1) % BUTTON_EVENT_QUEUE_LEN;
+        count--;
+    }
+    taskEXIT_CRITICAL(&events_lock);
+}
+
+size_t button_events_pending(void)
+{
+    return count;
+}
+
+uint32_t button_events_last_seq(void)
+{
+    return next_seq - 1;
+}
+
+uint32_t button_events_dropped(void)
+{
+    return dropped;
+}
@@ -1,4 +1,7 @@
 #include "button-states.h"
+#include "button-events.h"
+#include "slot-scanner.h"
+#include "report-schedule.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -11,136 +14,912 @@
 #include "esp_timer.h"
 #include "esp_log.h"
 
+#ifdef CONFIG_BUTTON_DEEP_SLEEP
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "esp_rtc_time.h"
+#include "driver/rtc_io.h"
+/* State that has to survive deep sleep lives in RTC slow memory */
+#define SLEEP_RETAIN RTC_DATA_ATTR
+#else
+#define SLEEP_RETAIN
+#endif
+#ifdef CONFIG_POWER_LIGHT_SLEEP
+#include "esp_sleep.h"
+#include "hal/gpio_ll.h"
+#endif
+
 #include "nvs_init.h"
 #include "http.h"
+#include "transport.h"
+#include "wifi.h"
+#include "backoff.h"
+#include "journal.h"
+#include "json-writer.h"
+#include "state-frame.h"
+#include "remote-config.h"
+#include "metrics.h"
+#include "dlog.h"
+#ifdef CONFIG_POWER_MANAGEMENT
+#include "power.h"
+#endif
+#ifdef CONFIG_PUSH_MQTT
+#include "push.h"
+#endif
+#ifdef CONFIG_OTA_UPDATES
+#include "ota.h"
+#endif
+#ifdef CONFIG_LOAD_CELLS
+#include "load-cells.h"
+#endif
+#ifdef CONFIG_HEAP_TRACE_GATE
+#include "heap-gate.h"
+#endif
+#ifdef CONFIG_INPUT_LATENCY_BENCH
+#include "latency-bench.h"
+#endif
+
+static SLEEP_RETAIN uint32_t slot_state[SLOT_WORDS];     // Debounced state, bit set when pressed
+static uint32_t slot_changed_at[SLOT_COUNT];
+static uint32_t coalesce_time_ms = DEFAULT_COALESCE_TIME_MS;
+static size_t max_batch = DEFAULT_MAX_BATCH;
+static TaskHandle_t send_task_handle = NULL;
+static button_event_t batch[DEFAULT_MAX_BATCH];
+static journal_event_t upload[JOURNAL_REPLAY_BATCH];
+static char post_response[RESPONSE_BUFFER_LEN];
+static uint8_t frame_buf[STATE_FRAME_MAX_LEN];
+#ifdef CONFIG_BUTTON_ENCODING_FRAME
+static state_encoding_t state_encoding = STATE_ENCODING_FRAME;
+#else
+static state_encoding_t state_encoding = STATE_ENCODING_JSON;
+#endif
+static uint32_t failed_uploads = 0;
+static upload_stats_t upload_stats;
+
+typedef struct {
+    state_listener_t listener;
+    void* ctx;
+} state_subscriber_t;
+
+static state_subscriber_t state_subscribers[STATE_MAX_LISTENERS];
+static size_t state_subscriber_count = 0;
+
+#ifdef CONFIG_BUTTON_FRONTEND_GPIO
+#define PIN_SLOTS_8(base) PIN_TO_SLOT(base), PIN_TO_SLOT(base + 1), PIN_TO_SLOT(base + 2), \
+        PIN_TO_SLOT(base + 3), PIN_TO_SLOT(base + 4), PIN_TO_SLOT(base + 5), \
+        PIN_TO_SLOT(base + 6), PIN_TO_SLOT(base + 7)
 
-static QueueHandle_t gpio_evt_queue = NULL;
-static button_t *buttons;
-static int buttons_size = 0;
-static uint32_t send_time = 0;
+static const int8_t pin_to_slot[GPIO_PIN_COUNT] = {
+    PIN_SLOTS_8(0), PIN_SLOTS_8(8), PIN_SLOTS_8(16), PIN_SLOTS_8(24), PIN_SLOTS_8(32)
+};
+
+/*
+ * The ISR only marks the pin as pending and wakes gpio_task, any number of edges
+ * before the task runs collapse into one read of the pin level. A pin producing
+ * more than ISR_MAX_EDGES edges within ISR_RATE_WINDOW_MS has its interrupt masked
+ * until rearm_timer fires.
+ *
+ * Light sleep can only wake on a level. With CONFIG_POWER_LIGHT_SLEEP every pin
+ * interrupts on the level it is not at and the ISR flips it, which gives one
+ * interrupt per edge like GPIO_INTR_ANYEDGE and keeps the pin a wakeup source.
+ */
+static TaskHandle_t gpio_task_handle = NULL;
+static esp_timer_handle_t rearm_timer = NULL;
+static portMUX_TYPE isr_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint64_t pending_pins = 0;
+static uint64_t throttled_pins = 0;
+#ifdef CONFIG_POWER_LIGHT_SLEEP
+static uint64_t wait_high_pins = 0;     // Pins armed on a high level, the others on low
+#endif
+static uint8_t window_edges[GPIO_PIN_COUNT];
+static int64_t window_start[GPIO_PIN_COUNT];
+static edge_stats_t edge_stats;
+static int64_t first_edge_at[GPIO_PIN_COUNT];  // For the ISR to debounce latency
 
 static void IRAM_ATTR gpio_isr_handler(void* arg)
 {
-    uint32_t gpio_num = (uint32_t) arg;
-    xQueueSendFromISR(gpio_evt_queue, &gpio_num, NULL);
+    uint32_t pin = (uint32_t) arg;
+    uint64_t pin_flag = 1ULL << pin;
+    int64_t now = esp_timer_get_time();
+    BaseType_t task_woken = pdFALSE;
+
+    portENTER_CRITICAL_ISR(&isr_lock);
+    edge_stats.edges++;
+    if (pending_pins & pin_flag) {
+        edge_stats.coalesced++;
+    }
+    pending_pins |= pin_flag;
+    if (first_edge_at[pin] == 0) {
+        first_edge_at[pin] = now;
+    }
+#ifdef CONFIG_POWER_LIGHT_SLEEP
+    wait_high_pins ^= pin_flag;
+    gpio_ll_set_intr_type(&GPIO, pin, (wait_high_pins & pin_flag) ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+#endif
+
+    if (now - window_start[pin] > ISR_RATE_WINDOW_MS * 1000) {
+        window_start[pin] = now;
+        window_edges[pin] = 0;
+    }
+    if (++window_edges[pin] > ISR_MAX_EDGES) {
+        gpio_intr_disable(pin);
+        throttled_pins |= pin_flag;
+        edge_stats.throttled++;
+    }
+    portEXIT_CRITICAL_ISR(&isr_lock);
+
+    vTaskNotifyGiveFromISR(gpio_task_handle, &task_woken);
+    if (task_woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+static void rearm_pins(void* arg)
+{
+    portENTER_CRITICAL(&isr_lock);
+    uint64_t pins = throttled_pins;
+    throttled_pins = 0;
+    // Edges were missed while masked, read the level again.
+    pending_pins |= pins;
+    portEXIT_CRITICAL(&isr_lock);
+
+    while (pins) {
+        int pin = __builtin_ctzll(pins);
+        pins &= pins - 1;
+        window_edges[pin] = 0;
+        gpio_intr_enable(pin);
+    }
+    xTaskNotifyGive(gpio_task_handle);
+}
+#endif
+
+void get_edge_stats(edge_stats_t* stats)
+{
+#ifdef CONFIG_BUTTON_FRONTEND_GPIO
+    portENTER_CRITICAL(&isr_lock);
+    *stats = edge_stats;
+    portEXIT_CRITICAL(&isr_lock);
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+    stats->dropped = button_events_dropped();
+}
+
+bool get_slot_state(int slot)
+{
+    return (slot_state[slot / 32] >> (slot % 32)) & 1;
+}
+
+static void set_slot_state(int slot, bool pressed)
+{
+    if (pressed) {
+        slot_state[slot / 32] |= 1UL << (slot % 32);
+    } else {
+        slot_state[slot / 32] &= ~(1UL << (slot % 32));
+    }
+}
+
+/* Values from the remote configuration, with the built-in defaults when unset */
+static const char* api_host(void)
+{
+    return config_is_set(CFG_API_HOST) ? config_get_str(CFG_API_HOST) : API_HOST;
+}
+
+static const char* api_path(char* buf, size_t len, const char* suffix)
+{
+    const char* base = config_is_set(CFG_API_PATH) ? config_get_str(CFG_API_PATH) : STATE_PATH;
+    snprintf(buf, len, "%s%s", base, suffix);
+    return buf;
+}
+
+static uint32_t heartbeat_ms(void)
+{
+    return config_get_u32(CFG_HEARTBEAT_S, HEARTBEAT_TIME_MS / 1000) * 1000;
+}
+
+static uint32_t bounce_ms(void)
+{
+    return config_get_u32(CFG_BOUNCE_MS, BOUNCE_TIME_MS);
 }
 
 static uint32_t millis() {
+#ifdef CONFIG_BUTTON_DEEP_SLEEP
+    // esp_timer restarts on every wakeup, the RTC timer keeps running in deep sleep.
+    return esp_rtc_get_time_us() / 1000;
+#else
     return esp_timer_get_time() / 1000;
+#endif
 }
 
 static void refresh_buttons(void)
 {
-    for (int i=0; i<buttons_size; ++i) {
-        buttons[i].state = (gpio_get_level(buttons[i].pin) == 0);
+#ifdef CONFIG_BUTTON_FRONTEND_SHIFT_REG
+    uint32_t raw[SLOT_WORDS];
+    if (slot_scanner_read(raw, SLOT_WORDS) == ESP_OK) {
+        memcpy(slot_state, raw, sizeof(slot_state));
+    }
+#else
+    for (int pin = 0; pin < GPIO_PIN_COUNT; ++pin) {
+        if (pin_to_slot[pin] >= 0) {
+            set_slot_state(pin_to_slot[pin], gpio_get_level(pin) == 0);
+        }
     }
+#endif
 }
 
-static void send_state_task()
+static void slot_changed(int slot, bool pressed, uint32_t now)
 {
-    while(1) {
-        if (millis() > send_time) {
-            refresh_buttons();
-            char* button_state_json = get_button_state_json();
-            char* post_response = calloc(MAX_HTTP_OUTPUT_BUFFER, sizeof(char));
-            printf("Send to server: %s\n", button_state_json);
-            http_post("pantry-io-api.herokuapp.com", "/db", post_response, button_state_json, true);
-            ESP_LOGI("TAG", "POST data: %s", post_response);
-            free(post_response);
-            free(button_state_json);
-            send_time = millis() + 1000*60*60;
-        }
-        vTaskDelay(1000);
+    set_slot_state(slot, pressed);
+    uint32_t seq = button_event_push(slot, pressed, now);
+    metrics_gauge_max(METRIC_EVENT_QUEUE_DEPTH, button_events_pending());
+    for (size_t i = 0; i < state_subscriber_count; ++i) {
+        state_subscribers[i].listener(seq, state_subscribers[i].ctx);
+    }
+    if (send_task_handle != NULL) {
+        xTaskNotifyGive(send_task_handle);
     }
 }
 
+typedef struct {
+    const char* unit_id;
+    const journal_event_t* events;
+    size_t n;
+    uint32_t dropped;
+    bool replay;
+} event_batch_t;
 
+typedef struct {
+    const char* unit_id;
+    uint32_t seq;
+    uint32_t state[SLOT_WORDS];
+#ifdef CONFIG_LOAD_CELLS
+    int32_t quantities[LOAD_CHANNEL_COUNT];
+#endif
+} snapshot_t;
 
-static void gpio_task(void* arg)
+/* Snapshots wait here until the uploader has sent them */
+static snapshot_t snapshot_queue[UPLOAD_QUEUE_LEN];
+static size_t snapshot_head = 0;
+static size_t snapshot_count = 0;
+static portMUX_TYPE snapshot_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Build functions run twice per upload, everything they write is copied into ctx first. */
+static void write_event_batch(json_writer_t* w, void* ctx)
 {
-    uint32_t io_num;
-    for(;;) {
-        if(xQueueReceive(gpio_evt_queue, &io_num, portMAX_DELAY)) {
-            for (int i=0; i<=buttons_size; ++i) {
-                if (buttons[i].pin != io_num) {
-                    continue;
-                }
-                uint32_t time_between = (millis() - buttons[i].previous_time);
-                if (time_between > BOUNCE_TIME_MS) {
-                    bool current_state_pressed = (gpio_get_level(io_num) == 0);
-                    buttons[i].state = current_state_pressed;
-                    buttons[i].previous_time = millis();
-                }
+    /* {"unit_id":"x","dropped":0,"replay":false,"events":[[seq,time_ms,slot,state],...]} */
+    const event_batch_t* batch = ctx;
+    json_begin_object(w);
+    json_key(w, "unit_id");
+    json_string(w, batch->unit_id);
+    json_key(w, "dropped");
+    json_uint(w, batch->dropped);
+    json_key(w, "replay");
+    json_bool(w, batch->replay);
+    json_key(w, "events");
+    json_begin_array(w);
+    for (size_t i = 0; i < batch->n; ++i) {
+        json_begin_array(w);
+        json_uint(w, batch->events[i].seq);
+        json_uint(w, batch->events[i].timestamp);
+        json_uint(w, batch->events[i].slot);
+        json_uint(w, batch->events[i].state);
+        json_end_array(w);
+    }
+    json_end_array(w);
+    json_end_object(w);
+}
+
+static void write_snapshot(json_writer_t* w, void* ctx)
+{
+    /* {"unit_id":"x","seq":0,"items":[1,0,...],"quantities":[12345,...]} */
+    const snapshot_t* snapshot = ctx;
+    json_begin_object(w);
+    json_key(w, "unit_id");
+    json_string(w, snapshot->unit_id);
+    json_key(w, "seq");
+    json_uint(w, snapshot->seq);
+    json_key(w, "items");
+    json_begin_array(w);
+    for (int i = 0; i < SLOT_COUNT; ++i) {
+        json_uint(w, (snapshot->state[i / 32] >> (i % 32)) & 1);
+    }
+    json_end_array(w);
+#ifdef CONFIG_LOAD_CELLS
+    json_key(w, "quantities");
+    json_begin_array(w);
+    for (int i = 0; i < LOAD_CHANNEL_COUNT; ++i) {
+        json_int(w, snapshot->quantities[i]);
+    }
+    json_end_array(w);
+#endif
+    json_end_object(w);
+}
+
+static void frame_event_batch(frame_writer_t* w, void* ctx)
+{
+    const event_batch_t* batch = ctx;
+    uint32_t seq = batch->n > 0 ? batch->events[0].seq : 0;
+    uint32_t timestamp = 0;
+    frame_header(w, STATE_FRAME_EVENTS, 0, batch->unit_id, seq);
+    frame_varint(w, batch->dropped);
+    frame_u8(w, batch->replay);
+    frame_varint(w, batch->n);
+    for (size_t i = 0; i < batch->n; ++i) {
+        frame_varint(w, batch->events[i].seq - seq);
+        frame_varint(w, batch->events[i].timestamp - timestamp);
+        frame_varint(w, (uint32_t) batch->events[i].slot << 1 | batch->events[i].state);
+        seq = batch->events[i].seq;
+        timestamp = batch->events[i].timestamp;
+    }
+}
+
+static void frame_snapshot(frame_writer_t* w, void* ctx)
+{
+    const snapshot_t* snapshot = ctx;
+#ifdef CONFIG_LOAD_CELLS
+    frame_header(w, STATE_FRAME_SNAPSHOT, STATE_FRAME_QUANTITIES, snapshot->unit_id, snapshot->seq);
+    frame_bits(w, snapshot->state, SLOT_COUNT);
+    frame_varint(w, LOAD_CHANNEL_COUNT);
+    for (int i = 0; i < LOAD_CHANNEL_COUNT; ++i) {
+        frame_svarint(w, snapshot->quantities[i]);
+    }
+#else
+    frame_header(w, STATE_FRAME_SNAPSHOT, 0, snapshot->unit_id, snapshot->seq);
+    frame_bits(w, snapshot->state, SLOT_COUNT);
+#endif
+}
+
+static http_result_t post_state(const char* path, http_response_t* response,
+                                json_build_fn build_json, frame_build_fn build_frame, void* ctx)
+{
+    /**
+     * Frames go out with their own Content-Type. A server that answers 415 does not
+     * know them yet, the same payload is sent as JSON and JSON is kept from then on.
+     */
+    if (state_encoding == STATE_ENCODING_FRAME) {
+        int len = frame_build(frame_buf, sizeof(frame_buf), build_frame, ctx);
+        if (len >= 0) {
+            http_result_t result = transport_post_data(api_host(), path, response, STATE_FRAME_CONTENT_TYPE,
+                                                       frame_buf, len);
+            if (result != HTTP_RESULT_REJECTED || response->status != HTTP_UNSUPPORTED_MEDIA_TYPE) {
+                return result;
             }
-            send_time = millis() + 5*1000;
+            ESP_LOGW(__func__, "Server does not accept binary frames, falling back to JSON");
+            state_encoding = STATE_ENCODING_JSON;
         }
     }
+    return transport_post_json(api_host(), path, response, build_json, ctx);
 }
 
-void init_debouncer(uint64_t button_flag)
+static http_result_t post_events(const journal_event_t* events, size_t n, bool replay)
 {
-    uint8_t num_buttons = 0;
-
-    for (int pin=0; pin<=39; pin++) {
-        if ((1ULL<<pin) & button_flag) {
-            num_buttons++;
+    const char* unit_id = get_unit_id();
+    event_batch_t batch = {
+        .unit_id = unit_id,
+        .events = events,
+        .n = n,
+        .dropped = button_events_dropped() + journal_lost_records(),
+        .replay = replay,
+    };
+    http_response_t response = {
+        .buf = post_response,
+        .size = sizeof(post_response),
+    };
+    DLOG(DLOG_UPLOAD_EVENTS, n);
+    char path[HTTP_URL_MAX_LEN];
+    api_path(path, sizeof(path), EVENTS_SUFFIX);
+    http_result_t result = post_state(path, &response, write_event_batch, frame_event_batch, &batch);
+    if (result == HTTP_RESULT_OK) {
+        uint32_t now = millis();
+        for (size_t i = 0; i < n; ++i) {
+            metrics_record_ms(METRIC_DEBOUNCE_TO_UPLOAD, now - events[i].timestamp);
         }
+    } else if (result == HTTP_RESULT_REJECTED) {
+        // Sending the same batch again will not help, drop it.
+        ESP_LOGE(__func__, "Server rejected %u events: %s", (unsigned) n, post_response);
+        upload_stats.rejected_events += n;
     }
-    buttons_size = num_buttons;
-    buttons = calloc(sizeof(button_t), num_buttons);
+    return result;
+}
 
-    int i = 0;
-    for (int pin=0; pin<=39; pin++) {
-        if ((1ULL<<pin) & button_flag) {
-            buttons[i].pin = pin;
-            buttons[i].state = (gpio_get_level(pin) == 0);
-            printf("Init GPIO[%d] intr, val: %d\n", pin, gpio_get_level(pin));
-            ++i;
+static bool network_ready(void)
+{
+    // Fail fast into the journal and backoff instead of letting the TLS connect time out.
+    if (wifi_wait_connected(UPLOAD_IP_TIMEOUT_MS)) {
+        return true;
+    }
+    ESP_LOGW(__func__, "No IP address, upload postponed");
+    return false;
+}
+
+static http_result_t replay_journal(void)
+{
+    journal_pos_t next;
+    while (journal_pending()) {
+        size_t n = journal_read(upload, JOURNAL_REPLAY_BATCH, &next);
+        if (n == 0) {
+            // Only skipped records were left, or the read failed.
+            return journal_pending() ? HTTP_RESULT_NETWORK : HTTP_RESULT_OK;
         }
+        http_result_t result = post_events(upload, n, true);
+        if (result != HTTP_RESULT_OK && result != HTTP_RESULT_REJECTED) {
+            return result;
+        }
+        journal_commit(next);
+    }
+    return HTTP_RESULT_OK;
+}
+
+static http_result_t send_event_batch(void)
+{
+    size_t n = button_events_peek(batch, max_batch);
+    if (n == 0) {
+        return HTTP_RESULT_NONE;
+    }
+    // Journaled events are older, they go out first.
+    http_result_t result = network_ready() ? replay_journal() : HTTP_RESULT_NETWORK;
+
+    for (size_t i = 0; i < n; ++i) {
+        upload[i].seq = batch[i].seq;
+        upload[i].timestamp = batch[i].timestamp;
+        upload[i].slot = batch[i].slot;
+        upload[i].state = batch[i].state;
+    }
+    if (result == HTTP_RESULT_OK) {
+        result = post_events(upload, n, false);
     }
+    bool retry = result != HTTP_RESULT_OK && result != HTTP_RESULT_REJECTED;
+    if (retry && journal_append(upload, n) != ESP_OK) {
+        // Not persisted either, keep them in RAM and retry later.
+        return result;
+    }
+    button_events_ack(batch[n - 1].seq);
+    return result;
 }
 
-char* get_button_state_json()
+static void take_snapshot(snapshot_t* snapshot, const char* unit_id)
 {
-    char* json_list = malloc((2*buttons_size + 4 + 30) * sizeof(char));
+    snapshot->unit_id = unit_id;
+    snapshot->seq = button_events_last_seq();
+    memcpy(snapshot->state, slot_state, sizeof(snapshot->state));
+#ifdef CONFIG_LOAD_CELLS
+    load_cells_read(snapshot->quantities, LOAD_CHANNEL_COUNT);
+#endif
+}
 
-    sprintf(json_list, "{\"unit_id\":\"%s\", \"items\":", get_unit_id());
+static void queue_snapshot(const snapshot_t* snapshot)
+{
+    // Producers never wait for the network, the oldest queued snapshot makes room.
+    portENTER_CRITICAL(&snapshot_lock);
+    if (snapshot_count == UPLOAD_QUEUE_LEN) {
+        snapshot_head = (snapshot_head + 1) % UPLOAD_QUEUE_LEN;
+        snapshot_count--;
+        upload_stats.dropped_snapshots++;
+    }
+    snapshot_queue[(snapshot_head + snapshot_count) % UPLOAD_QUEUE_LEN] = *snapshot;
+    snapshot_count++;
+    size_t depth = snapshot_count;
+    portEXIT_CRITICAL(&snapshot_lock);
+    metrics_gauge_max(METRIC_SNAPSHOT_QUEUE_DEPTH, depth);
+}
 
-    char* list_moder = json_list + strlen(json_list);
+static bool peek_snapshot(snapshot_t* snapshot)
+{
+    portENTER_CRITICAL(&snapshot_lock);
+    bool queued = snapshot_count > 0;
+    if (queued) {
+        *snapshot = snapshot_queue[snapshot_head];
+    }
+    portEXIT_CRITICAL(&snapshot_lock);
+    return queued;
+}
 
-    *list_moder = '[';
-    for (int i = 0; i < buttons_size; ++i) {
-        ++list_moder;
-        if (buttons[i].state) {
-            *list_moder = '1';
+static void pop_snapshot(void)
+{
+    portENTER_CRITICAL(&snapshot_lock);
+    if (snapshot_count > 0) {
+        snapshot_head = (snapshot_head + 1) % UPLOAD_QUEUE_LEN;
+        snapshot_count--;
+    }
+    portEXIT_CRITICAL(&snapshot_lock);
+}
+
+void request_state_upload(void)
+{
+    snapshot_t snapshot;
+    take_snapshot(&snapshot, NULL);
+    queue_snapshot(&snapshot);
+    if (send_task_handle != NULL) {
+        xTaskNotifyGive(send_task_handle);
+    }
+}
+
+static http_result_t send_snapshot(void)
+{
+    snapshot_t snapshot;
+    if (!peek_snapshot(&snapshot)) {
+        return HTTP_RESULT_NONE;
+    }
+    if (!network_ready()) {
+        return HTTP_RESULT_NETWORK;
+    }
+    // The unit id is looked up now, a queued pointer could outlive the config value.
+    snapshot.unit_id = get_unit_id();
+    http_response_t response = {
+        .buf = post_response,
+        .size = sizeof(post_response),
+    };
+    DLOG(DLOG_UPLOAD_SNAPSHOT);
+    char path[HTTP_URL_MAX_LEN];
+    api_path(path, sizeof(path), "");
+    http_result_t result = post_state(path, &response, write_snapshot, frame_snapshot, &snapshot);
+    DLOG_S(DLOG_UPLOAD_RESPONSE, post_response, response.status, response.total);
+    if (result == HTTP_RESULT_OK) {
+        replay_journal();
+    } else if (result == HTTP_RESULT_REJECTED) {
+        upload_stats.dropped_snapshots++;
+    }
+    if (result == HTTP_RESULT_OK || result == HTTP_RESULT_REJECTED) {
+        pop_snapshot();
+    }
+    return result;
+}
+
+static void upload_done(http_result_t result)
+{
+    if (result == HTTP_RESULT_NONE) {
+        return;
+    }
+    wifi_request_done(result != HTTP_RESULT_NETWORK);
+    if (result == HTTP_RESULT_OK || result == HTTP_RESULT_REJECTED) {
+        // A refused payload is dropped rather than retried, but it does not prove a new image works.
+        if (result == HTTP_RESULT_OK) {
+            upload_stats.uploads++;
+#ifdef CONFIG_OTA_UPDATES
+            ota_upload_succeeded();
+#endif
         } else {
-            *list_moder = '0';
+            upload_stats.rejected++;
         }
-        ++list_moder;
-        *list_moder = ',';
+        failed_uploads = 0;
+        schedule_cancel(SCHEDULE_RETRY);
+        return;
     }
-    *list_moder = ']';
-    ++list_moder;
-    *list_moder = '}';
-    ++list_moder;
-    *list_moder = '\0';
+    uint32_t delay_ms = backoff_delay_ms(failed_uploads, RETRY_MIN_MS, RETRY_MAX_MS);
+    failed_uploads++;
+    upload_stats.failed++;
+    schedule_in(SCHEDULE_RETRY, delay_ms * 1000ULL);
+    ESP_LOGW(__func__, "Upload failed (%d), retry in %u ms", result, (unsigned) delay_ms);
+}
 
-    return json_list;
+void get_upload_stats(upload_stats_t* stats)
+{
+    portENTER_CRITICAL(&snapshot_lock);
+    *stats = upload_stats;
+    stats->queued_snapshots = snapshot_count;
+    portEXIT_CRITICAL(&snapshot_lock);
+}
+
+typedef struct {
+    const char* unit_id;
+    edge_stats_t edges;
+    upload_stats_t uploads;
+    http_stats_t http;
+#ifdef CONFIG_PUSH_MQTT
+    push_stats_t push;
+#endif
+#ifdef CONFIG_POWER_MANAGEMENT
+    power_stats_t power;
+#endif
+    metrics_snapshot_t metrics;
+} telemetry_t;
+
+static void write_telemetry(json_writer_t* w, void* ctx)
+{
+    /* {"unit_id":"x","edges":[...],"uploads":[...],"http":[...],<metrics_write_json fields>} */
+    const telemetry_t* telemetry = ctx;
+    json_begin_object(w);
+    json_key(w, "unit_id");
+    json_string(w, telemetry->unit_id);
+    json_key(w, "edges");
+    json_begin_array(w);
+    json_uint(w, telemetry->edges.edges);
+    json_uint(w, telemetry->edges.coalesced);
+    json_uint(w, telemetry->edges.throttled);
+    json_uint(w, telemetry->edges.dropped);
+    json_end_array(w);
+    json_key(w, "uploads");
+    json_begin_array(w);
+    json_uint(w, telemetry->uploads.uploads);
+    json_uint(w, telemetry->uploads.failed);
+    json_uint(w, telemetry->uploads.rejected_events);
+    json_uint(w, telemetry->uploads.dropped_snapshots);
+    json_uint(w, telemetry->uploads.rejected);
+    json_end_array(w);
+    json_key(w, "http");
+    json_begin_array(w);
+    json_uint(w, telemetry->http.warm_requests);
+    json_uint(w, telemetry->http.cold_requests);
+    json_uint(w, telemetry->http.reconnects);
+    json_uint(w, telemetry->http.failed_requests);
+    json_uint(w, telemetry->http.body_bytes);
+    json_end_array(w);
+#ifdef CONFIG_PUSH_MQTT
+    json_key(w, "push");
+    json_begin_array(w);
+    json_uint(w, telemetry->push.publishes);
+    json_uint(w, telemetry->push.failed);
+    json_uint(w, telemetry->push.bytes);
+    json_uint(w, telemetry->push.commands);
+    json_uint(w, telemetry->push.connects);
+    json_end_array(w);
+#endif
+#ifdef CONFIG_POWER_MANAGEMENT
+    json_key(w, "power");
+    json_begin_array(w);
+    json_uint(w, telemetry->power.network_locks);
+    json_uint(w, telemetry->power.network_ms);
+    json_end_array(w);
+#endif
+    metrics_write_json(w, &telemetry->metrics);
+    json_end_object(w);
 }
 
+static void send_telemetry(void)
+{
+    static telemetry_t telemetry;  // Only used by the uploader, too big for its stack
+    http_response_t response = {
+        .buf = post_response,
+        .size = sizeof(post_response),
+    };
+
+    if (!network_ready()) {
+        return;
+    }
+    telemetry.unit_id = get_unit_id();
+    get_edge_stats(&telemetry.edges);
+    get_upload_stats(&telemetry.uploads);
+    http_get_stats(&telemetry.http);
+#ifdef CONFIG_PUSH_MQTT
+    get_push_stats(&telemetry.push);
+#endif
+#ifdef CONFIG_POWER_MANAGEMENT
+    get_power_stats(&telemetry.power);
+#endif
+    metrics_snapshot(&telemetry.metrics);
+    DLOG(DLOG_UPLOAD_TELEMETRY);
+    char path[HTTP_URL_MAX_LEN];
+    api_path(path, sizeof(path), TELEMETRY_SUFFIX);
+    transport_post_json(api_host(), path, &response, write_telemetry, &telemetry);
+}
+
+static http_result_t report_cycle(http_result_t (*send)(void), const char* name)
+{
+#ifdef CONFIG_HEAP_TRACE_GATE
+    heap_gate_begin();
+    http_result_t result = send();
+    heap_gate_end(name);
+    return result;
+#else
+    return send();
+#endif
+}
+
+static void send_state_task()
+{
+    /**
+     * The only task that talks to the server. Button changes and snapshot requests
+     * are queued by the producers, this task coalesces and sends them, and backs
+     * off after a failure. It sleeps until a producer or one of the schedules
+     * notifies it, nothing is polled.
+     */
+    init_report_schedule(xTaskGetCurrentTaskHandle());
+    schedule_in(SCHEDULE_HEARTBEAT, FIRST_HEARTBEAT_MS * 1000ULL);
+    schedule_in(SCHEDULE_TELEMETRY, FIRST_HEARTBEAT_MS * 1000ULL);
+    schedule_in(SCHEDULE_CONFIG, FIRST_CONFIG_CHECK_MS * 1000ULL);
+
+    while(1) {
+        int64_t now = esp_timer_get_time();
+        bool retry_wait = schedule_waiting(SCHEDULE_RETRY, now);
+        button_event_t oldest;
+        snapshot_t snapshot;
+
+        // A shorter heartbeat from the remote configuration applies right away.
+        if (schedule_deadline(SCHEDULE_HEARTBEAT) - now > heartbeat_ms() * 1000LL) {
+            schedule_in(SCHEDULE_HEARTBEAT, heartbeat_ms() * 1000ULL);
+        }
+        if (schedule_due(SCHEDULE_HEARTBEAT, now)) {
+            refresh_buttons();
+            request_state_upload();
+            schedule_in(SCHEDULE_HEARTBEAT, heartbeat_ms() * 1000ULL);
+            continue;
+        }
+#if CONFIG_REMOTE_CONFIG_PERIOD_S > 0
+        if (schedule_due(SCHEDULE_CONFIG, now) && !retry_wait) {
+            if (network_ready()) {
+                remote_config_check(api_host());
+            }
+            schedule_in(SCHEDULE_CONFIG, CONFIG_REMOTE_CONFIG_PERIOD_S * 1000000ULL);
+            continue;
+        }
+#endif
+#if CONFIG_METRICS_TELEMETRY_PERIOD_S > 0
+        if (schedule_due(SCHEDULE_TELEMETRY, now) && !retry_wait) {
+            send_telemetry();
+            schedule_in(SCHEDULE_TELEMETRY, CONFIG_METRICS_TELEMETRY_PERIOD_S * 1000000ULL);
+            continue;
+        }
+#endif
+        if (button_events_peek(&oldest, 1)) {
+            // Coalesce a burst of changes into one delta upload.
+            int32_t age_ms = millis() - oldest.timestamp;
+            int64_t due = now + ((int64_t) coalesce_time_ms - age_ms) * 1000;
+            if (button_events_pending() >= max_batch) {
+                due = now;
+            }
+            if (retry_wait && schedule_deadline(SCHEDULE_RETRY) > due) {
+                due = schedule_deadline(SCHEDULE_RETRY);
+            }
+            if (due <= now) {
+                upload_done(report_cycle(send_event_batch, "events"));
+                continue;
+            }
+            if (!schedule_waiting(SCHEDULE_BATCH, now) || schedule_deadline(SCHEDULE_BATCH) != due) {
+                schedule_at(SCHEDULE_BATCH, due);
+            }
+        } else {
+            schedule_cancel(SCHEDULE_BATCH);
+        }
+        // While backing off the retry schedule wakes us, it is already armed.
+        if ((peek_snapshot(&snapshot) || journal_pending()) && !retry_wait) {
+            // Offline counts as a failed upload, so the retry schedule paces the next attempt.
+            if (!network_ready()) {
+                upload_done(HTTP_RESULT_NETWORK);
+            } else if (journal_pending()) {
+                upload_done(replay_journal());
+            } else {
+                upload_done(report_cycle(send_snapshot, "snapshot"));
+            }
+            continue;
+        }
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+#ifdef CONFIG_BUTTON_FRONTEND_GPIO
 void init_input_buttons(uint64_t button_flag)
 {
-    init_debouncer(button_flag);
+    refresh_buttons();
 
-    for  (int pin=0; pin<=39; pin++) {
+    for (int pin = 0; pin < GPIO_PIN_COUNT; pin++) {
         uint64_t pin_flag = (1ULL<<pin);
         if (pin_flag & button_flag) {
+            int level = gpio_get_level(pin);
+            printf("Init GPIO[%d] intr, slot: %d, val: %d\n", pin, pin_to_slot[pin], level);
+#ifdef CONFIG_POWER_LIGHT_SLEEP
+            if (level == 0) {
+                wait_high_pins |= pin_flag;
+            }
+            ESP_ERROR_CHECK(gpio_wakeup_enable(pin, level ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL));
+#else
             gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE);
+#endif
             gpio_isr_handler_add(pin, gpio_isr_handler, (void*) pin);
         }
     }
+#ifdef CONFIG_POWER_LIGHT_SLEEP
+    ESP_ERROR_CHECK(esp_sleep_enable_gpio_wakeup());
+#endif
+}
+
+static void gpio_task(void* arg)
+{
+    // The interrupt is allocated on the core that installs the service, keep it with this task.
+    gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
+    init_input_buttons(BUTTON_GPIO_MASK);
+
+    uint64_t recheck_pins = 0;
+    for(;;) {
+        // Pins still bouncing are read again once their bounce time has passed.
+        ulTaskNotifyTake(pdTRUE, recheck_pins ? pdMS_TO_TICKS(bounce_ms()) + 1 : portMAX_DELAY);
+
+        portENTER_CRITICAL(&isr_lock);
+        uint64_t pins = pending_pins | recheck_pins;
+        bool throttled = throttled_pins != 0;
+        pending_pins = 0;
+        portEXIT_CRITICAL(&isr_lock);
+        recheck_pins = 0;
+
+        if (throttled && !esp_timer_is_active(rearm_timer)) {
+            esp_timer_start_once(rearm_timer, ISR_THROTTLE_TIME_MS * 1000);
+        }
+
+        uint32_t now = millis();
+        uint32_t bounce = bounce_ms();
+        while (pins) {
+            int pin = __builtin_ctzll(pins);
+            pins &= pins - 1;
+            int slot = pin_to_slot[pin];
+            if (slot < 0) {
+                continue;
+            }
+            if (now - slot_changed_at[slot] <= bounce) {
+                recheck_pins |= 1ULL << pin;
+                continue;
+            }
+            portENTER_CRITICAL(&isr_lock);
+            int64_t edge_at = first_edge_at[pin];
+            first_edge_at[pin] = 0;
+            portEXIT_CRITICAL(&isr_lock);
+
+            bool current_state_pressed = (gpio_get_level(pin) == 0);
+            if (current_state_pressed != get_slot_state(slot)) {
+                slot_changed(slot, current_state_pressed, now);
+                slot_changed_at[slot] = now;
+                if (edge_at != 0) {
+                    metrics_record_us(METRIC_ISR_TO_DEBOUNCE, esp_timer_get_time() - edge_at);
+                }
+#ifdef CONFIG_INPUT_LATENCY_BENCH
+                latency_bench_accepted();
+#endif
+            }
+        }
+    }
 }
+#endif
 
+#ifdef CONFIG_BUTTON_FRONTEND_SHIFT_REG
+static void scan_task(void* arg)
+{
+    /**
+     * A raw change has to stay stable for the bounce time before it is accepted.
+     * Only the bits that differ from the debounced state are visited.
+     */
+    uint32_t raw[SLOT_WORDS];
+    uint32_t previous_raw[SLOT_WORDS];
+    memcpy(previous_raw, slot_state, sizeof(previous_raw));
+    TickType_t last_wake = xTaskGetTickCount();
+
+    for(;;) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(CONFIG_BUTTON_SCAN_PERIOD_MS));
+        if (slot_scanner_read(raw, SLOT_WORDS) != ESP_OK) {
+            continue;
+        }
+        uint32_t now = millis();
+        for (int word = 0; word < SLOT_WORDS; ++word) {
+            uint32_t bouncing = raw[word] ^ previous_raw[word];
+            while (bouncing) {
+                int bit = __builtin_ctz(bouncing);
+                bouncing &= bouncing - 1;
+                slot_changed_at[word * 32 + bit] = now;
+            }
+            previous_raw[word] = raw[word];
+
+            uint32_t changed = raw[word] ^ slot_state[word];
+            while (changed) {
+                int bit = __builtin_ctz(changed);
+                changed &= changed - 1;
+                int slot = word * 32 + bit;
+                if (now - slot_changed_at[slot] >= bounce_ms()) {
+                    slot_changed(slot, (raw[word] >> bit) & 1, now);
+                }
+            }
+        }
+    }
+}
+#endif
+
+int get_button_state_json(char* buf, size_t len)
+{
+    snapshot_t snapshot;
+    const char* unit_id = get_unit_id();
+
+    take_snapshot(&snapshot, unit_id);
+    int json_len = json_build(buf, len, write_snapshot, &snapshot);
+    return json_len;
+}
+
+#ifdef CONFIG_BUTTON_FRONTEND_GPIO
 void init_gpio()
 {
     printf("Init gpio");
@@ -148,27 +927,328 @@ void init_gpio()
 
     //interrupt of rising edge
     io_conf.intr_type = GPIO_INTR_POSEDGE;
-    //bit mask of the pins, use GPIO4/5 here
-    io_conf.pin_bit_mask = (1ULL<<GPIO_INPUT_IO_0 | 1ULL<<GPIO_INPUT_IO_1);
+    //bit mask of the slot pins from the project configuration
+    io_conf.pin_bit_mask = BUTTON_GPIO_MASK;
     //set as input mode
     io_conf.mode = GPIO_MODE_INPUT;
     //enable pull-up mode
     io_conf.pull_up_en = 1;
     gpio_config(&io_conf);
 
-    //create a queue to handle gpio event from isr
-    gpio_evt_queue = xQueueCreate(10, sizeof(uint32_t));
-    //start gpio task
-    xTaskCreate(gpio_task, "gpio_task", 2048, NULL, 10, NULL);
+    //timer that unmasks pins throttled by the isr
+    const esp_timer_create_args_t rearm_args = {
+        .callback = rearm_pins,
+        .name = "gpio_rearm",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&rearm_args, &rearm_timer));
+    //start gpio task, it installs the isr service and hooks the slot pins on its own core
+    xTaskCreatePinnedToCore(gpio_task, "gpio_task", CONFIG_INPUT_TASK_STACK, NULL,
+                            CONFIG_INPUT_TASK_PRIORITY, &gpio_task_handle, CONFIG_INPUT_TASK_CORE);
+    metrics_register_task(gpio_task_handle);
+#ifdef CONFIG_INPUT_LATENCY_BENCH
+    init_latency_bench();
+#endif
+}
+#else
+void init_gpio()
+{
+    printf("Init shift register scanner, %d slots\n", SLOT_COUNT);
+    ESP_ERROR_CHECK(init_slot_scanner(CONFIG_BUTTON_SR_CHIPS));
+    refresh_buttons();
+    TaskHandle_t scan_task_handle = NULL;
+    xTaskCreatePinnedToCore(scan_task, "scan_task", CONFIG_INPUT_TASK_STACK, NULL,
+                            CONFIG_INPUT_TASK_PRIORITY, &scan_task_handle, CONFIG_INPUT_TASK_CORE);
+    metrics_register_task(scan_task_handle);
+}
+#endif
 
-    //install gpio isr service
-    gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
-    //hook isr handler for specific gpio pin
-    init_input_buttons(io_conf.pin_bit_mask);
+int subscribe_state_changes(state_listener_t listener, void* ctx)
+{
+    // Listeners run in the input task, they must only signal and return.
+    if (state_subscriber_count >= STATE_MAX_LISTENERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    state_subscribers[state_subscriber_count].listener = listener;
+    state_subscribers[state_subscriber_count].ctx = ctx;
+    state_subscriber_count++;
+    return ESP_OK;
+}
+
+void set_state_encoding(state_encoding_t encoding)
+{
+    state_encoding = encoding;
+}
+
+void set_report_coalescing(uint32_t window_ms, size_t batch_size)
+{
+    if (batch_size == 0 || batch_size > DEFAULT_MAX_BATCH) {
+        batch_size = DEFAULT_MAX_BATCH;
+    }
+    coalesce_time_ms = window_ms;
+    max_batch = batch_size;
+    if (send_task_handle != NULL) {
+        xTaskNotifyGive(send_task_handle);
+    }
+}
+
+#ifdef CONFIG_LOAD_CELLS
+static void on_load_change(void* ctx)
+{
+    // Only values past the hysteresis get here, each one is worth a snapshot.
+    request_state_upload();
+}
+#endif
+
+#ifdef CONFIG_PUSH_MQTT
+static void on_push_command(const char* command, void* ctx)
+{
+    /* "upload", "coalesce <window_ms> <max_batch>", "encoding json|frame" or "ota" */
+    unsigned window_ms = 0;
+    unsigned batch_size = 0;
+    if (strcmp(command, "upload") == 0) {
+        request_state_upload();
+    } else if (sscanf(command, "coalesce %u %u", &window_ms, &batch_size) == 2) {
+        set_report_coalescing(window_ms, batch_size);
+    } else if (strcmp(command, "encoding json") == 0) {
+        set_state_encoding(STATE_ENCODING_JSON);
+    } else if (strcmp(command, "encoding frame") == 0) {
+        set_state_encoding(STATE_ENCODING_FRAME);
+#ifdef CONFIG_OTA_UPDATES
+    } else if (strcmp(command, "ota") == 0) {
+        ota_check_now();
+#endif
+    } else {
+        ESP_LOGW(__func__, "Unknown command: %s", command);
+    }
+}
+#endif
+
+static void apply_remote_config(config_key_t key, void* ctx)
+{
+    /**
+     * Remote values are committed by remote_config_check() in send_state_task, other
+     * commits can come from any task. Hosts, paths and the bounce time are read at
+     * the point of use and need nothing here.
+     */
+    if (key == CFG_COALESCE_MS || key == CFG_MAX_BATCH) {
+        set_report_coalescing(config_get_u32(CFG_COALESCE_MS, DEFAULT_COALESCE_TIME_MS),
+                              config_get_u32(CFG_MAX_BATCH, DEFAULT_MAX_BATCH));
+    } else if (key == CFG_HEARTBEAT_S && send_task_handle != NULL) {
+        // The task owns the schedules and shortens the heartbeat when it wakes up.
+        xTaskNotifyGive(send_task_handle);
+    }
 }
 
 void init_state_sender()
 {
-    send_time = millis() + 1000*30;
-    xTaskCreate(send_state_task, "send_state_task", 4096, NULL, 10, NULL);
-}
\ No newline at end of file
+    apply_remote_config(CFG_COALESCE_MS, NULL);
+    ESP_ERROR_CHECK(config_subscribe(apply_remote_config, NULL));
+    xTaskCreatePinnedToCore(send_state_task, "send_state_task", CONFIG_NETWORK_TASK_STACK, NULL,
+                            CONFIG_NETWORK_TASK_PRIORITY, &send_task_handle, CONFIG_NETWORK_TASK_CORE);
+    metrics_register_task(send_task_handle);
+#ifdef CONFIG_LOAD_CELLS
+    ESP_ERROR_CHECK(subscribe_load_changes(on_load_change, NULL));
+#endif
+#ifdef CONFIG_PUSH_MQTT
+    ESP_ERROR_CHECK(subscribe_push_commands(on_push_command, NULL));
+#endif
+}
+
+#ifdef CONFIG_BUTTON_DEEP_SLEEP
+/*
+ * Battery mode. Every wakeup runs one cycle from app_main: sleep_cycle_collect()
+ * reads the slots, Wi-Fi is only brought up when it returns true, then
+ * sleep_cycle_upload() and sleep_cycle_enter().
+ */
+static RTC_DATA_ATTR bool sleep_initialized = false;
+static RTC_DATA_ATTR uint64_t heartbeat_at = 0;
+static RTC_DATA_ATTR uint64_t sleep_retry_at = 0;
+static RTC_DATA_ATTR sleep_stats_t sleep_stats;
+
+static void read_slot_levels(uint32_t* levels)
+{
+    memset(levels, 0, SLOT_WORDS * sizeof(uint32_t));
+    for (int pin = 0; pin < GPIO_PIN_COUNT; ++pin) {
+        int slot = pin_to_slot[pin];
+        if (slot >= 0 && gpio_get_level(pin) == 0) {
+            levels[slot / 32] |= 1UL << (slot % 32);
+        }
+    }
+}
+
+static uint64_t rtc_ms(void)
+{
+    // Deadlines across deep sleep, 64 bits do not wrap like millis().
+    return esp_rtc_get_time_us() / 1000;
+}
+
+static bool upload_behind(uint64_t now)
+{
+    return button_events_pending() > 0 || journal_pending() || now >= heartbeat_at;
+}
+
+bool sleep_cycle_collect(void)
+{
+    uint32_t last_seq = button_events_last_seq();
+    uint32_t first[SLOT_WORDS];
+    uint32_t second[SLOT_WORDS];
+
+    // Pins that woke the chip are still routed to the RTC mux.
+    for (int pin = 0; pin < GPIO_PIN_COUNT; ++pin) {
+        if (pin_to_slot[pin] >= 0 && rtc_gpio_is_valid_gpio(pin)) {
+            rtc_gpio_deinit(pin);
+        }
+    }
+    gpio_config_t io_conf = {
+        .pin_bit_mask = BUTTON_GPIO_MASK,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = 1,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    gpio_config(&io_conf);
+    sleep_stats.wakeups++;
+
+    if (!sleep_initialized) {
+        printf("Power-up, %d slots\n", SLOT_COUNT);
+        refresh_buttons();
+        heartbeat_at = rtc_ms();
+        sleep_initialized = true;
+        return true;
+    }
+
+    // A change only counts when the level reads the same again after the bounce time.
+    read_slot_levels(second);
+    for (int round = 0; round < SLEEP_DEBOUNCE_ROUNDS; ++round) {
+        memcpy(first, second, sizeof(first));
+        vTaskDelay(pdMS_TO_TICKS(bounce_ms()));
+        read_slot_levels(second);
+        if (memcmp(first, second, sizeof(first)) == 0) {
+            break;
+        }
+    }
+
+    uint32_t timestamp = millis();
+    for (int word = 0; word < SLOT_WORDS; ++word) {
+        uint32_t changed = (second[word] ^ slot_state[word]) & ~(first[word] ^ second[word]);
+        while (changed) {
+            int bit = __builtin_ctz(changed);
+            changed &= changed - 1;
+            slot_changed(word * 32 + bit, (second[word] >> bit) & 1, timestamp);
+        }
+    }
+    ESP_LOGI(__func__, "Wakeup cause %d, %u events pending", esp_sleep_get_wakeup_cause(),
+             (unsigned) button_events_pending());
+
+    if (button_events_last_seq() != last_seq) {
+        return true;
+    }
+    uint64_t now = rtc_ms();
+    return upload_behind(now) && now >= sleep_retry_at;
+}
+
+void sleep_cycle_upload(void)
+{
+    http_result_t result = HTTP_RESULT_OK;
+    while (result != HTTP_RESULT_NETWORK && result != HTTP_RESULT_SERVER && button_events_pending() > 0) {
+        result = send_event_batch();
+    }
+    if (result == HTTP_RESULT_NETWORK) {
+        wifi_request_done(false);
+    }
+    bool sent = result == HTTP_RESULT_OK || result == HTTP_RESULT_REJECTED;
+    if (sent && journal_pending()) {
+        sent = replay_journal() == HTTP_RESULT_OK;
+    }
+    if (rtc_ms() >= heartbeat_at) {
+        request_state_upload();
+        send_snapshot();
+        send_telemetry();
+#if CONFIG_REMOTE_CONFIG_PERIOD_S > 0
+        remote_config_check(api_host());
+#endif
+        heartbeat_at = rtc_ms() + heartbeat_ms();
+    }
+    if (sent) {
+        uint32_t upload_ms = esp_timer_get_time() / 1000;
+        sleep_stats.uploads++;
+        sleep_stats.last_upload_ms = upload_ms;
+        if (upload_ms > sleep_stats.max_upload_ms) {
+            sleep_stats.max_upload_ms = upload_ms;
+        }
+        ESP_LOGI(__func__, "Uploaded %u ms after wakeup", (unsigned) upload_ms);
+    }
+}
+
+void sleep_cycle_enter(void)
+{
+    /**
+     * ext1 on the ESP32 can only wake when any pin goes high or all pins go low.
+     * Pressed slots read low, so they are armed to wake on release. One empty slot
+     * is armed with ext0 on a low level, any other is polled with the timer.
+     */
+    uint64_t now = rtc_ms();
+    uint64_t sleep_ms = heartbeat_at > now ? heartbeat_at - now : heartbeat_ms();
+    uint64_t release_mask = 0;
+    int press_pin = -1;
+    bool poll = false;
+
+    if (upload_behind(now)) {
+        if (sleep_retry_at <= now) {
+            sleep_retry_at = now + CONFIG_BUTTON_SLEEP_RETRY_S * 1000;
+        }
+        if (sleep_retry_at - now < sleep_ms) {
+            sleep_ms = sleep_retry_at - now;
+        }
+    } else {
+        sleep_retry_at = now;
+    }
+
+    for (int pin = 0; pin < GPIO_PIN_COUNT; ++pin) {
+        int slot = pin_to_slot[pin];
+        if (slot < 0) {
+            continue;
+        }
+        if (!rtc_gpio_is_valid_gpio(pin)) {
+            poll = true;
+        } else if (get_slot_state(slot)) {
+            release_mask |= 1ULL << pin;
+        } else if (press_pin < 0) {
+            press_pin = pin;
+        } else {
+            poll = true;
+        }
+    }
+    if (poll && CONFIG_BUTTON_SLEEP_POLL_S * 1000 < sleep_ms) {
+        sleep_ms = CONFIG_BUTTON_SLEEP_POLL_S * 1000;
+    }
+
+    if (release_mask) {
+        ESP_ERROR_CHECK(esp_sleep_enable_ext1_wakeup(release_mask, ESP_EXT1_WAKEUP_ANY_HIGH));
+    }
+    if (press_pin >= 0) {
+        ESP_ERROR_CHECK(esp_sleep_enable_ext0_wakeup(press_pin, 0));
+    }
+    // The digital pull-ups are off in deep sleep, keep the RTC ones powered.
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+    for (int pin = 0; pin < GPIO_PIN_COUNT; ++pin) {
+        if (pin_to_slot[pin] >= 0 && rtc_gpio_is_valid_gpio(pin)) {
+            rtc_gpio_pullup_en(pin);
+            rtc_gpio_pulldown_dis(pin);
+        }
+    }
+    esp_sleep_enable_timer_wakeup(sleep_ms * 1000);
+
+    uint32_t awake_ms = esp_timer_get_time() / 1000;
+    sleep_stats.awake_ms += awake_ms;
+    ESP_LOGI(__func__, "Awake %u ms (%u of %u ms since power-up), sleeping up to %u ms",
+             (unsigned) awake_ms, (unsigned) sleep_stats.awake_ms, (unsigned) now, (unsigned) sleep_ms);
+
+    http_close();
+    esp_deep_sleep_start();
+}
+
+void get_sleep_stats(sleep_stats_t* stats)
+{
+    *stats = sleep_stats;
+}
+#endif
@@ -0,0 +1,20 @@
+/* Ring buffer of debounced button changes waiting to be reported */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BUTTON_EVENT_QUEUE_LEN 64
+
+typedef struct {
+  uint32_t seq;        // Increases by one per change, gaps tell the server events were lost
+  uint32_t timestamp;  // Milliseconds since boot, since power-up with deep sleep
+  uint16_t slot;
+  bool state;
+} button_event_t;
+
+uint32_t button_event_push(uint16_t slot, bool state, uint32_t timestamp);
+size_t button_events_peek(button_event_t *events, size_t max_events);
+void button_events_ack(uint32_t last_seq);
+size_t button_events_pending(void);
+uint32_t button_events_last_seq(void);
+uint32_t button_events_dropped(void);
@@ -2,19 +2,94 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include "sdkconfig.h"
 
 #define BOUNCE_TIME_MS 50
-#define GPIO_INPUT_IO_0      17
-#define GPIO_INPUT_IO_1      5
+#define API_HOST "pantry-io-api.herokuapp.com"
+#define STATE_PATH "/db"             // Default, the remote configuration can move it
+#define EVENTS_SUFFIX "/events"
+#define TELEMETRY_SUFFIX "/telemetry"
+#define HEARTBEAT_TIME_MS (1000*60*60)
+#define FIRST_HEARTBEAT_MS (1000*30)        // First snapshot and telemetry after boot
+#define FIRST_CONFIG_CHECK_MS (1000*10)
+#define DEFAULT_COALESCE_TIME_MS 5000
+#define DEFAULT_MAX_BATCH 32
+#define RETRY_MIN_MS 2000
+#define RETRY_MAX_MS (1000*60*10)
+#define UPLOAD_QUEUE_LEN 4
+#define UPLOAD_IP_TIMEOUT_MS 5000
+#define JOURNAL_REPLAY_BATCH 64
+#define RESPONSE_BUFFER_LEN 512
+#define STATE_FRAME_MAX_LEN 1024    // A full event batch or a snapshot of every slot
+#define HTTP_UNSUPPORTED_MEDIA_TYPE 415
 #define GPIO_OUTPUT_1        18
 #define ESP_INTR_FLAG_DEFAULT 0
+#define GPIO_PIN_COUNT 40
+#define ISR_RATE_WINDOW_MS 100
+#define ISR_MAX_EDGES 20
+#define ISR_THROTTLE_TIME_MS 2000
+#define SLEEP_DEBOUNCE_ROUNDS 10
+#define STATE_MAX_LISTENERS 4
+
+#ifdef CONFIG_BUTTON_FRONTEND_SHIFT_REG
+#define SLOT_COUNT (CONFIG_BUTTON_SR_CHIPS * 8)
+#else
+#define BUTTON_GPIO_MASK ((uint64_t) CONFIG_BUTTON_GPIO_MASK)
+#define SLOT_COUNT __builtin_popcountll(BUTTON_GPIO_MASK)
+/* Slots are numbered in pin order, pins outside the mask map to -1 */
+#define PIN_TO_SLOT(pin) ((int8_t) (((BUTTON_GPIO_MASK >> (pin)) & 1) ? \
+        __builtin_popcountll(BUTTON_GPIO_MASK & ((1ULL << (pin)) - 1)) : -1))
+#endif
+
+#define SLOT_WORDS ((SLOT_COUNT + 31) / 32)
+
+/* Payload format of the event and snapshot uploads, telemetry is always JSON */
+typedef enum {
+  STATE_ENCODING_JSON,
+  STATE_ENCODING_FRAME,     // Binary frame, see state-frame.h
+} state_encoding_t;
+
+/* Called with the event sequence number after every accepted slot change */
+typedef void (*state_listener_t)(uint32_t seq, void* ctx);
 
 typedef struct {
-  uint8_t pin;
-  bool state;
-  uint32_t previous_time;
-} button_t;
+  uint32_t edges;       // Interrupts taken
+  uint32_t coalesced;   // Edges on a pin that was already waiting for gpio_task
+  uint32_t throttled;   // Times a chattering pin had its interrupt masked
+  uint32_t dropped;     // Changes lost because the event ring was full
+} edge_stats_t;
+
+typedef struct {
+  uint32_t uploads;            // Successful uploads of an event batch or snapshot
+  uint32_t failed;             // Failed attempts, each one starts a backoff
+  uint32_t rejected;           // Uploads the server refused with a 4xx, not retried
+  uint32_t rejected_events;    // Events dropped because the server refused them
+  uint32_t dropped_snapshots;  // Snapshots dropped from a full queue or refused
+  uint32_t queued_snapshots;
+} upload_stats_t;
+
+typedef struct {
+  uint32_t wakeups;
+  uint32_t uploads;         // Wakeups that ended with a successful upload
+  uint32_t last_upload_ms;  // Application start until the upload finished, last wakeup
+  uint32_t max_upload_ms;
+  uint32_t awake_ms;        // Total time awake since power-up, for the duty cycle
+} sleep_stats_t;
 
 void init_gpio();
 void init_state_sender();
-char* get_button_state_json();
+int get_button_state_json(char* buf, size_t len);
+bool get_slot_state(int slot);
+void get_edge_stats(edge_stats_t* stats);
+void set_report_coalescing(uint32_t window_ms, size_t max_batch);
+void set_state_encoding(state_encoding_t encoding);
+void request_state_upload(void);
+int subscribe_state_changes(state_listener_t listener, void* ctx);
+void get_upload_stats(upload_stats_t* stats);
+
+#ifdef CONFIG_BUTTON_DEEP_SLEEP
+bool sleep_cycle_collect(void);
+void sleep_cycle_upload(void);
+void sleep_cycle_enter(void);
+void get_sleep_stats(sleep_stats_t* stats);
+#endif
@@ -0,0 +1,5 @@
+/* Edge to slot state latency benchmark, see CONFIG_INPUT_LATENCY_BENCH */
+#include <stdint.h>
+
+void init_latency_bench(void);
+void latency_bench_accepted(void);
@@ -0,0 +1,27 @@
+/* Deadlines of the uploader, each backed by an esp_timer that wakes its task */
+#ifndef _REPORT_SCHEDULE_H_
+#define _REPORT_SCHEDULE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+typedef enum {
+    SCHEDULE_HEARTBEAT,         // Periodic snapshot
+    SCHEDULE_TELEMETRY,
+    SCHEDULE_CONFIG,            // Remote configuration check
+    SCHEDULE_BATCH,             // End of the coalescing window of the oldest event
+    SCHEDULE_RETRY,             // End of the backoff after a failed upload
+    SCHEDULE_COUNT,
+} schedule_id_t;
+
+void init_report_schedule(TaskHandle_t task);
+void schedule_at(schedule_id_t id, int64_t deadline_us);
+void schedule_in(schedule_id_t id, uint64_t delay_us);
+void schedule_cancel(schedule_id_t id);
+bool schedule_due(schedule_id_t id, int64_t now_us);
+bool schedule_waiting(schedule_id_t id, int64_t now_us);
+int64_t schedule_deadline(schedule_id_t id);
+
+#endif
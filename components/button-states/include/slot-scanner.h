@@ -0,0 +1,16 @@
+/* 74HC165 shift register chain read over SPI */
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define SCANNER_MAX_CHIPS 32
+
+typedef struct {
+  uint32_t scans;
+  uint32_t last_scan_us;
+  uint32_t max_scan_us;
+} slot_scanner_stats_t;
+
+esp_err_t init_slot_scanner(size_t chips);
+esp_err_t slot_scanner_read(uint32_t *bits, size_t words);
+void slot_scanner_get_stats(slot_scanner_stats_t *stats);
@@ -0,0 +1,91 @@
+#include "latency-bench.h"
+#include "button-states.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#ifdef CONFIG_INPUT_LATENCY_BENCH
+
+#define BENCH_EDGE_TIMEOUT_MS 200
+
+/*
+ * bench_task drives the output pin and waits until gpio_task reports the slot
+ * change before the next edge, so only one edge is ever in flight.
+ */
+static TaskHandle_t bench_task_handle = NULL;
+static volatile int64_t accepted_at = 0;
+static uint32_t samples[CONFIG_INPUT_LATENCY_BENCH_SAMPLES];
+
+static int compare_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    return (x > y) - (x < y);
+}
+
+static void report(size_t count, uint32_t missed)
+{
+    qsort(samples, count, sizeof(samples[0]), compare_u32);
+    printf("latency bench: %u edges, %u missed, p50 %u us, p99 %u us, max %u us\n",
+           (unsigned) count, (unsigned) missed,
+           (unsigned) samples[count / 2],
+           (unsigned) samples[(count * 99) / 100],
+           (unsigned) samples[count - 1]);
+}
+
+static void bench_task(void* arg)
+{
+    int level = 1;
+    for(;;) {
+        size_t count = 0;
+        uint32_t missed = 0;
+        while (count < CONFIG_INPUT_LATENCY_BENCH_SAMPLES) {
+            // Every edge also queues a snapshot so an upload is running while we measure.
+            request_state_upload();
+            vTaskDelay(pdMS_TO_TICKS(BOUNCE_TIME_MS * 2));
+
+            level = !level;
+            ulTaskNotifyTake(pdTRUE, 0);
+            accepted_at = 0;
+            int64_t toggled_at = esp_timer_get_time();
+            gpio_set_level(CONFIG_INPUT_LATENCY_BENCH_PIN, level);
+
+            if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(BENCH_EDGE_TIMEOUT_MS)) == 0) {
+                missed++;
+                continue;
+            }
+            samples[count++] = accepted_at - toggled_at;
+        }
+        report(count, missed);
+    }
+}
+
+void latency_bench_accepted(void)
+{
+    if (bench_task_handle != NULL) {
+        accepted_at = esp_timer_get_time();
+        xTaskNotifyGive(bench_task_handle);
+    }
+}
+
+void init_latency_bench(void)
+{
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << CONFIG_INPUT_LATENCY_BENCH_PIN,
+        .mode = GPIO_MODE_OUTPUT,
+    };
+    gpio_config(&io_conf);
+    gpio_set_level(CONFIG_INPUT_LATENCY_BENCH_PIN, 1);
+
+    printf("Latency bench on GPIO[%d], wire it to a slot pin\n", CONFIG_INPUT_LATENCY_BENCH_PIN);
+    xTaskCreatePinnedToCore(bench_task, "latency_bench", 2048, NULL, CONFIG_NETWORK_TASK_PRIORITY,
+                            &bench_task_handle, CONFIG_NETWORK_TASK_CORE);
+}
+
+#endif
@@ -0,0 +1,75 @@
+#include "report-schedule.h"
+
+#include "esp_timer.h"
+#include "esp_err.h"
+
+/*
+ * Deadlines are absolute esp_timer microseconds, 64 bits do not wrap. Every
+ * schedule has a one-shot timer that only notifies the task, the task itself
+ * decides what is due by comparing the deadlines with the time. Only the task
+ * that owns the schedules may change them, the timers run in the esp_timer task.
+ */
+static esp_timer_handle_t timers[SCHEDULE_COUNT];
+static int64_t deadlines[SCHEDULE_COUNT];
+static bool armed[SCHEDULE_COUNT];
+static TaskHandle_t schedule_task = NULL;
+
+static const char* const timer_names[SCHEDULE_COUNT] = {
+    "heartbeat",
+    "telemetry",
+    "config",
+    "batch",
+    "retry",
+};
+
+static void schedule_fired(void* arg)
+{
+    xTaskNotifyGive(schedule_task);
+}
+
+void schedule_at(schedule_id_t id, int64_t deadline_us)
+{
+    int64_t now = esp_timer_get_time();
+    esp_timer_stop(timers[id]);
+    deadlines[id] = deadline_us;
+    armed[id] = true;
+    esp_timer_start_once(timers[id], deadline_us > now ? deadline_us - now : 0);
+}
+
+void schedule_in(schedule_id_t id, uint64_t delay_us)
+{
+    schedule_at(id, esp_timer_get_time() + delay_us);
+}
+
+void schedule_cancel(schedule_id_t id)
+{
+    esp_timer_stop(timers[id]);
+    armed[id] = false;
+}
+
+bool schedule_due(schedule_id_t id, int64_t now_us)
+{
+    return armed[id] && deadlines[id] <= now_us;
+}
+
+bool schedule_waiting(schedule_id_t id, int64_t now_us)
+{
+    return armed[id] && deadlines[id] > now_us;
+}
+
+int64_t schedule_deadline(schedule_id_t id)
+{
+    return deadlines[id];
+}
+
+void init_report_schedule(TaskHandle_t task)
+{
+    schedule_task = task;
+    for (int i = 0; i < SCHEDULE_COUNT; ++i) {
+        const esp_timer_create_args_t args = {
+            .callback = schedule_fired,
+            .name = timer_names[i],
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&args, &timers[i]));
+    }
+}
@@ -0,0 +1,107 @@
+#include "slot-scanner.h"
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#ifdef CONFIG_BUTTON_FRONTEND_SHIFT_REG
+
+#define SCANNER_HOST SPI2_HOST
+
+static spi_device_handle_t scanner;
+static size_t chip_count = 0;
+static slot_scanner_stats_t stats;
+DMA_ATTR static uint8_t rx_buffer[SCANNER_MAX_CHIPS];
+
+esp_err_t init_slot_scanner(size_t chips)
+{
+    if (chips == 0 || chips > SCANNER_MAX_CHIPS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    chip_count = chips;
+
+    gpio_config_t load_conf = {
+        .pin_bit_mask = 1ULL << CONFIG_BUTTON_SR_PIN_LOAD,
+        .mode = GPIO_MODE_OUTPUT,
+    };
+    gpio_config(&load_conf);
+    gpio_set_level(CONFIG_BUTTON_SR_PIN_LOAD, 1);
+
+    spi_bus_config_t bus_conf = {
+        .miso_io_num = CONFIG_BUTTON_SR_PIN_DATA,
+        .mosi_io_num = -1,
+        .sclk_io_num = CONFIG_BUTTON_SR_PIN_CLK,
+        .quadwp_io_num = -1,
+        .quadhd_io_num = -1,
+        .max_transfer_sz = SCANNER_MAX_CHIPS,
+    };
+    esp_err_t err = spi_bus_initialize(SCANNER_HOST, &bus_conf, SPI_DMA_CH_AUTO);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // Mode 2: sample on the falling edge, the 74HC165 shifts on the rising one.
+    spi_device_interface_config_t dev_conf = {
+        .mode = 2,
+        .clock_speed_hz = CONFIG_BUTTON_SR_CLOCK_HZ,
+        .spics_io_num = -1,
+        .queue_size = 1,
+    };
+    return spi_bus_add_device(SCANNER_HOST, &dev_conf, &scanner);
+}
+
+esp_err_t slot_scanner_read(uint32_t *bits, size_t words)
+{
+    /**
+     * Latch all inputs and shift them out. The chip closest to the ESP32 comes first,
+     * its input H (D7) is slot 0. Switches pull the inputs low, so a pressed slot
+     * is returned as a set bit.
+     */
+    int64_t start = esp_timer_get_time();
+
+    gpio_set_level(CONFIG_BUTTON_SR_PIN_LOAD, 0);
+    esp_rom_delay_us(1);
+    gpio_set_level(CONFIG_BUTTON_SR_PIN_LOAD, 1);
+
+    spi_transaction_t transaction = {
+        .length = chip_count * 8,
+        .rxlength = chip_count * 8,
+        .rx_buffer = rx_buffer,
+    };
+    esp_err_t err = spi_device_polling_transmit(scanner, &transaction);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    memset(bits, 0, words * sizeof(uint32_t));
+    for (size_t chip = 0; chip < chip_count && chip / 4 < words; ++chip) {
+        uint8_t pressed = ~rx_buffer[chip];
+        // SPI delivers MSB first, reverse so input H lands on the lowest slot.
+        uint8_t reversed = 0;
+        for (int bit = 0; bit < 8; ++bit) {
+            reversed |= ((pressed >> (7 - bit)) & 1) << bit;
+        }
+        bits[chip / 4] |= (uint32_t) reversed << ((chip % 4) * 8);
+    }
+
+    uint32_t elapsed = esp_timer_get_time() - start;
+    stats.scans++;
+    stats.last_scan_us = elapsed;
+    if (elapsed > stats.max_scan_us) {
+        stats.max_scan_us = elapsed;
+    }
+    return ESP_OK;
+}
+
+void slot_scanner_get_stats(slot_scanner_stats_t *out)
+{
+    *out = stats;
+}
+
+#endif
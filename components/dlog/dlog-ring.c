@@ -0,0 +1,150 @@
+#include "dlog-ring.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void dlog_ring_init(dlog_ring_t* ring, dlog_slot_t* slots, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        slots[i].seq = i;
+    }
+    ring->mask = count - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+    __atomic_store_n(&ring->slots, slots, __ATOMIC_RELEASE);
+}
+
+static void fill_record(dlog_record_t* record, uint16_t id, uint32_t time_us,
+                        const uint32_t* args, size_t argc, const char* str)
+{
+    if (argc > DLOG_PAYLOAD_LEN / sizeof(uint32_t)) {
+        argc = DLOG_PAYLOAD_LEN / sizeof(uint32_t);
+    }
+    size_t len = argc * sizeof(uint32_t);
+    // The targets are little endian, the integers are stored as they are in memory.
+    memcpy(record->payload, args, len);
+    if (str != NULL) {
+        size_t n = strnlen(str, DLOG_PAYLOAD_LEN - len);
+        memcpy(record->payload + len, str, n);
+        len += n;
+    }
+    record->time_us = time_us;
+    record->id = id;
+    record->argc = argc;
+    record->len = len;
+}
+
+bool dlog_ring_push(dlog_ring_t* ring, uint16_t id, uint32_t time_us,
+                    const uint32_t* args, size_t argc, const char* str)
+{
+    dlog_slot_t* slots = __atomic_load_n(&ring->slots, __ATOMIC_ACQUIRE);
+    if (slots == NULL) {
+        return false;
+    }
+    dlog_slot_t* slot;
+    uint32_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = &slots[pos & ring->mask];
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int32_t diff = (int32_t) (seq - pos);
+        if (diff == 0) {
+            // On failure pos is reloaded with the current head.
+            if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The consumer has not freed this slot yet, the ring is full.
+            __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        } else {
+            pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+    fill_record(&slot->record, id, time_us, args, argc, str);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool dlog_ring_pop(dlog_ring_t* ring, dlog_record_t* record)
+{
+    if (ring->slots == NULL) {
+        return false;
+    }
+    uint32_t pos = ring->tail;
+    dlog_slot_t* slot = &ring->slots[pos & ring->mask];
+    // A producer that claimed this slot but was preempted before filling it holds up the reader.
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+        return false;
+    }
+    *record = slot->record;
+    __atomic_store_n(&slot->seq, pos + ring->mask + 1, __ATOMIC_RELEASE);
+    ring->tail = pos + 1;
+    return true;
+}
+
+uint32_t dlog_ring_dropped(const dlog_ring_t* ring)
+{
+    return __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+}
+
+int dlog_format(char* buf, size_t size, const char* format, const dlog_record_t* record)
+{
+    /**
+     * A small printf that takes its arguments from the record: every integer
+     * conversion gets the next 32-bit argument, %s gets the string.
+     */
+    size_t n = 0;
+    size_t arg = 0;
+    size_t ints = record->argc * sizeof(uint32_t);
+    const char* str = (const char*) record->payload + ints;
+    int str_len = record->len > ints ? record->len - ints : 0;
+
+    if (size == 0) {
+        return 0;
+    }
+    while (*format != '\0' && n + 1 < size) {
+        if (*format != '%') {
+            buf[n++] = *format++;
+            continue;
+        }
+        char spec[12];
+        size_t s = 0;
+        spec[s++] = *format++;
+        while (*format != '\0' && strchr("-+ #0123456789", *format) != NULL && s < sizeof(spec) - 2) {
+            spec[s++] = *format++;
+        }
+        char conversion = *format;
+        if (conversion == '\0') {
+            break;
+        }
+        format++;
+        spec[s++] = conversion;
+        spec[s] = '\0';
+
+        int written;
+        if (conversion == '%') {
+            written = snprintf(buf + n, size - n, "%%");
+        } else if (conversion == 's') {
+            written = snprintf(buf + n, size - n, "%.*s", str_len, str);
+        } else if (arg < record->argc) {
+            uint32_t value;
+            memcpy(&value, record->payload + arg * sizeof(uint32_t), sizeof(value));
+            arg++;
+            if (conversion == 'd' || conversion == 'i') {
+                written = snprintf(buf + n, size - n, spec, (int) (int32_t) value);
+            } else {
+                written = snprintf(buf + n, size - n, spec, (unsigned) value);
+            }
+        } else {
+            written = snprintf(buf + n, size - n, "?");
+        }
+        if (written < 0) {
+            break;
+        }
+        n += (size_t) written < size - n ? (size_t) written : size - n - 1;
+    }
+    buf[n] = '\0';
+    return n;
+}
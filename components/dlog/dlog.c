@@ -0,0 +1,145 @@
+#include "dlog.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "metrics.h"
+
+#define DLOG_LINE_LEN 160
+#define DLOG_RING_RECORDS (1 << CONFIG_DLOG_RING_ORDER)
+
+/*
+ * Records are only formatted in dlog_task, which runs just above idle and
+ * sleeps CONFIG_DLOG_FLUSH_MS between drains. Producers never notify it, a
+ * notification would take the scheduler lock on every log call.
+ */
+static dlog_slot_t slots[DLOG_RING_RECORDS];
+static dlog_ring_t ring;
+static uint32_t written = 0;
+static TaskHandle_t dlog_task_handle = NULL;
+
+#ifdef CONFIG_DLOG_OUTPUT_TEXT
+static const char* const formats[DLOG_FORMAT_COUNT] = {
+#define DLOG_FORMAT(id, format) format,
+#include "dlog-formats.h"
+#undef DLOG_FORMAT
+};
+#endif
+
+void dlog_write(dlog_id_t id, const char* str, const uint32_t* args, size_t argc)
+{
+    if (dlog_ring_push(&ring, id, (uint32_t) esp_timer_get_time(), args, argc, str)) {
+        __atomic_fetch_add(&written, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void get_dlog_stats(dlog_stats_t* stats)
+{
+    stats->written = __atomic_load_n(&written, __ATOMIC_RELAXED);
+    stats->dropped = dlog_ring_dropped(&ring);
+}
+
+static void emit(const dlog_record_t* record)
+{
+    // The record keeps 32 bits of microseconds, about 71 minutes, unwrap against now.
+    int64_t now = esp_timer_get_time();
+    int64_t time_us = now - (uint32_t) ((uint32_t) now - record->time_us);
+#ifdef CONFIG_DLOG_OUTPUT_TEXT
+    char line[DLOG_LINE_LEN];
+    if (record->id >= DLOG_FORMAT_COUNT) {
+        snprintf(line, sizeof(line), "unknown message %u", (unsigned) record->id);
+    } else {
+        dlog_format(line, sizeof(line), formats[record->id], record);
+    }
+    printf("D (%u) %s\n", (unsigned) (time_us / 1000), line);
+#else
+    // One line per record for dlog_decode.py, other console output passes through it.
+    const uint8_t* bytes = (const uint8_t*) record;
+    size_t len = offsetof(dlog_record_t, payload) + record->len;
+    char line[2 * sizeof(dlog_record_t) + 1];
+    for (size_t i = 0; i < len; ++i) {
+        snprintf(&line[2 * i], 3, "%02x", bytes[i]);
+    }
+    line[2 * len] = '\0';
+    printf("~D%s\n", line);
+    (void) time_us;
+#endif
+}
+
+static void dlog_task(void* arg)
+{
+    dlog_record_t record;
+    uint32_t reported_drops = 0;
+    for(;;) {
+        while (dlog_ring_pop(&ring, &record)) {
+            emit(&record);
+        }
+        uint32_t dropped = dlog_ring_dropped(&ring);
+        if (dropped != reported_drops) {
+            printf("dlog: %u records dropped\n", (unsigned) (dropped - reported_drops));
+            reported_drops = dropped;
+        }
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_DLOG_FLUSH_MS));
+    }
+}
+
+#ifdef CONFIG_DLOG_BENCH
+#define BENCH_REQUESTS 8
+
+static void dlog_bench(void)
+{
+    /**
+     * The console output of one snapshot upload before the deferred log, against
+     * the records that replace it. Runs before dlog_task, the records are
+     * dropped again without being printed.
+     */
+    static const char response[] = "{\"ok\":true,\"unit_id\":\"0123456789abcdef\"}";
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_REQUESTS; ++i) {
+        printf("Send snapshot to server\n");
+        printf("Start request\n");
+        printf("esp client set method: %d\n", 0);
+        printf("Set headers:\n");
+        printf("Set auth header:\n");
+        printf("Headers set %d\n", 0);
+        printf("Set post field %d \n", 0);
+        printf("Perform action");
+        printf("Host: %s, path: %s, %u bytes of %s\n", "api.example.com", "/db", 199u, "application/json");
+        printf("I (%u) log_result: HTTP Status = %d, content_length = %d\n", 0u, 200, 40);
+        printf("I (%u) log_result: Connections warm: %u, cold: %u\n", 0u, 12u, 1u);
+        printf("HTTP done\n");
+        printf("I (%u) TAG: POST data: %s\n", 0u, response);
+    }
+    fflush(stdout);
+    int64_t console_us = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_REQUESTS; ++i) {
+        DLOG(DLOG_UPLOAD_SNAPSHOT);
+        DLOG_S(DLOG_HTTP_REQUEST, "/db", 1, 199, 1);
+        DLOG(DLOG_HTTP_RESULT, 200, 40, 12, 1);
+        DLOG_S(DLOG_UPLOAD_RESPONSE, response, 200, sizeof(response) - 1);
+    }
+    int64_t deferred_us = esp_timer_get_time() - start;
+
+    dlog_record_t record;
+    while (dlog_ring_pop(&ring, &record)) {
+    }
+    printf("dlog bench: console %u us, deferred %u us per request\n",
+           (unsigned) (console_us / BENCH_REQUESTS), (unsigned) (deferred_us / BENCH_REQUESTS));
+}
+#endif
+
+void init_dlog(void)
+{
+    dlog_ring_init(&ring, slots, DLOG_RING_RECORDS);
+#ifdef CONFIG_DLOG_BENCH
+    dlog_bench();
+#endif
+    xTaskCreatePinnedToCore(dlog_task, "dlog_task", CONFIG_DLOG_TASK_STACK, NULL,
+                            CONFIG_DLOG_TASK_PRIORITY, &dlog_task_handle, CONFIG_NETWORK_TASK_CORE);
+    metrics_register_task(dlog_task_handle);
+}
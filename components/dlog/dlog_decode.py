@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+"""Turns the hex records of the deferred log (CONFIG_DLOG_OUTPUT_BINARY) back into text.
+
+Reads a console capture from a file or stdin, e.g. idf.py monitor | dlog_decode.py,
+decodes the lines that start with ~D and passes every other line through.
+"""
+import os
+import re
+import struct
+import sys
+
+FORMATS_H = os.path.join(os.path.dirname(os.path.abspath(__file__)), "include", "dlog-formats.h")
+HEADER = struct.Struct("<IHBB")     # time_us, id, argc, len, see dlog_record_t
+CONVERSION = re.compile(r"%([-+ #0-9]*)([diuxXcs%])")
+
+
+def load_formats(path):
+    with open(path) as f:
+        source = f.read()
+    return [bytes(fmt, "ascii").decode("unicode_escape")
+            for fmt in re.findall(r'^DLOG_FORMAT\(\w+,\s*"((?:[^"\\]|\\.)*)"\)', source, re.M)]
+
+
+def format_record(fmt, args, text):
+    args = iter(args)
+
+    def convert(match):
+        flags, conversion = match.groups()
+        if conversion == "%":
+            return "%"
+        if conversion == "s":
+            return text
+        value = next(args, None)
+        if value is None:
+            return "?"
+        if conversion in "di":
+            value = value - (1 << 32) if value & 0x80000000 else value
+            conversion = "d"
+        elif conversion == "u":
+            conversion = "d"
+        return ("%" + flags + conversion) % value
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def main():
+    formats = load_formats(FORMATS_H)
+    source = open(sys.argv[1], errors="replace") if len(sys.argv) > 1 else sys.stdin
+    latest = None
+    for line in source:
+        marker = line.find("~D")
+        if marker < 0:
+            sys.stdout.write(line)
+            continue
+        try:
+            record = bytes.fromhex(line[marker + 2:].strip())
+            time_us, msg_id, argc, length = HEADER.unpack_from(record)
+        except (ValueError, struct.error):
+            sys.stdout.write(line)
+            continue
+        # Timestamps are 32 bits of microseconds, taken before the slot is claimed, so a
+        # preempted writer can land a little behind its neighbours. Only a step back by more
+        # than half the range is a wrap, smaller ones are placed before the latest record.
+        if latest is None:
+            stamp = time_us
+        else:
+            stamp = latest + ((time_us - latest + (1 << 31)) % (1 << 32)) - (1 << 31)
+        latest = stamp if latest is None else max(latest, stamp)
+        payload = record[HEADER.size:HEADER.size + length]
+        args = struct.unpack_from("<%dI" % argc, payload)
+        text = payload[4 * argc:].decode("utf-8", errors="replace")
+        if msg_id < len(formats):
+            message = format_record(formats[msg_id], args, text)
+        else:
+            message = "unknown message %d %r %r" % (msg_id, args, text)
+        sys.stdout.write("D (%d) %s\n" % (stamp // 1000, message))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,16 @@
+/*
+ * Every deferred log message. The id is the position in this list, so only
+ * append, dlog_decode.py reads this file to turn records back into text.
+ * Conversions: %d %i %u %x %X %c with flags and width for the integer
+ * arguments, and one %s for the string of DLOG_S. No secrets: tokens and
+ * passwords are never passed to DLOG, the formats only have room for lengths
+ * and flags of those.
+ */
+DLOG_FORMAT(DLOG_HTTP_INIT_CLIENT, "Init client")
+DLOG_FORMAT(DLOG_HTTP_REQUEST, "Request %s, method %d, %u bytes, auth %d")
+DLOG_FORMAT(DLOG_HTTP_STREAM, "Stream JSON to %s, auth %d")
+DLOG_FORMAT(DLOG_HTTP_RESULT, "HTTP status %d, content_length %d, connections warm %u cold %u")
+DLOG_FORMAT(DLOG_UPLOAD_EVENTS, "Send %u events to server")
+DLOG_FORMAT(DLOG_UPLOAD_SNAPSHOT, "Send snapshot to server")
+DLOG_FORMAT(DLOG_UPLOAD_TELEMETRY, "Send telemetry to server")
+DLOG_FORMAT(DLOG_UPLOAD_RESPONSE, "Response %d, %u bytes: %s")
@@ -0,0 +1,47 @@
+/* Fixed-size binary log records in a lock-free multi-producer ring */
+#ifndef _DLOG_RING_H_
+#define _DLOG_RING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DLOG_PAYLOAD_LEN 24     // Up to 6 integer arguments, a string gets the bytes they leave
+
+typedef struct {
+    uint32_t time_us;           // Low 32 bits of the timestamp, the reader unwraps it
+    uint16_t id;                // Position in dlog-formats.h
+    uint8_t argc;               // 32-bit little endian arguments at the start of the payload
+    uint8_t len;                // Payload bytes, the string is what follows the integers
+    uint8_t payload[DLOG_PAYLOAD_LEN];
+} dlog_record_t;
+
+typedef struct {
+    uint32_t seq;
+    dlog_record_t record;
+} dlog_slot_t;
+
+/*
+ * Bounded queue after D. Vyukov: producers claim a slot with one compare and
+ * swap on head and publish it through the slot's sequence number, one consumer
+ * reads in order. Nothing blocks, a full ring drops the new record.
+ */
+typedef struct {
+    dlog_slot_t* slots;
+    uint32_t mask;
+    uint32_t head;              // Next slot to claim, shared by the producers
+    uint32_t tail;              // Next slot to read, only touched by the consumer
+    uint32_t dropped;
+} dlog_ring_t;
+
+/* count has to be a power of two */
+void dlog_ring_init(dlog_ring_t* ring, dlog_slot_t* slots, size_t count);
+bool dlog_ring_push(dlog_ring_t* ring, uint16_t id, uint32_t time_us,
+                    const uint32_t* args, size_t argc, const char* str);
+bool dlog_ring_pop(dlog_ring_t* ring, dlog_record_t* record);
+uint32_t dlog_ring_dropped(const dlog_ring_t* ring);
+
+/* Formats a record with its format string, returns the length written */
+int dlog_format(char* buf, size_t size, const char* format, const dlog_record_t* record);
+
+#endif
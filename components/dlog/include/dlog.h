@@ -0,0 +1,37 @@
+/*
+ * Deferred logging for the hot paths. A DLOG call stores the message id and its
+ * integer arguments in a lock-free ring, dlog_task formats and prints them later
+ * at low priority, so the caller never waits for the UART.
+ */
+#ifndef _DLOG_H_
+#define _DLOG_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "dlog-ring.h"
+
+typedef enum {
+#define DLOG_FORMAT(id, format) id,
+#include "dlog-formats.h"
+#undef DLOG_FORMAT
+    DLOG_FORMAT_COUNT,
+} dlog_id_t;
+
+/* Integer arguments only, at most DLOG_PAYLOAD_LEN / 4 of them */
+#define DLOG(id, ...) DLOG_S(id, NULL, ##__VA_ARGS__)
+
+/* Like DLOG with a string for the %s of the format, cut to what fits in the record */
+#define DLOG_S(id, str, ...) \
+    dlog_write(id, str, (const uint32_t[]) {0, ##__VA_ARGS__} + 1, \
+               sizeof((const uint32_t[]) {0, ##__VA_ARGS__}) / sizeof(uint32_t) - 1)
+
+typedef struct {
+    uint32_t written;
+    uint32_t dropped;           // Records lost to a full ring
+} dlog_stats_t;
+
+void dlog_write(dlog_id_t id, const char* str, const uint32_t* args, size_t argc);
+void get_dlog_stats(dlog_stats_t* stats);
+void init_dlog(void);
+
+#endif
@@ -1,53 +1,132 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include "http.h"
 
 #define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 #include "esp_log.h"
-#include "esp_event.h"
 #include "esp_http_client.h"
-#include "esp_netif.h"
 #include "esp_tls.h"
 #include "nvs_init.h"
+#include "json-writer.h"
+#include "metrics.h"
+#include "dlog.h"
+#ifdef CONFIG_HEAP_TRACE_GATE
+#include "heap-gate.h"
+#endif
+#ifdef CONFIG_POWER_MANAGEMENT
+#include "power.h"
+#endif
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+/* One client handle is kept open across requests so that keep-alive connections
+ * and TLS session tickets can be reused instead of doing a full handshake per report. */
+static esp_http_client_handle_t http_client = NULL;
+static SemaphoreHandle_t client_mutex = NULL;
+static http_stats_t stats;
+
+/* What the kept client already has set. esp_http_client copies every value it is
+ * given, set_url even duplicates the old host first, so unchanged values are skipped
+ * and a steady run of requests to one endpoint does not touch the heap for them. */
+static struct {
+    char url[HTTP_URL_MAX_LEN];
+    char content_type[HTTP_CONTENT_TYPE_LEN];
+    char authorization[STR_LENGTH + 8];
+} client_values;
+
+/* esp_http_client, mbedTLS and lwIP allocate per request, so only their calls are
+ * left out of a gated report cycle. Everything this file does around them counts. */
+#ifdef CONFIG_HEAP_TRACE_GATE
+#define UNGATED(call) do { heap_gate_pause(); call; heap_gate_resume(); } while (0)
+#else
+#define UNGATED(call) do { call; } while (0)
+#endif
+
+typedef struct {
+    http_response_t *response;
+    bool new_connection;  // Set by the event handler when the request had to connect
+    bool answered;        // Part of the response arrived, the request must not be sent again
+    bool reading_body;    // The body is read with esp_http_client_read, not from events
+} request_ctx_t;
+
+static void response_append(http_response_t *response, const char *data, size_t len)
+{
+    /* The fixed buffer keeps what fits and marks the rest as truncated, the sink sees everything */
+    if (response == NULL) {
+        return;
+    }
+    response->total += len;
+    if (response->sink != NULL && response->sink(response->sink_ctx, data, len) != 0) {
+        response->truncated = true;
+    }
+    if (response->buf != NULL && response->size > 0) {
+        size_t room = response->size - 1 - response->len;
+        size_t n = len < room ? len : room;
+        memcpy(response->buf + response->len, data, n);
+        response->len += n;
+        response->buf[response->len] = '\0';
+        if (n < len) {
+            response->truncated = true;
+        }
+    }
+}
+
+static void response_reset(http_response_t *response)
+{
+    if (response == NULL) {
+        return;
+    }
+    response->len = 0;
+    response->total = 0;
+    response->status = 0;
+    response->truncated = false;
+    if (response->buf != NULL && response->size > 0) {
+        response->buf[0] = '\0';
+    }
+    if (response->etag != NULL && response->etag_size > 0) {
+        response->etag[0] = '\0';
+    }
+}
 
 static esp_err_t _http_event_handler(esp_http_client_event_t *evt)
 {
-    static char *output_buffer;  // Buffer to store response of http request from event handler
-    static int output_len;       // Stores number of bytes read
+    // Everything about the running request is in user_data, nothing is shared between requests.
+    request_ctx_t *request = (request_ctx_t *) evt->user_data;
     switch(evt->event_id) {
+        case HTTP_EVENT_ON_CONNECTED:
+            ESP_LOGD(__func__, "HTTP_EVENT_ON_CONNECTED");
+            if (request != NULL) {
+                request->new_connection = true;
+            }
+            break;
         case HTTP_EVENT_ON_DATA:
             ESP_LOGD(__func__, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-            /*
-             *  Check for chunked encoding is added as the URL for chunked encoding used in this example returns binary data.
-             *  However, event handler can also be used in case chunked encoding is used.
-             */
-            if (!esp_http_client_is_chunked_response(evt->client)) {
-                // If user_data buffer is configured, copy the response into the buffer
-                if (evt->user_data) {
-                    memcpy(evt->user_data + output_len, evt->data, evt->data_len);
-                } else {
-                    if (output_buffer == NULL) {
-                        output_buffer = (char *) malloc(esp_http_client_get_content_length(evt->client));
-                        output_len = 0;
-                        if (output_buffer == NULL) {
-                            ESP_LOGE(__func__, "Failed to allocate memory for output buffer");
-                            return ESP_FAIL;
-                        }
-                    }
-                    memcpy(output_buffer + output_len, evt->data, evt->data_len);
+            if (request != NULL) {
+                request->answered = true;
+            }
+            // Chunked bodies arrive here already decoded, the status is known so sinks can check it.
+            if (request != NULL && !request->reading_body) {
+                if (request->response != NULL) {
+                    request->response->status = esp_http_client_get_status_code(evt->client);
                 }
-                output_len += evt->data_len;
+                response_append(request->response, evt->data, evt->data_len);
+            }
+            break;
+        case HTTP_EVENT_ON_HEADER:
+            if (request != NULL) {
+                request->answered = true;
+            }
+            if (request != NULL && request->response != NULL && request->response->etag != NULL &&
+                strcasecmp(evt->header_key, "ETag") == 0) {
+                snprintf(request->response->etag, request->response->etag_size, "%s", evt->header_value);
             }
-
             break;
         case HTTP_EVENT_ON_FINISH:
             ESP_LOGD(__func__, "HTTP_EVENT_ON_FINISH");
-            if (output_buffer != NULL) {
-                // Response is accumulated in output_buffer. Uncomment the below line to print the accumulated response
-                ESP_LOG_BUFFER_HEX(__func__, output_buffer, output_len);
-                free(output_buffer);
-                output_buffer = NULL;
-            }
-            output_len = 0;
             break;
         case HTTP_EVENT_DISCONNECTED:
             ESP_LOGI(__func__, "HTTP_EVENT_DISCONNECTED");
@@ -58,11 +137,6 @@ static esp_err_t _http_event_handler(esp_http_client_event_t *evt)
                 ESP_LOGI(__func__, "Last esp error code: 0x%x", err);
                 ESP_LOGI(__func__, "Last mbedtls failure: 0x%x", mbedtls_err);
             }
-            if (output_buffer != NULL) {
-                free(output_buffer);
-                output_buffer = NULL;
-            }
-            output_len = 0;
             break;
         case HTTP_EVENT_REDIRECT:
             ESP_LOGD(__func__, "HTTP_EVENT_REDIRECT");
@@ -74,81 +148,414 @@ static esp_err_t _http_event_handler(esp_http_client_event_t *evt)
     return ESP_OK;
 }
 
+void init_http(void)
+{
+    if (client_mutex == NULL) {
+        client_mutex = xSemaphoreCreateMutex();
+    }
+}
 
-int http_request(const char* host, const char* path, char *response_data, esp_http_client_method_t method, char *data, bool use_auth)
+static esp_http_client_handle_t get_client(const char* host)
 {
-    /**
-     * Sends HTTPS request to host/path with authorization header
-     * Response from server is saved in response_data. 
-     *
-     * NOTE: All the configuration parameters for http_client must be spefied either in URL or as host and path parameters.
-     * If host and path parameters are not set, query parameter will be ignored. In such cases,
-     * query parameter should be specified in URL.
-     *
-     * If URL as well as host and path parameters are specified, values of host and path will be considered.
-     */
-    printf("Start request\n");
-    esp_err_t err = 0;
-    int return_code = 0;
+    if (http_client != NULL) {
+        return http_client;
+    }
     esp_http_client_config_t config = {
         .host = host,
-        .path = path,
+        .path = "/",
         .event_handler = _http_event_handler,
-        .user_data = response_data,        // Pass address of local buffer to get response
         .transport_type = HTTP_TRANSPORT_OVER_SSL,
+        .keep_alive_enable = true,
+        .timeout_ms = HTTP_CONNECT_TIMEOUT_MS,
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        .save_client_session = true,
+#endif
     };
-    printf("Init client\n");
-    esp_http_client_handle_t client = esp_http_client_init(&config);
+    DLOG(DLOG_HTTP_INIT_CLIENT);
+    memset(&client_values, 0, sizeof(client_values));
+    UNGATED(http_client = esp_http_client_init(&config));
+    return http_client;
+}
 
-    err = esp_http_client_set_method(client, method);
+void http_close(void)
+{
+    if (client_mutex == NULL) {
+        return;
+    }
+    xSemaphoreTake(client_mutex, portMAX_DELAY);
+    if (http_client != NULL) {
+        esp_http_client_cleanup(http_client);
+        http_client = NULL;
+        memset(&client_values, 0, sizeof(client_values));
+    }
+    xSemaphoreGive(client_mutex);
+}
 
-    printf("esp client set method: %d\n", err);
-    printf("Set headers:\n");
-    err = esp_http_client_set_header(client, "Content-Type", "application/json");
-    char* token_header = NULL;
-    char* auth_token = NULL;
-    if (use_auth) {
-        printf("Set auth header:\n");
-        token_header = calloc(64, sizeof(char));
-        auth_token = get_auth_token();
-        sprintf(token_header, "Bearer %s", auth_token);
-        err = esp_http_client_set_header(client, "Authorization", token_header);
+static void lock_client(void)
+{
+    init_http();
+    xSemaphoreTake(client_mutex, portMAX_DELAY);
+#ifdef CONFIG_POWER_MANAGEMENT
+    // Full clock for the handshake and the request, the CPU scales down again after.
+    power_network_begin();
+#endif
+}
+
+static void unlock_client(void)
+{
+#ifdef CONFIG_POWER_MANAGEMENT
+    power_network_end();
+#endif
+    xSemaphoreGive(client_mutex);
+}
+
+void http_get_stats(http_stats_t *out)
+{
+    *out = stats;
+}
+
+static http_result_t request_result(esp_http_client_handle_t client, esp_err_t err, http_response_t *response)
+{
+    if (err != ESP_OK) {
+        return HTTP_RESULT_NETWORK;
     }
-    printf("Headers set %d\n", err);
+    int status = esp_http_client_get_status_code(client);
+    if (response != NULL) {
+        response->status = status;
+    }
+    if (status >= 200 && status < 300) {
+        return HTTP_RESULT_OK;
+    }
+    // Auth errors are retried, the token can be provisioned again in the meantime.
+    if (status >= 500 || status == 408 || status == 429 || status == 401 || status == 403) {
+        return HTTP_RESULT_SERVER;
+    }
+    return HTTP_RESULT_REJECTED;
+}
 
-    if (method == HTTP_METHOD_POST) {
-        printf("Set post field %d \n", err);
-        err = esp_http_client_set_post_field(client, data, strlen(data));
+static esp_err_t perform_request(esp_http_client_handle_t client, request_ctx_t *request)
+{
+    request->new_connection = false;
+    request->answered = false;
+    response_reset(request->response);
+    esp_http_client_set_timeout_ms(client, HTTP_RESPONSE_TIMEOUT_MS);
+    int64_t start = esp_timer_get_time();
+    esp_err_t err;
+    UNGATED(err = esp_http_client_perform(client));
 
+    // A sink may have consumed part of the body already, only a request that got no answer is repeated.
+    if (err != ESP_OK && !request->new_connection && !request->answered) {
+        // The server closed the kept-alive connection, retry once on a new one.
+        ESP_LOGI(__func__, "Reconnecting: %s", esp_err_to_name(err));
+        esp_http_client_close(client);
+        stats.reconnects++;
+        request->new_connection = false;
+        response_reset(request->response);
+        UNGATED(err = esp_http_client_perform(client));
     }
-    printf("Perform action");
-    printf("Host: %s, path: %s, data: %s, token: %s\n", host, path, data, token_header);
 
-    err = esp_http_client_perform(client);
+    if (err != ESP_OK) {
+        stats.failed_requests++;
+        esp_http_client_close(client);
+    } else if (request->new_connection) {
+        stats.cold_requests++;
+    } else {
+        stats.warm_requests++;
+    }
+    if (err == ESP_OK) {
+        metrics_record_us(METRIC_HTTP_TOTAL, esp_timer_get_time() - start);
+    }
+    return err;
+}
+
+static esp_err_t set_header_once(esp_http_client_handle_t client, char* current, size_t size,
+                                 const char* key, const char* value)
+{
+    if (strcmp(current, value) == 0) {
+        return ESP_OK;
+    }
+    esp_err_t err;
+    UNGATED(err = esp_http_client_set_header(client, key, value));
+    // Only remember what the client really holds, a failed set is tried again next time.
     if (err == ESP_OK) {
-        ESP_LOGI(__func__, "HTTP Status = %d, content_length = %lld",
-                 esp_http_client_get_status_code(client),
-                 esp_http_client_get_content_length(client));
+        snprintf(current, size, "%s", value);
+    }
+    return err;
+}
+
+static esp_http_client_handle_t prepare_request(const char* host, const char* path, esp_http_client_method_t method,
+                                                const char* content_type, bool use_auth)
+{
+    char url[HTTP_URL_MAX_LEN];
+    esp_http_client_handle_t client = get_client(host);
+    if (client == NULL) {
+        ESP_LOGE(__func__, "Failed to init http client");
+        return NULL;
+    }
+
+    snprintf(url, sizeof(url), "https://%s%s", host, path);
+    if (strcmp(url, client_values.url) != 0) {
+        esp_err_t err;
+        UNGATED(err = esp_http_client_set_url(client, url));
+        if (err != ESP_OK) {
+            ESP_LOGE(__func__, "Setting url failed: %s", esp_err_to_name(err));
+            client_values.url[0] = '\0';
+            return NULL;
+        }
+        snprintf(client_values.url, sizeof(client_values.url), "%s", url);
+    }
+    esp_http_client_set_method(client, method);
+    esp_err_t err = ESP_OK;
+    if (content_type != NULL) {
+        err = set_header_once(client, client_values.content_type, sizeof(client_values.content_type),
+                              "Content-Type", content_type);
+    } else if (client_values.content_type[0] != '\0') {
+        // Requests without a body do not describe one.
+        esp_http_client_delete_header(client, "Content-Type");
+        client_values.content_type[0] = '\0';
+    }
+    if (use_auth) {
+        char token_header[STR_LENGTH + 8];
+        snprintf(token_header, sizeof(token_header), "Bearer %s", get_auth_token());
+        esp_err_t auth_err = set_header_once(client, client_values.authorization, sizeof(client_values.authorization),
+                              "Authorization", token_header);
+        if (err == ESP_OK) {
+            err = auth_err;
+        }
+    } else {
+        esp_http_client_delete_header(client, "Authorization");
+        client_values.authorization[0] = '\0';
+    }
+    // The client is reused, headers of an earlier download or check must not stick.
+    esp_http_client_delete_header(client, "Range");
+    esp_http_client_delete_header(client, "If-None-Match");
+    if (err != ESP_OK) {
+        ESP_LOGW(__func__, "Setting headers failed: %s", esp_err_to_name(err));
+    }
+    return client;
+}
+
+static void log_result(esp_http_client_handle_t client, esp_err_t err, const http_response_t *response)
+{
+    if (err == ESP_OK) {
+        DLOG(DLOG_HTTP_RESULT, esp_http_client_get_status_code(client),
+             (int32_t) esp_http_client_get_content_length(client),
+             stats.warm_requests, stats.cold_requests);
+        if (response != NULL && response->truncated) {
+            ESP_LOGW(__func__, "Response truncated, kept %u of %u bytes",
+                     (unsigned) response->len, (unsigned) response->total);
+        }
     } else {
         ESP_LOGE(__func__, "HTTP request failed: %s", esp_err_to_name(err));
-        return_code = 1;
     }
+}
 
-    esp_http_client_cleanup(client);
-    printf("HTTP done\n");
-    free(token_header);
-    free(auth_token);
-    printf("Free token header\n");
-    return return_code;
- 
+static http_result_t send_request(const char* host, const char* path, http_response_t *response,
+                                  esp_http_client_method_t method, const char* content_type,
+                                  const char* data, size_t len, const char* header, const char* value,
+                                  bool use_auth)
+{
+    /**
+     * Sends HTTPS request to host/path with authorization header
+     * Response from server is passed to response, which may be NULL.
+     * Returns an http_result_t, 0 when the server answered with a 2xx status.
+     *
+     * The client and its connection are kept open between calls. Requests to a different
+     * host close the old connection, a dropped connection is reopened transparently.
+     */
+    esp_err_t err = 0;
+
+    lock_client();
+
+    esp_http_client_handle_t client = prepare_request(host, path, method, content_type, use_auth);
+    if (client == NULL) {
+        unlock_client();
+        return HTTP_RESULT_NETWORK;
+    }
+    request_ctx_t request = {
+        .response = response,
+    };
+    esp_http_client_set_user_data(client, &request);
+    if (header != NULL) {
+        UNGATED(esp_http_client_set_header(client, header, value));
+    }
+
+    if (method == HTTP_METHOD_POST) {
+        stats.body_bytes += len;
+        esp_http_client_set_post_field(client, data, len);
+    } else {
+        esp_http_client_set_post_field(client, NULL, 0);
+    }
+    DLOG_S(DLOG_HTTP_REQUEST, path, method, len, use_auth);
+
+    err = perform_request(client, &request);
+    log_result(client, err, response);
+    http_result_t result = request_result(client, err, response);
+    esp_http_client_set_user_data(client, NULL);
+
+    unlock_client();
+    return result;
+}
+
+int http_request(const char* host, const char* path, http_response_t *response, esp_http_client_method_t method, char *data, bool use_auth)
+{
+    return send_request(host, path, response, method, data != NULL ? "application/json" : NULL,
+                        data, data != NULL ? strlen(data) : 0, NULL, NULL, use_auth);
 }
 
-int http_get(const char* host, const char* path, char* get_response, bool use_auth)
+static int write_body(void* ctx, const char* data, size_t len)
+{
+    int written;
+    UNGATED(written = esp_http_client_write((esp_http_client_handle_t) ctx, data, len));
+    return written == len ? 0 : -1;
+}
+
+static esp_err_t stream_request(esp_http_client_handle_t client, json_build_fn build, void* ctx,
+                                request_ctx_t *request)
+{
+    char chunk[HTTP_BODY_CHUNK];
+    json_writer_t writer;
+
+    request->new_connection = false;
+    request->answered = false;
+    response_reset(request->response);
+    esp_http_client_set_timeout_ms(client, HTTP_CONNECT_TIMEOUT_MS);
+    int64_t start = esp_timer_get_time();
+    int content_length = json_measure(build, ctx);
+    esp_err_t err;
+    UNGATED(err = esp_http_client_open(client, content_length));
+    if (err != ESP_OK) {
+        return err;
+    }
+    // open() resolves, connects and shakes hands in one go, DNS and TLS are not timed apart.
+    int64_t opened = esp_timer_get_time();
+    if (request->new_connection) {
+        metrics_record_us(METRIC_HTTP_CONNECT, opened - start);
+    }
+    json_writer_init(&writer, chunk, sizeof(chunk), write_body, client);
+    build(&writer, ctx);
+    if (json_writer_finish(&writer) < 0) {
+        return ESP_FAIL;
+    }
+    stats.body_bytes += writer.total;
+    int64_t sent = esp_timer_get_time();
+    metrics_record_us(METRIC_HTTP_SEND, sent - opened);
+    esp_http_client_set_timeout_ms(client, HTTP_RESPONSE_TIMEOUT_MS);
+    int64_t header_len;
+    UNGATED(header_len = esp_http_client_fetch_headers(client));
+    if (header_len < 0) {
+        return ESP_FAIL;
+    }
+    request->answered = true;
+    metrics_record_us(METRIC_HTTP_FIRST_BYTE, esp_timer_get_time() - sent);
+
+    // The whole body is read, the chunk buffer is reused, so the connection can be kept alive.
+    int read_len;
+    UNGATED(read_len = esp_http_client_read(client, chunk, sizeof(chunk)));
+    while (read_len > 0) {
+        response_append(request->response, chunk, read_len);
+        UNGATED(read_len = esp_http_client_read(client, chunk, sizeof(chunk)));
+    }
+    if (read_len < 0) {
+        return ESP_FAIL;
+    }
+    metrics_record_us(METRIC_HTTP_TOTAL, esp_timer_get_time() - start);
+    return ESP_OK;
+}
+
+http_result_t http_post_json(const char* host, const char* path, http_response_t *response,
+                             json_build_fn build, void* ctx, bool use_auth)
+{
+    /**
+     * Like http_post, but the body is written by build straight into the connection
+     * in small chunks. build is called twice, first to get the Content-Length.
+     * The connect and response phases each have their own timeout.
+     */
+    lock_client();
+
+    esp_http_client_handle_t client = prepare_request(host, path, HTTP_METHOD_POST, "application/json", use_auth);
+    if (client == NULL) {
+        unlock_client();
+        return HTTP_RESULT_NETWORK;
+    }
+    request_ctx_t request = {
+        .response = response,
+        .reading_body = true,
+    };
+    esp_http_client_set_post_field(client, NULL, 0);
+    esp_http_client_set_user_data(client, &request);
+    DLOG_S(DLOG_HTTP_STREAM, path, use_auth);
+
+    esp_err_t err = stream_request(client, build, ctx, &request);
+    if (err != ESP_OK && !request.new_connection && !request.answered) {
+        ESP_LOGI(__func__, "Reconnecting: %s", esp_err_to_name(err));
+        esp_http_client_close(client);
+        stats.reconnects++;
+        err = stream_request(client, build, ctx, &request);
+    }
+    if (err != ESP_OK) {
+        stats.failed_requests++;
+        esp_http_client_close(client);
+    } else if (request.new_connection) {
+        stats.cold_requests++;
+    } else {
+        stats.warm_requests++;
+    }
+    log_result(client, err, response);
+    http_result_t result = request_result(client, err, response);
+    esp_http_client_set_user_data(client, NULL);
+
+    unlock_client();
+    return result;
+}
+
+int http_get(const char* host, const char* path, http_response_t *get_response, bool use_auth)
 {
     return http_request(host, path, get_response, HTTP_METHOD_GET, NULL, use_auth);
 }
 
-int http_post(const char* host, const char* path, char *post_response, char* data, bool use_auth)
+int http_post(const char* host, const char* path, http_response_t *post_response, char* data, bool use_auth)
 {
     return http_request(host, path, post_response, HTTP_METHOD_POST, data, use_auth);
 }
+
+http_result_t http_post_data(const char* host, const char* path, http_response_t *response,
+                             const char* content_type, const uint8_t* data, size_t len, bool use_auth)
+{
+    /**
+     * Posts a body that is already encoded, with its own Content-Type so the
+     * server can tell it from JSON.
+     */
+    return send_request(host, path, response, HTTP_METHOD_POST, content_type,
+                        (const char*) data, len, NULL, NULL, use_auth);
+}
+
+http_result_t http_get_range(const char* host, const char* path, http_response_t *response,
+                             size_t offset, size_t len, bool use_auth)
+{
+    /**
+     * GET of the bytes [offset, offset + len) of path. The body goes to the response
+     * sink as it arrives, the sink sees response->status and can tell a 206 from a
+     * server that ignored the range and sent the whole file with a 200.
+     */
+    char range[48];
+    snprintf(range, sizeof(range), "bytes=%u-%u", (unsigned) offset, (unsigned) (offset + len - 1));
+    return send_request(host, path, response, HTTP_METHOD_GET, NULL, NULL, 0,
+                        "Range", range, use_auth);
+}
+
+http_result_t http_get_if_none_match(const char* host, const char* path, http_response_t *response,
+                                     const char* etag, bool use_auth)
+{
+    /**
+     * Conditional GET. A 304 counts as success, response->status tells it from a
+     * 200. Give the response an etag buffer to get the ETag of a new body.
+     */
+    bool conditional = etag != NULL && etag[0] != '\0';
+    http_result_t result = send_request(host, path, response, HTTP_METHOD_GET, NULL, NULL, 0,
+                                        conditional ? "If-None-Match" : NULL, etag, use_auth);
+    if (result == HTTP_RESULT_REJECTED && response != NULL && response->status == 304) {
+        return HTTP_RESULT_OK;
+    }
+    return result;
+}
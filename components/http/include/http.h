@@ -1,7 +1,67 @@
 // Methods for HTTP communication.
-#include <stdbool.h> 
+#ifndef _HTTP_H_
+#define _HTTP_H_
 
-#define MAX_HTTP_OUTPUT_BUFFER 4096
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "json-writer.h"
 
-int http_post(const char* host, const char* path, char *post_response, char* data, bool use_auth);
-int http_get(const char* host, const char* path, char *get_response, bool use_auth);
+#define HTTP_URL_MAX_LEN 256
+#define HTTP_BODY_CHUNK 256
+#define HTTP_CONTENT_TYPE_LEN 64
+#define HTTP_CONNECT_TIMEOUT_MS 5000    // DNS, TCP and TLS handshake, and writing the body
+#define HTTP_RESPONSE_TIMEOUT_MS 10000  // Waiting for the response headers and body
+
+typedef enum {
+    HTTP_RESULT_OK = 0,
+    HTTP_RESULT_NETWORK,    // No connection, timeout or broken connection, worth retrying
+    HTTP_RESULT_SERVER,     // 5xx, 408, 429 or an auth error, worth retrying later
+    HTTP_RESULT_REJECTED,   // Any other non-2xx status, the same request will fail again
+    HTTP_RESULT_NONE,       // Nothing was queued, no request was made
+} http_result_t;
+
+typedef int (*http_sink_fn)(void* ctx, const char* data, size_t len);
+
+/*
+ * Where one request puts the response body. Owned by the caller, nothing is
+ * allocated. buf keeps at most size - 1 bytes and is always NUL terminated,
+ * sink (optional) is called with every piece of the body as it arrives.
+ */
+typedef struct {
+    char* buf;
+    size_t size;
+    http_sink_fn sink;      // Returning non-zero marks the response as truncated
+    void* sink_ctx;
+    char* etag;             // Optional, gets the ETag header of the response
+    size_t etag_size;
+    size_t len;             // Bytes stored in buf
+    size_t total;           // Bytes received
+    int status;             // HTTP status code, 0 if no response arrived
+    bool truncated;
+} http_response_t;
+
+typedef struct {
+    uint32_t warm_requests;     // Requests sent over an already open connection
+    uint32_t cold_requests;     // Requests that had to (re)connect first
+    uint32_t reconnects;        // Stale keep-alive connections retried on a new connection
+    uint32_t failed_requests;
+    uint32_t body_bytes;        // Request bodies sent, headers and TLS records not included
+} http_stats_t;
+
+void init_http(void);
+void http_close(void);
+void http_get_stats(http_stats_t *stats);
+
+int http_post(const char* host, const char* path, http_response_t *post_response, char* data, bool use_auth);
+http_result_t http_post_json(const char* host, const char* path, http_response_t *response,
+                             json_build_fn build, void* ctx, bool use_auth);
+http_result_t http_post_data(const char* host, const char* path, http_response_t *response,
+                             const char* content_type, const uint8_t* data, size_t len, bool use_auth);
+http_result_t http_get_range(const char* host, const char* path, http_response_t *response,
+                             size_t offset, size_t len, bool use_auth);
+http_result_t http_get_if_none_match(const char* host, const char* path, http_response_t *response,
+                                     const char* etag, bool use_auth);
+int http_get(const char* host, const char* path, http_response_t *get_response, bool use_auth);
+
+#endif
@@ -0,0 +1,31 @@
+/* Where uploads go: HTTPS requests by default, or a persistent push connection */
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "http.h"
+
+/*
+ * Every upload is a POST to a path on the API host. A transport that is not
+ * HTTP maps the path to its own addressing, and reports its outcome with the
+ * same http_result_t so retries and backoff work unchanged.
+ */
+typedef struct {
+    const char* name;
+    http_result_t (*post_json)(const char* host, const char* path, http_response_t* response,
+                               json_build_fn build, void* ctx);
+    http_result_t (*post_data)(const char* host, const char* path, http_response_t* response,
+                               const char* content_type, const uint8_t* data, size_t len);
+} transport_t;
+
+extern const transport_t https_transport;
+
+void set_transport(const transport_t* transport);
+const transport_t* get_transport(void);
+http_result_t transport_post_json(const char* host, const char* path, http_response_t* response,
+                                  json_build_fn build, void* ctx);
+http_result_t transport_post_data(const char* host, const char* path, http_response_t* response,
+                                  const char* content_type, const uint8_t* data, size_t len);
+
+#endif
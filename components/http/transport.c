@@ -0,0 +1,47 @@
+#include "transport.h"
+
+#include <stdio.h>
+
+static http_result_t https_post_json(const char* host, const char* path, http_response_t* response,
+                                     json_build_fn build, void* ctx)
+{
+    return http_post_json(host, path, response, build, ctx, true);
+}
+
+static http_result_t https_post_data(const char* host, const char* path, http_response_t* response,
+                                     const char* content_type, const uint8_t* data, size_t len)
+{
+    return http_post_data(host, path, response, content_type, data, len, true);
+}
+
+const transport_t https_transport = {
+    .name = "https",
+    .post_json = https_post_json,
+    .post_data = https_post_data,
+};
+
+/* Only changed at startup, before the uploader runs */
+static const transport_t* transport = &https_transport;
+
+void set_transport(const transport_t* t)
+{
+    transport = t != NULL ? t : &https_transport;
+    printf("Upload transport: %s\n", transport->name);
+}
+
+const transport_t* get_transport(void)
+{
+    return transport;
+}
+
+http_result_t transport_post_json(const char* host, const char* path, http_response_t* response,
+                                  json_build_fn build, void* ctx)
+{
+    return transport->post_json(host, path, response, build, ctx);
+}
+
+http_result_t transport_post_data(const char* host, const char* path, http_response_t* response,
+                                  const char* content_type, const uint8_t* data, size_t len)
+{
+    return transport->post_data(host, path, response, content_type, data, len);
+}
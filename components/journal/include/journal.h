@@ -0,0 +1,34 @@
+/* Append-only flash journal for button events that could not be uploaded */
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define JOURNAL_PARTITION_LABEL "journal"
+#define JOURNAL_PARTITION_SUBTYPE 0x40
+#define JOURNAL_SECTOR_SIZE 4096
+#define JOURNAL_MAX_SECTORS 64
+
+typedef struct {
+    uint32_t seq;
+    uint32_t timestamp;
+    uint16_t slot;
+    bool state;
+} journal_event_t;
+
+typedef struct {
+    uint32_t generation;  // Generation of the sector the position points into
+    uint32_t offset;      // Byte offset inside that sector
+} journal_pos_t;
+
+esp_err_t init_journal(void);
+esp_err_t journal_append(const journal_event_t *events, size_t n);
+size_t journal_read(journal_event_t *events, size_t max_events, journal_pos_t *next);
+esp_err_t journal_commit(journal_pos_t next);
+bool journal_pending(void);
+uint32_t journal_lost_records(void);
+
+#endif
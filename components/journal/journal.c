@@ -0,0 +1,381 @@
+#include "journal.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_log.h"
+
+/*
+ * The partition is used as a ring of flash sectors. Every sector starts with a
+ * header carrying an increasing generation number, followed by fixed size records
+ * that are only ever appended. A record torn by a power loss fails its CRC and is
+ * skipped, an all 0xFF slot marks the end of the written data.
+ *
+ * The replay cursor is stored as a record too, and it is carried over to the
+ * start of every new sector so erasing the oldest sector never loses it.
+ */
+
+#define JOURNAL_LOG_TAG "JOURNAL"
+#define SECTOR_MAGIC 0x4c4e4a50
+#define RECORD_EVENT 0xe1
+#define RECORD_CURSOR 0xc2
+#define RECORD_CHUNK 16
+
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t reserved;
+    uint32_t crc;
+} sector_header_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t state;
+    uint16_t slot;
+    uint32_t seq;        // Event sequence number, or cursor generation
+    uint32_t timestamp;  // Event time, or cursor offset
+    uint32_t crc;
+} journal_record_t;
+
+#define RECORD_SIZE sizeof(journal_record_t)
+#define FIRST_RECORD sizeof(sector_header_t)
+
+static const esp_partition_t *partition = NULL;
+static SemaphoreHandle_t journal_mutex = NULL;
+static size_t sector_count = 0;
+static uint32_t generations[JOURNAL_MAX_SECTORS];  // 0 when the sector holds no data
+static size_t head_sector = 0;
+static uint32_t write_offset = 0;
+static journal_pos_t cursor;
+static uint32_t lost_records = 0;
+
+static bool is_erased(const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < len; ++i) {
+        if (bytes[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool record_valid(const journal_record_t *record)
+{
+    return (record->type == RECORD_EVENT || record->type == RECORD_CURSOR) &&
+           record->crc == esp_rom_crc32_le(0, (const uint8_t *) record, offsetof(journal_record_t, crc));
+}
+
+static bool pos_before(journal_pos_t a, journal_pos_t b)
+{
+    return a.generation < b.generation || (a.generation == b.generation && a.offset < b.offset);
+}
+
+static journal_pos_t write_pos(void)
+{
+    journal_pos_t pos = {generations[head_sector], write_offset};
+    return pos;
+}
+
+static int sector_of(uint32_t generation)
+{
+    for (size_t i = 0; i < sector_count; ++i) {
+        if (generations[i] == generation && generation != 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static esp_err_t write_records(const journal_record_t *records, size_t n)
+{
+    // Callers make sure the records fit into the head sector.
+    esp_err_t err = esp_partition_write(partition, head_sector * JOURNAL_SECTOR_SIZE + write_offset,
+                                        records, n * RECORD_SIZE);
+    // Never reprogram a slot that may be half written, even if the write failed.
+    write_offset += n * RECORD_SIZE;
+    return err;
+}
+
+static void make_record(journal_record_t *record, uint8_t type, uint8_t state,
+                        uint16_t slot, uint32_t seq, uint32_t timestamp)
+{
+    record->type = type;
+    record->state = state;
+    record->slot = slot;
+    record->seq = seq;
+    record->timestamp = timestamp;
+    record->crc = esp_rom_crc32_le(0, (const uint8_t *) record, offsetof(journal_record_t, crc));
+}
+
+static uint32_t count_events_from(size_t sector, uint32_t offset)
+{
+    journal_record_t record;
+    uint32_t events = 0;
+    for (; offset + RECORD_SIZE <= JOURNAL_SECTOR_SIZE; offset += RECORD_SIZE) {
+        if (esp_partition_read(partition, sector * JOURNAL_SECTOR_SIZE + offset, &record, RECORD_SIZE) != ESP_OK ||
+            is_erased(&record, RECORD_SIZE)) {
+            break;
+        }
+        if (record_valid(&record) && record.type == RECORD_EVENT) {
+            events++;
+        }
+    }
+    return events;
+}
+
+static esp_err_t start_sector(size_t sector, uint32_t generation)
+{
+    if (generations[sector] != 0 && cursor.generation <= generations[sector]) {
+        // The oldest sector still had events to replay, they are overwritten now.
+        uint32_t from = cursor.generation == generations[sector] ? cursor.offset : FIRST_RECORD;
+        uint32_t lost = count_events_from(sector, from);
+        lost_records += lost;
+        ESP_LOGW(JOURNAL_LOG_TAG, "Journal full, dropped %u events", (unsigned) lost);
+        cursor.generation = generations[sector] + 1;
+        cursor.offset = FIRST_RECORD;
+    }
+    generations[sector] = 0;
+
+    esp_err_t err = esp_partition_erase_range(partition, sector * JOURNAL_SECTOR_SIZE, JOURNAL_SECTOR_SIZE);
+    if (err != ESP_OK) {
+        return err;
+    }
+    sector_header_t header = {
+        .magic = SECTOR_MAGIC,
+        .generation = generation,
+        .reserved = 0xffffffff,
+    };
+    header.crc = esp_rom_crc32_le(0, (const uint8_t *) &header, offsetof(sector_header_t, crc));
+    err = esp_partition_write(partition, sector * JOURNAL_SECTOR_SIZE, &header, sizeof(header));
+    if (err != ESP_OK) {
+        return err;
+    }
+    generations[sector] = generation;
+    head_sector = sector;
+    write_offset = FIRST_RECORD;
+
+    if (pos_before(cursor, write_pos())) {
+        journal_record_t record;
+        make_record(&record, RECORD_CURSOR, 0, 0, cursor.generation, cursor.offset);
+        err = write_records(&record, 1);
+    }
+    return err;
+}
+
+static esp_err_t ensure_space(void)
+{
+    if (write_offset + RECORD_SIZE <= JOURNAL_SECTOR_SIZE) {
+        return ESP_OK;
+    }
+    return start_sector((head_sector + 1) % sector_count, generations[head_sector] + 1);
+}
+
+static void scan_sector(size_t sector, bool *found_cursor)
+{
+    journal_record_t records[RECORD_CHUNK];
+    uint32_t offset = FIRST_RECORD;
+
+    while (offset + RECORD_SIZE <= JOURNAL_SECTOR_SIZE) {
+        size_t n = (JOURNAL_SECTOR_SIZE - offset) / RECORD_SIZE;
+        if (n > RECORD_CHUNK) {
+            n = RECORD_CHUNK;
+        }
+        if (esp_partition_read(partition, sector * JOURNAL_SECTOR_SIZE + offset, records, n * RECORD_SIZE) != ESP_OK) {
+            break;
+        }
+        for (size_t i = 0; i < n; ++i, offset += RECORD_SIZE) {
+            if (is_erased(&records[i], RECORD_SIZE)) {
+                if (sector == head_sector) {
+                    write_offset = offset;
+                }
+                return;
+            }
+            if (record_valid(&records[i]) && records[i].type == RECORD_CURSOR) {
+                cursor.generation = records[i].seq;
+                cursor.offset = records[i].timestamp;
+                *found_cursor = true;
+            }
+        }
+    }
+    if (sector == head_sector) {
+        write_offset = JOURNAL_SECTOR_SIZE;
+    }
+}
+
+esp_err_t init_journal(void)
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, JOURNAL_PARTITION_SUBTYPE,
+                                         JOURNAL_PARTITION_LABEL);
+    if (partition == NULL) {
+        ESP_LOGE(JOURNAL_LOG_TAG, "No journal partition");
+        return ESP_ERR_NOT_FOUND;
+    }
+    sector_count = partition->size / JOURNAL_SECTOR_SIZE;
+    if (sector_count > JOURNAL_MAX_SECTORS) {
+        sector_count = JOURNAL_MAX_SECTORS;
+    }
+    if (sector_count < 2) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (journal_mutex == NULL) {
+        journal_mutex = xSemaphoreCreateMutex();
+    }
+
+    size_t tail_sector = 0;
+    bool has_data = false;
+    for (size_t i = 0; i < sector_count; ++i) {
+        sector_header_t header;
+        generations[i] = 0;
+        if (esp_partition_read(partition, i * JOURNAL_SECTOR_SIZE, &header, sizeof(header)) != ESP_OK ||
+            header.magic != SECTOR_MAGIC || header.generation == 0 ||
+            header.crc != esp_rom_crc32_le(0, (const uint8_t *) &header, offsetof(sector_header_t, crc))) {
+            continue;
+        }
+        generations[i] = header.generation;
+        if (!has_data || header.generation > generations[head_sector]) {
+            head_sector = i;
+        }
+        if (!has_data || header.generation < generations[tail_sector]) {
+            tail_sector = i;
+        }
+        has_data = true;
+    }
+
+    if (!has_data) {
+        cursor.generation = 1;
+        cursor.offset = FIRST_RECORD;
+        return start_sector(0, 1);
+    }
+
+    // Walk the sectors from oldest to newest, the last cursor record wins.
+    bool found_cursor = false;
+    for (uint32_t gen = generations[tail_sector]; gen <= generations[head_sector]; ++gen) {
+        int sector = sector_of(gen);
+        if (sector >= 0) {
+            scan_sector(sector, &found_cursor);
+        }
+    }
+    if (!found_cursor || sector_of(cursor.generation) < 0) {
+        cursor.generation = generations[tail_sector];
+        cursor.offset = FIRST_RECORD;
+    }
+    ESP_LOGI(JOURNAL_LOG_TAG, "Journal mounted, %u sectors, head %u offset %u",
+             (unsigned) sector_count, (unsigned) head_sector, (unsigned) write_offset);
+    return ESP_OK;
+}
+
+esp_err_t journal_append(const journal_event_t *events, size_t n)
+{
+    if (partition == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    journal_record_t records[RECORD_CHUNK];
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(journal_mutex, portMAX_DELAY);
+    while (n > 0 && err == ESP_OK) {
+        err = ensure_space();
+        if (err != ESP_OK) {
+            break;
+        }
+        // Write as many records as fit into the rest of the sector in one go.
+        size_t room = (JOURNAL_SECTOR_SIZE - write_offset) / RECORD_SIZE;
+        size_t chunk = n < room ? n : room;
+        if (chunk > RECORD_CHUNK) {
+            chunk = RECORD_CHUNK;
+        }
+        for (size_t i = 0; i < chunk; ++i) {
+            make_record(&records[i], RECORD_EVENT, events[i].state, events[i].slot,
+                        events[i].seq, events[i].timestamp);
+        }
+        err = write_records(records, chunk);
+        events += chunk;
+        n -= chunk;
+    }
+    xSemaphoreGive(journal_mutex);
+    return err;
+}
+
+size_t journal_read(journal_event_t *events, size_t max_events, journal_pos_t *next)
+{
+    if (partition == NULL) {
+        return 0;
+    }
+    journal_record_t records[RECORD_CHUNK];
+    size_t n = 0;
+
+    xSemaphoreTake(journal_mutex, portMAX_DELAY);
+    journal_pos_t pos = cursor;
+    while (n < max_events && pos_before(pos, write_pos())) {
+        int sector = sector_of(pos.generation);
+        if (sector < 0 || pos.offset + RECORD_SIZE > JOURNAL_SECTOR_SIZE) {
+            pos.generation++;
+            pos.offset = FIRST_RECORD;
+            continue;
+        }
+        uint32_t end = (sector == head_sector) ? write_offset : JOURNAL_SECTOR_SIZE;
+        size_t chunk = (end - pos.offset) / RECORD_SIZE;
+        if (chunk > RECORD_CHUNK) {
+            chunk = RECORD_CHUNK;
+        }
+        if (esp_partition_read(partition, sector * JOURNAL_SECTOR_SIZE + pos.offset,
+                               records, chunk * RECORD_SIZE) != ESP_OK) {
+            break;
+        }
+        for (size_t i = 0; i < chunk && n < max_events; ++i) {
+            if (is_erased(&records[i], RECORD_SIZE)) {
+                pos.offset = JOURNAL_SECTOR_SIZE;
+                break;
+            }
+            pos.offset += RECORD_SIZE;
+            if (record_valid(&records[i]) && records[i].type == RECORD_EVENT) {
+                events[n].seq = records[i].seq;
+                events[n].timestamp = records[i].timestamp;
+                events[n].slot = records[i].slot;
+                events[n].state = records[i].state;
+                n++;
+            }
+        }
+    }
+    if (n == 0) {
+        // Only cursor or torn records left, nothing to upload for them.
+        cursor = pos;
+    }
+    *next = pos;
+    xSemaphoreGive(journal_mutex);
+    return n;
+}
+
+esp_err_t journal_commit(journal_pos_t next)
+{
+    if (partition == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(journal_mutex, portMAX_DELAY);
+    esp_err_t err = ensure_space();
+    if (err == ESP_OK) {
+        bool caught_up = !pos_before(next, write_pos());
+        journal_record_t record;
+        make_record(&record, RECORD_CURSOR, 0, 0, next.generation, next.offset);
+        err = write_records(&record, 1);
+        cursor = caught_up ? write_pos() : next;
+    }
+    xSemaphoreGive(journal_mutex);
+    return err;
+}
+
+bool journal_pending(void)
+{
+    return partition != NULL && pos_before(cursor, write_pos());
+}
+
+uint32_t journal_lost_records(void)
+{
+    return lost_records;
+}
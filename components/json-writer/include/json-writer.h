@@ -0,0 +1,52 @@
+/* Streaming JSON writer that never allocates */
+#ifndef _JSON_WRITER_H_
+#define _JSON_WRITER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define JSON_MAX_DEPTH 32
+
+/* Called with every full chunk, return non-zero to abort writing */
+typedef int (*json_flush_fn)(void *ctx, const char *data, size_t len);
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;              // Bytes in buf that are not flushed yet
+    size_t total;            // Bytes produced so far
+    json_flush_fn flush;
+    void *ctx;
+    uint32_t needs_comma;    // One bit per nesting level
+    uint8_t depth;
+    bool after_key;
+    bool overflow;
+    bool failed;
+} json_writer_t;
+
+typedef void (*json_build_fn)(json_writer_t *writer, void *ctx);
+
+/**
+ * buf == NULL: only count the output length.
+ * flush == NULL: write into buf and NUL terminate it, overflow if it does not fit.
+ * flush != NULL: buf is a chunk buffer passed to flush whenever it fills up.
+ */
+void json_writer_init(json_writer_t *writer, char *buf, size_t size, json_flush_fn flush, void *ctx);
+int json_writer_finish(json_writer_t *writer);
+
+void json_begin_object(json_writer_t *writer);
+void json_end_object(json_writer_t *writer);
+void json_begin_array(json_writer_t *writer);
+void json_end_array(json_writer_t *writer);
+void json_key(json_writer_t *writer, const char *key);
+void json_string(json_writer_t *writer, const char *value);
+void json_uint(json_writer_t *writer, uint32_t value);
+void json_int(json_writer_t *writer, int32_t value);
+void json_bool(json_writer_t *writer, bool value);
+void json_null(json_writer_t *writer);
+
+int json_build(char *buf, size_t size, json_build_fn build, void *ctx);
+size_t json_measure(json_build_fn build, void *ctx);
+
+#endif
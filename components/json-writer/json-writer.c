@@ -0,0 +1,223 @@
+#include "json-writer.h"
+
+#include <string.h>
+
+static void put(json_writer_t *w, const char *data, size_t n)
+{
+    if (w->overflow || w->failed) {
+        return;
+    }
+    w->total += n;
+    if (w->buf == NULL) {
+        return;
+    }
+    if (w->flush == NULL) {
+        // Keep room for the terminating NUL.
+        if (w->len + n >= w->size) {
+            w->overflow = true;
+            return;
+        }
+        memcpy(w->buf + w->len, data, n);
+        w->len += n;
+        return;
+    }
+    while (n > 0) {
+        size_t room = w->size - w->len;
+        size_t chunk = n < room ? n : room;
+        memcpy(w->buf + w->len, data, chunk);
+        w->len += chunk;
+        data += chunk;
+        n -= chunk;
+        if (w->len == w->size) {
+            if (w->flush(w->ctx, w->buf, w->len) != 0) {
+                w->failed = true;
+                return;
+            }
+            w->len = 0;
+        }
+    }
+}
+
+static void put_char(json_writer_t *w, char c)
+{
+    put(w, &c, 1);
+}
+
+static void begin_value(json_writer_t *w)
+{
+    if (w->after_key) {
+        w->after_key = false;
+        return;
+    }
+    uint32_t level = 1UL << (w->depth % JSON_MAX_DEPTH);
+    if (w->needs_comma & level) {
+        put_char(w, ',');
+    }
+    w->needs_comma |= level;
+}
+
+static void open_level(json_writer_t *w, char c)
+{
+    begin_value(w);
+    put_char(w, c);
+    if (w->depth + 1 >= JSON_MAX_DEPTH) {
+        w->overflow = true;
+        return;
+    }
+    w->depth++;
+    w->needs_comma &= ~(1UL << w->depth);
+}
+
+static void close_level(json_writer_t *w, char c)
+{
+    if (w->depth > 0) {
+        w->depth--;
+    }
+    put_char(w, c);
+}
+
+static void put_escaped(json_writer_t *w, const char *s)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *run = s;
+
+    put_char(w, '"');
+    for (; *s; ++s) {
+        unsigned char c = *s;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        put(w, run, s - run);
+        run = s + 1;
+        switch (c) {
+        case '"':  put(w, "\\\"", 2); break;
+        case '\\': put(w, "\\\\", 2); break;
+        case '\n': put(w, "\\n", 2); break;
+        case '\r': put(w, "\\r", 2); break;
+        case '\t': put(w, "\\t", 2); break;
+        default: {
+            char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+            put(w, esc, sizeof(esc));
+        }
+        }
+    }
+    put(w, run, s - run);
+    put_char(w, '"');
+}
+
+void json_writer_init(json_writer_t *w, char *buf, size_t size, json_flush_fn flush, void *ctx)
+{
+    memset(w, 0, sizeof(*w));
+    w->buf = (size > 0) ? buf : NULL;
+    w->size = size;
+    w->flush = flush;
+    w->ctx = ctx;
+}
+
+int json_writer_finish(json_writer_t *w)
+{
+    if (w->buf != NULL && w->flush != NULL && w->len > 0 && !w->failed && !w->overflow) {
+        if (w->flush(w->ctx, w->buf, w->len) != 0) {
+            w->failed = true;
+        }
+        w->len = 0;
+    }
+    if (w->buf != NULL && w->flush == NULL && w->size > 0) {
+        w->buf[w->overflow ? 0 : w->len] = '\0';
+    }
+    if (w->overflow || w->failed) {
+        return -1;
+    }
+    return w->total;
+}
+
+void json_begin_object(json_writer_t *w)
+{
+    open_level(w, '{');
+}
+
+void json_end_object(json_writer_t *w)
+{
+    close_level(w, '}');
+}
+
+void json_begin_array(json_writer_t *w)
+{
+    open_level(w, '[');
+}
+
+void json_end_array(json_writer_t *w)
+{
+    close_level(w, ']');
+}
+
+void json_key(json_writer_t *w, const char *key)
+{
+    begin_value(w);
+    put_escaped(w, key);
+    put_char(w, ':');
+    w->after_key = true;
+}
+
+void json_string(json_writer_t *w, const char *value)
+{
+    begin_value(w);
+    put_escaped(w, value ? value : "");
+}
+
+void json_uint(json_writer_t *w, uint32_t value)
+{
+    char digits[10];
+    size_t n = 0;
+
+    begin_value(w);
+    do {
+        digits[sizeof(digits) - 1 - n++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    put(w, digits + sizeof(digits) - n, n);
+}
+
+void json_int(json_writer_t *w, int32_t value)
+{
+    if (value < 0) {
+        begin_value(w);
+        put_char(w, '-');
+        w->after_key = true;
+        json_uint(w, -(uint32_t) value);
+        return;
+    }
+    json_uint(w, value);
+}
+
+void json_bool(json_writer_t *w, bool value)
+{
+    begin_value(w);
+    if (value) {
+        put(w, "true", 4);
+    } else {
+        put(w, "false", 5);
+    }
+}
+
+void json_null(json_writer_t *w)
+{
+    begin_value(w);
+    put(w, "null", 4);
+}
+
+int json_build(char *buf, size_t size, json_build_fn build, void *ctx)
+{
+    json_writer_t w;
+    json_writer_init(&w, buf, size, NULL, NULL);
+    build(&w, ctx);
+    return json_writer_finish(&w);
+}
+
+size_t json_measure(json_build_fn build, void *ctx)
+{
+    json_writer_t w;
+    json_writer_init(&w, NULL, 0, NULL, NULL);
+    build(&w, ctx);
+    return w.total;
+}
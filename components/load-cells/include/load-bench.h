@@ -0,0 +1,6 @@
+/* Load filter throughput benchmark, runs on the host (linux target) and on the device */
+#include <stddef.h>
+
+#define LOAD_BENCH_SAMPLES 200000   // Per channel
+
+void load_filter_bench(size_t channels, size_t batch);
@@ -0,0 +1,28 @@
+/* Load cell sampling, one channel per slot that measures a quantity */
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+
+#define LOAD_MAX_LISTENERS 2
+
+#ifdef CONFIG_LOAD_FRONTEND_ADC
+#define LOAD_CHANNEL_COUNT __builtin_popcount(CONFIG_LOAD_ADC_CHANNEL_MASK)
+#else
+#define LOAD_CHANNEL_COUNT __builtin_popcountll((uint64_t) CONFIG_LOAD_HX711_DOUT_MASK)
+#endif
+
+typedef struct {
+    uint32_t samples;
+    uint32_t batches;
+    uint32_t reports;
+    uint32_t overruns;      // ADC samples lost because the task fell behind
+} load_stats_t;
+
+/* Called from the load cell task when any reported value changed, must not block */
+typedef void (*load_listener_t)(void* ctx);
+
+void init_load_cells(void);
+/* Copies the last reported value of every channel, returns the number of channels. */
+size_t load_cells_read(int32_t* out, size_t n);
+int subscribe_load_changes(load_listener_t listener, void* ctx);
+void get_load_stats(load_stats_t* stats);
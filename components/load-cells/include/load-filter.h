@@ -0,0 +1,27 @@
+/* Fixed-point median + IIR filter with hysteresis for load cell samples */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define LOAD_MEDIAN_WINDOW 5
+#define LOAD_IIR_FRAC_BITS 4
+
+typedef struct {
+    int32_t window[LOAD_MEDIAN_WINDOW];
+    uint8_t fill;
+    bool primed;
+    bool reported_valid;
+    int32_t iir;        // Q(LOAD_IIR_FRAC_BITS)
+    int32_t reported;
+} load_filter_t;
+
+typedef struct {
+    uint8_t iir_shift;  // Smoothing, every median moves the output 1/2^shift of the way
+    int32_t hysteresis; // Change in counts before a new value is reported
+} load_filter_config_t;
+
+void load_filter_init(load_filter_t* filter);
+/* Returns true when the reported value changed, samples are raw signed counts. */
+bool load_filter_run(load_filter_t* filter, const load_filter_config_t* config,
+                     const int32_t* samples, size_t n);
+int32_t load_filter_value(const load_filter_t* filter);
@@ -0,0 +1,83 @@
+#include "load-bench.h"
+#include "load-filter.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_MAX_BATCH 200
+#define BENCH_NOISE 256             // Peak to peak noise in counts
+#define BENCH_SPIKE_PERIOD 97       // Every n-th sample is a spike the median has to drop
+#define BENCH_STEP_PERIOD 5000      // Samples between changes of the simulated load
+
+/*
+ * Feeds synthetic HX711 style samples (noise, spikes and a load that changes in
+ * steps) through the same batched load_filter_run() calls as load_task and prints
+ * the cost per sample. The samples are generated up front so only the filter is
+ * timed.
+ */
+static uint32_t lcg_state = 1;
+
+static int32_t noise(void)
+{
+    lcg_state = lcg_state * 1664525u + 1013904223u;
+    return (int32_t) (lcg_state >> 24) % BENCH_NOISE - BENCH_NOISE / 2;
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void load_filter_bench(size_t channels, size_t batch)
+{
+    load_filter_config_t config = {
+        .iir_shift = 3,
+        .hysteresis = 2000,
+    };
+    batch = batch / LOAD_MEDIAN_WINDOW * LOAD_MEDIAN_WINDOW;
+    if (channels == 0 || batch == 0 || batch > BENCH_MAX_BATCH) {
+        printf("load bench: bad parameters\n");
+        return;
+    }
+    load_filter_t* filters = calloc(channels, sizeof(load_filter_t));
+    int32_t (*input)[BENCH_MAX_BATCH] = malloc(channels * sizeof(*input));
+    if (filters == NULL || input == NULL) {
+        free(filters);
+        free(input);
+        printf("load bench: out of memory\n");
+        return;
+    }
+    for (size_t ch = 0; ch < channels; ++ch) {
+        load_filter_init(&filters[ch]);
+    }
+
+    size_t batches = LOAD_BENCH_SAMPLES / batch;
+    uint32_t reports = 0;
+    int64_t elapsed_ns = 0;
+    for (size_t b = 0; b < batches; ++b) {
+        for (size_t ch = 0; ch < channels; ++ch) {
+            for (size_t i = 0; i < batch; ++i) {
+                size_t n = b * batch + i;
+                int32_t load = (int32_t) ((n / BENCH_STEP_PERIOD + ch) % 4) * 50000;
+                input[ch][i] = n % BENCH_SPIKE_PERIOD == 0 ? 0x7fffff : load + noise();
+            }
+        }
+        int64_t start = now_ns();
+        for (size_t ch = 0; ch < channels; ++ch) {
+            reports += load_filter_run(&filters[ch], &config, input[ch], batch);
+        }
+        elapsed_ns += now_ns() - start;
+    }
+
+    size_t total = batches * batch * channels;
+    printf("load bench: %u channels, batch %u, %u samples, %u reports, %u ns/sample, %u ksamples/s\n",
+           (unsigned) channels, (unsigned) batch, (unsigned) total, (unsigned) reports,
+           (unsigned) (elapsed_ns / total),
+           (unsigned) (elapsed_ns > 0 ? total * 1000000ULL / elapsed_ns : 0));
+    free(filters);
+    free(input);
+}
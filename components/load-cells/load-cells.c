@@ -0,0 +1,300 @@
+#include "load-cells.h"
+#include "load-filter.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "metrics.h"
+#ifdef CONFIG_LOAD_FILTER_BENCH
+#include "load-bench.h"
+#endif
+
+#ifdef CONFIG_LOAD_FRONTEND_ADC
+#include "esp_adc/adc_continuous.h"
+#else
+#include "driver/gpio.h"
+#include "esp_rom_sys.h"
+#endif
+
+#ifdef CONFIG_LOAD_CELLS
+
+/* Whole median windows only, a partial window would carry over into the next batch */
+#define LOAD_BATCH (CONFIG_LOAD_FILTER_BATCH / LOAD_MEDIAN_WINDOW * LOAD_MEDIAN_WINDOW)
+
+/*
+ * load_task collects LOAD_BATCH samples per channel before running the filter over
+ * them, so the filter state is touched once per batch instead of once per sample.
+ * It runs below the input task on the same core and only ever blocks on the
+ * front-end, a slot change always preempts it.
+ */
+static TaskHandle_t load_task_handle = NULL;
+static portMUX_TYPE load_lock = portMUX_INITIALIZER_UNLOCKED;
+static load_filter_t filters[LOAD_CHANNEL_COUNT];
+static int32_t samples[LOAD_CHANNEL_COUNT][LOAD_BATCH];
+static size_t sample_count[LOAD_CHANNEL_COUNT];
+static int32_t reported[LOAD_CHANNEL_COUNT];
+static load_stats_t load_stats;
+
+typedef struct {
+    load_listener_t listener;
+    void* ctx;
+} load_subscriber_t;
+
+static load_subscriber_t load_subscribers[LOAD_MAX_LISTENERS];
+static size_t load_subscriber_count = 0;
+
+static const load_filter_config_t filter_config = {
+    .iir_shift = CONFIG_LOAD_FILTER_IIR_SHIFT,
+    .hysteresis = CONFIG_LOAD_FILTER_HYSTERESIS,
+};
+
+/* Returns true when the channel finished a batch and its reported value changed */
+static bool add_sample(int channel, int32_t value)
+{
+    samples[channel][sample_count[channel]++] = value;
+    if (sample_count[channel] < LOAD_BATCH) {
+        return false;
+    }
+    sample_count[channel] = 0;
+    bool changed = load_filter_run(&filters[channel], &filter_config, samples[channel], LOAD_BATCH);
+
+    portENTER_CRITICAL(&load_lock);
+    load_stats.samples += LOAD_BATCH;
+    load_stats.batches++;
+    if (changed) {
+        reported[channel] = load_filter_value(&filters[channel]);
+        load_stats.reports++;
+    }
+    portEXIT_CRITICAL(&load_lock);
+    return changed;
+}
+
+static void notify_listeners(void)
+{
+    for (size_t i = 0; i < load_subscriber_count; ++i) {
+        load_subscribers[i].listener(load_subscribers[i].ctx);
+    }
+}
+
+#ifdef CONFIG_LOAD_FRONTEND_HX711
+#define HX711_DOUT_MASK ((uint64_t) CONFIG_LOAD_HX711_DOUT_MASK)
+#define HX711_BITS 24
+#define HX711_GAIN_PULSES 1     // One extra pulse selects channel A, gain 128, for the next read
+#define HX711_POLL_MS 10
+
+static int8_t dout_pins[LOAD_CHANNEL_COUNT];
+
+static bool hx711_ready(void)
+{
+    // Every amplifier pulls DOUT low when a conversion is ready.
+    for (int i = 0; i < LOAD_CHANNEL_COUNT; ++i) {
+        if (gpio_get_level(dout_pins[i]) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void hx711_read(int32_t* values)
+{
+    /**
+     * All amplifiers share the clock and are shifted out in parallel, MSB first.
+     * SCK high for more than 60 us powers the HX711 down, so only the high phase
+     * runs with interrupts off.
+     */
+    uint32_t raw[LOAD_CHANNEL_COUNT] = {0};
+    static portMUX_TYPE sck_lock = portMUX_INITIALIZER_UNLOCKED;
+
+    for (int bit = 0; bit < HX711_BITS + HX711_GAIN_PULSES; ++bit) {
+        portENTER_CRITICAL(&sck_lock);
+        gpio_set_level(CONFIG_LOAD_HX711_PIN_SCK, 1);
+        esp_rom_delay_us(1);
+        gpio_set_level(CONFIG_LOAD_HX711_PIN_SCK, 0);
+        portEXIT_CRITICAL(&sck_lock);
+        esp_rom_delay_us(1);
+        if (bit >= HX711_BITS) {
+            continue;
+        }
+        for (int i = 0; i < LOAD_CHANNEL_COUNT; ++i) {
+            raw[i] = (raw[i] << 1) | gpio_get_level(dout_pins[i]);
+        }
+    }
+    for (int i = 0; i < LOAD_CHANNEL_COUNT; ++i) {
+        // 24-bit two's complement
+        values[i] = (int32_t) (raw[i] << 8) >> 8;
+    }
+}
+
+static void load_task(void* arg)
+{
+    int32_t values[LOAD_CHANNEL_COUNT];
+    for(;;) {
+        if (!hx711_ready()) {
+            vTaskDelay(pdMS_TO_TICKS(HX711_POLL_MS));
+            continue;
+        }
+        hx711_read(values);
+        bool changed = false;
+        for (int i = 0; i < LOAD_CHANNEL_COUNT; ++i) {
+            changed |= add_sample(i, values[i]);
+        }
+        if (changed) {
+            notify_listeners();
+        }
+    }
+}
+
+static void init_frontend(void)
+{
+    int channel = 0;
+    for (int pin = 0; pin < 64; ++pin) {
+        if ((HX711_DOUT_MASK >> pin) & 1) {
+            dout_pins[channel++] = pin;
+        }
+    }
+    gpio_config_t dout_conf = {
+        .pin_bit_mask = HX711_DOUT_MASK,
+        .mode = GPIO_MODE_INPUT,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    ESP_ERROR_CHECK(gpio_config(&dout_conf));
+    gpio_config_t sck_conf = {
+        .pin_bit_mask = 1ULL << CONFIG_LOAD_HX711_PIN_SCK,
+        .mode = GPIO_MODE_OUTPUT,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    ESP_ERROR_CHECK(gpio_config(&sck_conf));
+    gpio_set_level(CONFIG_LOAD_HX711_PIN_SCK, 0);
+    printf("Init HX711, %d load cells, SCK GPIO[%d]\n", LOAD_CHANNEL_COUNT, CONFIG_LOAD_HX711_PIN_SCK);
+}
+#endif
+
+#ifdef CONFIG_LOAD_FRONTEND_ADC
+#define ADC_READ_LEN 256        // Bytes per adc_continuous_read(), SOC_ADC_DIGI_RESULT_BYTES per sample
+#define ADC_POOL_LEN 1024
+
+static adc_continuous_handle_t adc_handle = NULL;
+static int8_t adc_channel_to_load[8];
+
+static bool IRAM_ATTR adc_pool_overflow(adc_continuous_handle_t handle,
+                                        const adc_continuous_evt_data_t* edata, void* ctx)
+{
+    portENTER_CRITICAL_ISR(&load_lock);
+    load_stats.overruns += edata->size / SOC_ADC_DIGI_RESULT_BYTES;
+    portEXIT_CRITICAL_ISR(&load_lock);
+    return false;
+}
+
+static void load_task(void* arg)
+{
+    static uint8_t buf[ADC_READ_LEN];   // DMA results, only used by this task
+    ESP_ERROR_CHECK(adc_continuous_start(adc_handle));
+
+    for(;;) {
+        uint32_t len = 0;
+        if (adc_continuous_read(adc_handle, buf, sizeof(buf), &len, ADC_MAX_DELAY) != ESP_OK) {
+            continue;
+        }
+        bool changed = false;
+        for (uint32_t i = 0; i < len; i += SOC_ADC_DIGI_RESULT_BYTES) {
+            const adc_digi_output_data_t* result = (const adc_digi_output_data_t*) &buf[i];
+            uint32_t adc_channel = result->type1.channel;
+            if (adc_channel >= sizeof(adc_channel_to_load) || adc_channel_to_load[adc_channel] < 0) {
+                continue;
+            }
+            changed |= add_sample(adc_channel_to_load[adc_channel], result->type1.data);
+        }
+        if (changed) {
+            notify_listeners();
+        }
+    }
+}
+
+static void init_frontend(void)
+{
+    adc_continuous_handle_cfg_t handle_config = {
+        .max_store_buf_size = ADC_POOL_LEN,
+        .conv_frame_size = ADC_READ_LEN,
+    };
+    ESP_ERROR_CHECK(adc_continuous_new_handle(&handle_config, &adc_handle));
+
+    adc_digi_pattern_config_t patterns[LOAD_CHANNEL_COUNT];
+    int channel = 0;
+    for (size_t adc_channel = 0; adc_channel < sizeof(adc_channel_to_load); ++adc_channel) {
+        adc_channel_to_load[adc_channel] = -1;
+        if (((CONFIG_LOAD_ADC_CHANNEL_MASK >> adc_channel) & 1) == 0) {
+            continue;
+        }
+        patterns[channel] = (adc_digi_pattern_config_t) {
+            .atten = ADC_ATTEN_DB_12,
+            .channel = adc_channel,
+            .unit = ADC_UNIT_1,
+            .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+        };
+        adc_channel_to_load[adc_channel] = channel++;
+    }
+    adc_continuous_config_t config = {
+        .pattern_num = LOAD_CHANNEL_COUNT,
+        .adc_pattern = patterns,
+        .sample_freq_hz = CONFIG_LOAD_ADC_SAMPLE_HZ,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+    };
+    ESP_ERROR_CHECK(adc_continuous_config(adc_handle, &config));
+
+    adc_continuous_evt_cbs_t callbacks = {
+        .on_pool_ovf = adc_pool_overflow,
+    };
+    ESP_ERROR_CHECK(adc_continuous_register_event_callbacks(adc_handle, &callbacks, NULL));
+    printf("Init ADC1 continuous, %d load cells at %d Hz\n", LOAD_CHANNEL_COUNT, CONFIG_LOAD_ADC_SAMPLE_HZ);
+}
+#endif
+
+size_t load_cells_read(int32_t* out, size_t n)
+{
+    if (n > LOAD_CHANNEL_COUNT) {
+        n = LOAD_CHANNEL_COUNT;
+    }
+    portENTER_CRITICAL(&load_lock);
+    memcpy(out, reported, n * sizeof(reported[0]));
+    portEXIT_CRITICAL(&load_lock);
+    return LOAD_CHANNEL_COUNT;
+}
+
+void get_load_stats(load_stats_t* stats)
+{
+    portENTER_CRITICAL(&load_lock);
+    *stats = load_stats;
+    portEXIT_CRITICAL(&load_lock);
+}
+
+int subscribe_load_changes(load_listener_t listener, void* ctx)
+{
+    if (load_subscriber_count >= LOAD_MAX_LISTENERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    load_subscribers[load_subscriber_count].listener = listener;
+    load_subscribers[load_subscriber_count].ctx = ctx;
+    load_subscriber_count++;
+    return ESP_OK;
+}
+
+void init_load_cells(void)
+{
+#ifdef CONFIG_LOAD_FILTER_BENCH
+    load_filter_bench(LOAD_CHANNEL_COUNT, LOAD_BATCH);
+#endif
+    for (int i = 0; i < LOAD_CHANNEL_COUNT; ++i) {
+        load_filter_init(&filters[i]);
+    }
+    init_frontend();
+    xTaskCreatePinnedToCore(load_task, "load_task", CONFIG_LOAD_TASK_STACK, NULL,
+                            CONFIG_LOAD_TASK_PRIORITY, &load_task_handle, CONFIG_INPUT_TASK_CORE);
+    metrics_register_task(load_task_handle);
+}
+
+#endif
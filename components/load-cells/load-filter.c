@@ -0,0 +1,65 @@
+#include "load-filter.h"
+
+#include <string.h>
+
+/*
+ * Samples are reduced to the median of every LOAD_MEDIAN_WINDOW in a row, which
+ * drops single spikes, and the medians go through a first order IIR. Only integer
+ * shifts and adds, the filter runs on the same core as the slot input task.
+ */
+
+static int32_t median(const int32_t* window)
+{
+    int32_t v[LOAD_MEDIAN_WINDOW];
+    memcpy(v, window, sizeof(v));
+    for (int i = 1; i < LOAD_MEDIAN_WINDOW; ++i) {
+        int32_t x = v[i];
+        int j = i;
+        for (; j > 0 && v[j - 1] > x; --j) {
+            v[j] = v[j - 1];
+        }
+        v[j] = x;
+    }
+    return v[LOAD_MEDIAN_WINDOW / 2];
+}
+
+void load_filter_init(load_filter_t* filter)
+{
+    memset(filter, 0, sizeof(*filter));
+}
+
+bool load_filter_run(load_filter_t* filter, const load_filter_config_t* config,
+                     const int32_t* samples, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        filter->window[filter->fill++] = samples[i];
+        if (filter->fill < LOAD_MEDIAN_WINDOW) {
+            continue;
+        }
+        filter->fill = 0;
+        int32_t m = median(filter->window) * (1 << LOAD_IIR_FRAC_BITS);
+        if (!filter->primed) {
+            filter->iir = m;
+            filter->primed = true;
+        } else {
+            filter->iir += (m - filter->iir) >> config->iir_shift;
+        }
+    }
+    if (!filter->primed) {
+        return false;
+    }
+
+    int32_t value = load_filter_value(filter);
+    int32_t delta = value - filter->reported;
+    if (filter->reported_valid && delta < config->hysteresis && -delta < config->hysteresis) {
+        return false;
+    }
+    filter->reported = value;
+    filter->reported_valid = true;
+    return true;
+}
+
+int32_t load_filter_value(const load_filter_t* filter)
+{
+    return filter->iir >> LOAD_IIR_FRAC_BITS;
+}
@@ -0,0 +1,14 @@
+/* REST endpoint on the local network for the companion app */
+#ifndef _LOCAL_API_H_
+#define _LOCAL_API_H_
+
+#define LOCAL_STATE_PATH "/state"
+#define LOCAL_POLL_PATH "/state/poll"
+#define LOCAL_STATE_JSON_LEN 1024
+#define LOCAL_ETAG_LEN 24
+#define LOCAL_MAX_POLLS 4           // Waiting long-polls, more are answered with 503
+#define LOCAL_POLL_TASK_STACK 3072
+
+void init_local_api(void);
+
+#endif
@@ -0,0 +1,200 @@
+#include "local-api.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_http_server.h"
+#include "esp_random.h"
+#include "esp_log.h"
+
+#include "button-states.h"
+#include "button-events.h"
+#include "metrics.h"
+
+/*
+ * The state JSON is serialized once per change and served from state_json until
+ * the next one. Its ETag is the event sequence number it was built from, plus a
+ * random boot id because the sequence starts over after a reboot.
+ */
+static char state_json[LOCAL_STATE_JSON_LEN];
+static int state_json_len = -1;
+static uint32_t state_seq = 0;
+static char state_etag[LOCAL_ETAG_LEN];
+static uint32_t boot_id = 0;
+static SemaphoreHandle_t state_mutex = NULL;
+static httpd_handle_t server = NULL;
+
+static TaskHandle_t poll_task_handle = NULL;
+
+static void on_state_change(uint32_t seq, void* ctx)
+{
+    xTaskNotifyGive(poll_task_handle);
+}
+
+static void refresh_state(void)
+{
+    // Read the sequence first, a change racing the build only makes the ETag older.
+    uint32_t seq = button_events_last_seq();
+    if (state_json_len >= 0 && seq == state_seq) {
+        return;
+    }
+    state_json_len = get_button_state_json(state_json, sizeof(state_json));
+    state_seq = seq;
+    snprintf(state_etag, sizeof(state_etag), "\"%08x-%u\"", (unsigned) boot_id, (unsigned) seq);
+}
+
+static bool client_has_state(httpd_req_t* req)
+{
+    char etag[LOCAL_ETAG_LEN];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", etag, sizeof(etag)) != ESP_OK) {
+        return false;
+    }
+    return strcmp(etag, state_etag) == 0;
+}
+
+static esp_err_t send_state(httpd_req_t* req, bool not_modified)
+{
+    /* Called with state_mutex held */
+    httpd_resp_set_hdr(req, "ETag", state_etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    if (not_modified) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    if (state_json_len < 0) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "State does not fit");
+    }
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, state_json, state_json_len);
+}
+
+static esp_err_t state_handler(httpd_req_t* req)
+{
+    xSemaphoreTake(state_mutex, portMAX_DELAY);
+    refresh_state();
+    esp_err_t err = send_state(req, client_has_state(req));
+    xSemaphoreGive(state_mutex);
+    return err;
+}
+
+/*
+ * A long-poll that has to wait is parked here and the handler returns, so the
+ * single httpd worker stays free for other requests. poll_task answers the
+ * parked requests when the state changes or their timeout runs out.
+ */
+typedef struct {
+    httpd_req_t* req;       // Async copy, NULL when the slot is free
+    char etag[LOCAL_ETAG_LEN];
+    TickType_t deadline;
+} parked_poll_t;
+
+static parked_poll_t parked[LOCAL_MAX_POLLS];
+
+static esp_err_t poll_handler(httpd_req_t* req)
+{
+    /**
+     * Answers right away when the client's If-None-Match is not the current state,
+     * otherwise parks the request until the next slot change or the poll timeout,
+     * whichever comes first. A timeout is answered with 304.
+     */
+    char etag[LOCAL_ETAG_LEN];
+    TickType_t timeout = pdMS_TO_TICKS(CONFIG_LOCAL_API_POLL_TIMEOUT_S * 1000);
+
+    xSemaphoreTake(state_mutex, portMAX_DELAY);
+    refresh_state();
+    if (!client_has_state(req)) {
+        esp_err_t err = send_state(req, false);
+        xSemaphoreGive(state_mutex);
+        return err;
+    }
+    httpd_req_get_hdr_value_str(req, "If-None-Match", etag, sizeof(etag));
+    parked_poll_t* slot = NULL;
+    for (size_t i = 0; i < LOCAL_MAX_POLLS && slot == NULL; ++i) {
+        if (parked[i].req == NULL) {
+            slot = &parked[i];
+        }
+    }
+    if (slot == NULL || httpd_req_async_handler_begin(req, &slot->req) != ESP_OK) {
+        if (slot != NULL) {
+            slot->req = NULL;
+        }
+        xSemaphoreGive(state_mutex);
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    strcpy(slot->etag, etag);
+    slot->deadline = xTaskGetTickCount() + timeout;
+    xSemaphoreGive(state_mutex);
+    xTaskNotifyGive(poll_task_handle);
+    return ESP_OK;
+}
+
+static void poll_task(void* arg)
+{
+    TickType_t wait = portMAX_DELAY;
+    for(;;) {
+        // Woken by a slot change or a new parked poll, or when the next one times out.
+        ulTaskNotifyTake(pdTRUE, wait);
+        TickType_t now = xTaskGetTickCount();
+        wait = portMAX_DELAY;
+
+        xSemaphoreTake(state_mutex, portMAX_DELAY);
+        refresh_state();
+        for (size_t i = 0; i < LOCAL_MAX_POLLS; ++i) {
+            parked_poll_t* poll = &parked[i];
+            if (poll->req == NULL) {
+                continue;
+            }
+            TickType_t left = poll->deadline - now;
+            bool unchanged = strcmp(poll->etag, state_etag) == 0;
+            if (unchanged && (int32_t) left > 0) {
+                wait = left < wait ? left : wait;
+                continue;
+            }
+            send_state(poll->req, unchanged);
+            httpd_req_async_handler_complete(poll->req);
+            poll->req = NULL;
+        }
+        xSemaphoreGive(state_mutex);
+    }
+}
+
+void init_local_api(void)
+{
+    if (server != NULL) {
+        return;
+    }
+    state_mutex = xSemaphoreCreateMutex();
+    boot_id = esp_random();
+    xTaskCreatePinnedToCore(poll_task, "local_poll", LOCAL_POLL_TASK_STACK, NULL,
+                            CONFIG_NETWORK_TASK_PRIORITY, &poll_task_handle, CONFIG_NETWORK_TASK_CORE);
+    metrics_register_task(poll_task_handle);
+    ESP_ERROR_CHECK(subscribe_state_changes(on_state_change, NULL));
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = CONFIG_LOCAL_API_PORT;
+    config.lru_purge_enable = true;
+    config.core_id = CONFIG_NETWORK_TASK_CORE;
+    config.task_priority = CONFIG_NETWORK_TASK_PRIORITY;
+    if (httpd_start(&server, &config) != ESP_OK) {
+        ESP_LOGE(__func__, "Failed to start the local API server");
+        return;
+    }
+
+    const httpd_uri_t state_uri = {
+        .uri = LOCAL_STATE_PATH,
+        .method = HTTP_GET,
+        .handler = state_handler,
+    };
+    const httpd_uri_t poll_uri = {
+        .uri = LOCAL_POLL_PATH,
+        .method = HTTP_GET,
+        .handler = poll_handler,
+    };
+    httpd_register_uri_handler(server, &state_uri);
+    httpd_register_uri_handler(server, &poll_uri);
+    ESP_LOGI(__func__, "Local API on port %d", CONFIG_LOCAL_API_PORT);
+}
@@ -0,0 +1,95 @@
+#include "heap-gate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_trace.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+
+#ifdef CONFIG_HEAP_TRACE_GATE
+
+/*
+ * A report cycle runs between heap_gate_begin() and heap_gate_end() in the
+ * uploading task. heap_trace records every allocation in the meantime, and the
+ * allocation hook counts the ones made by that task, outside of paused sections.
+ * Other tasks (Wi-Fi, lwIP) allocate per packet and only show up in the dump.
+ */
+static heap_trace_record_t records[CONFIG_HEAP_TRACE_GATE_RECORDS];
+static TaskHandle_t gated_task = NULL;
+static volatile bool paused = false;
+static volatile uint32_t allocations = 0;
+static uint32_t cycles = 0;
+static heap_gate_stats_t gate_stats;
+
+void IRAM_ATTR esp_heap_trace_alloc_hook(void* ptr, size_t size, uint32_t caps)
+{
+    if (gated_task != NULL && !paused && !xPortInIsrContext() &&
+        xTaskGetCurrentTaskHandle() == gated_task) {
+        allocations++;
+    }
+}
+
+void IRAM_ATTR esp_heap_trace_free_hook(void* ptr)
+{
+}
+
+void heap_gate_begin(void)
+{
+    // The first cycles set up the client, the connection and lazily allocated locks.
+    if (++cycles <= CONFIG_HEAP_TRACE_GATE_WARMUP) {
+        return;
+    }
+    allocations = 0;
+    paused = false;
+    ESP_ERROR_CHECK(heap_trace_start(HEAP_TRACE_ALL));
+    gated_task = xTaskGetCurrentTaskHandle();
+}
+
+void heap_gate_pause(void)
+{
+    paused = true;
+}
+
+void heap_gate_resume(void)
+{
+    paused = false;
+}
+
+void heap_gate_end(const char* cycle)
+{
+    if (gated_task != xTaskGetCurrentTaskHandle()) {
+        return;
+    }
+    gated_task = NULL;
+    heap_trace_stop();
+    gate_stats.traced++;
+    if (allocations == 0) {
+        return;
+    }
+    gate_stats.failed++;
+    gate_stats.allocations = allocations;
+    ESP_LOGE(__func__, "%s cycle allocated %u times, %u allocations traced in all tasks",
+             cycle, (unsigned) allocations, (unsigned) heap_trace_get_count());
+    heap_trace_dump();
+#ifdef CONFIG_HEAP_TRACE_GATE_ABORT
+    abort();
+#endif
+}
+
+void get_heap_gate_stats(heap_gate_stats_t* stats)
+{
+    *stats = gate_stats;
+}
+
+void init_heap_gate(void)
+{
+    ESP_ERROR_CHECK(heap_trace_init_standalone(records, CONFIG_HEAP_TRACE_GATE_RECORDS));
+    printf("Heap gate: tracing report cycles after %d warm-up cycles\n", CONFIG_HEAP_TRACE_GATE_WARMUP);
+}
+
+#endif
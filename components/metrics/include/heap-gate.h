@@ -0,0 +1,20 @@
+/* Heap allocations in steady-state report cycles, see CONFIG_HEAP_TRACE_GATE */
+#ifndef _HEAP_GATE_H_
+#define _HEAP_GATE_H_
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t traced;        // Cycles traced after the warm-up
+    uint32_t failed;        // Traced cycles that allocated
+    uint32_t allocations;   // Allocations of the last failed cycle
+} heap_gate_stats_t;
+
+void init_heap_gate(void);
+void heap_gate_begin(void);
+void heap_gate_pause(void);
+void heap_gate_resume(void);
+void heap_gate_end(const char* cycle);
+void get_heap_gate_stats(heap_gate_stats_t* stats);
+
+#endif
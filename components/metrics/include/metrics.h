@@ -0,0 +1,63 @@
+/* Fixed-bucket latency histograms and high-water marks, cheap enough for the hot paths */
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "json-writer.h"
+
+#define METRICS_BUCKETS 16      // Bucket 0 is < 1 ms, bucket i is [2^(i-1), 2^i) ms, the last one is open
+#define METRICS_MAX_TASKS 8
+
+typedef enum {
+    METRIC_ISR_TO_DEBOUNCE,     // First edge until the change was accepted
+    METRIC_DEBOUNCE_TO_UPLOAD,  // Accepted change until the server confirmed it
+    METRIC_HTTP_CONNECT,        // DNS, TCP and TLS handshake, new connections only
+    METRIC_HTTP_SEND,           // Writing the request body
+    METRIC_HTTP_FIRST_BYTE,     // Body sent until the response headers arrived
+    METRIC_HTTP_TOTAL,
+    METRIC_PUSH_PUBLISH,        // MQTT publish until the broker acknowledged it
+    METRIC_HIST_COUNT,
+} metric_hist_t;
+
+typedef enum {
+    METRIC_EVENT_QUEUE_DEPTH,   // Button events waiting for upload
+    METRIC_SNAPSHOT_QUEUE_DEPTH,
+    METRIC_GAUGE_COUNT,
+} metric_gauge_t;
+
+typedef struct {
+    uint32_t buckets[METRICS_BUCKETS];
+    uint32_t count;
+    uint32_t max_ms;
+    uint64_t sum_ms;
+} metrics_histogram_t;
+
+typedef struct {
+    const char* name;
+    uint32_t free_stack;        // Lowest free stack seen, in bytes
+} metrics_task_t;
+
+typedef struct {
+    uint32_t uptime_s;
+    uint32_t free_heap;
+    uint32_t min_free_heap;
+    uint32_t gauges[METRIC_GAUGE_COUNT];
+    metrics_histogram_t hist[METRIC_HIST_COUNT];
+    size_t task_count;
+    metrics_task_t tasks[METRICS_MAX_TASKS];
+} metrics_snapshot_t;
+
+void init_metrics(void);
+void metrics_record_ms(metric_hist_t hist, uint32_t ms);
+void metrics_record_us(metric_hist_t hist, int64_t us);
+void metrics_gauge_max(metric_gauge_t gauge, uint32_t value);
+void metrics_register_task(TaskHandle_t task);
+void metrics_snapshot(metrics_snapshot_t* snapshot);
+void metrics_write_json(json_writer_t* writer, const metrics_snapshot_t* snapshot);
+void metrics_print(void);
+
+#endif
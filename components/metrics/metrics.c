@@ -0,0 +1,221 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#ifdef CONFIG_METRICS_CONSOLE
+#include "esp_console.h"
+#endif
+#ifdef CONFIG_HEAP_TRACE_GATE
+#include "heap-gate.h"
+#endif
+
+/*
+ * Everything is a fixed size array updated under a spinlock, recording a sample
+ * is a handful of instructions and never allocates. Values only grow until reboot,
+ * the server works with the difference between two telemetry reports.
+ */
+
+static metrics_histogram_t histograms[METRIC_HIST_COUNT];
+static uint32_t gauges[METRIC_GAUGE_COUNT];
+static TaskHandle_t tasks[METRICS_MAX_TASKS];
+static size_t task_count = 0;
+static portMUX_TYPE metrics_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char* hist_names[METRIC_HIST_COUNT] = {
+    [METRIC_ISR_TO_DEBOUNCE] = "isr_to_debounce",
+    [METRIC_DEBOUNCE_TO_UPLOAD] = "debounce_to_upload",
+    [METRIC_HTTP_CONNECT] = "http_connect",
+    [METRIC_HTTP_SEND] = "http_send",
+    [METRIC_HTTP_FIRST_BYTE] = "http_first_byte",
+    [METRIC_HTTP_TOTAL] = "http_total",
+    [METRIC_PUSH_PUBLISH] = "push_publish",
+};
+
+static const char* gauge_names[METRIC_GAUGE_COUNT] = {
+    [METRIC_EVENT_QUEUE_DEPTH] = "event_queue_max",
+    [METRIC_SNAPSHOT_QUEUE_DEPTH] = "snapshot_queue_max",
+};
+
+static int bucket_of(uint32_t ms)
+{
+    int bucket = ms == 0 ? 0 : 32 - __builtin_clz(ms);
+    return bucket < METRICS_BUCKETS ? bucket : METRICS_BUCKETS - 1;
+}
+
+void metrics_record_ms(metric_hist_t hist, uint32_t ms)
+{
+    if (hist >= METRIC_HIST_COUNT) {
+        return;
+    }
+    metrics_histogram_t* h = &histograms[hist];
+    portENTER_CRITICAL(&metrics_lock);
+    h->buckets[bucket_of(ms)]++;
+    h->count++;
+    h->sum_ms += ms;
+    if (ms > h->max_ms) {
+        h->max_ms = ms;
+    }
+    portEXIT_CRITICAL(&metrics_lock);
+}
+
+void metrics_record_us(metric_hist_t hist, int64_t us)
+{
+    metrics_record_ms(hist, us > 0 ? us / 1000 : 0);
+}
+
+void metrics_gauge_max(metric_gauge_t gauge, uint32_t value)
+{
+    if (gauge >= METRIC_GAUGE_COUNT) {
+        return;
+    }
+    portENTER_CRITICAL(&metrics_lock);
+    if (value > gauges[gauge]) {
+        gauges[gauge] = value;
+    }
+    portEXIT_CRITICAL(&metrics_lock);
+}
+
+void metrics_register_task(TaskHandle_t task)
+{
+    portENTER_CRITICAL(&metrics_lock);
+    if (task != NULL && task_count < METRICS_MAX_TASKS) {
+        tasks[task_count++] = task;
+    }
+    portEXIT_CRITICAL(&metrics_lock);
+}
+
+void metrics_snapshot(metrics_snapshot_t* snapshot)
+{
+    portENTER_CRITICAL(&metrics_lock);
+    memcpy(snapshot->hist, histograms, sizeof(snapshot->hist));
+    memcpy(snapshot->gauges, gauges, sizeof(snapshot->gauges));
+    snapshot->task_count = task_count;
+    portEXIT_CRITICAL(&metrics_lock);
+
+    snapshot->uptime_s = esp_timer_get_time() / 1000000;
+    snapshot->free_heap = esp_get_free_heap_size();
+    snapshot->min_free_heap = esp_get_minimum_free_heap_size();
+    for (size_t i = 0; i < snapshot->task_count; ++i) {
+        snapshot->tasks[i].name = pcTaskGetName(tasks[i]);
+        snapshot->tasks[i].free_stack = uxTaskGetStackHighWaterMark(tasks[i]);
+    }
+}
+
+void metrics_write_json(json_writer_t* w, const metrics_snapshot_t* snapshot)
+{
+    /**
+     * Writes the fields into the object the caller has opened:
+     * "uptime_s":0,"heap":[free,min_free],"queues":{...},"stacks":{"task":free,...},
+     * "latency":{"name":[count,sum_ms,max_ms,[buckets...]],...}
+     * Trailing empty buckets are left out.
+     */
+    json_key(w, "uptime_s");
+    json_uint(w, snapshot->uptime_s);
+    json_key(w, "heap");
+    json_begin_array(w);
+    json_uint(w, snapshot->free_heap);
+    json_uint(w, snapshot->min_free_heap);
+    json_end_array(w);
+
+    json_key(w, "queues");
+    json_begin_object(w);
+    for (int i = 0; i < METRIC_GAUGE_COUNT; ++i) {
+        json_key(w, gauge_names[i]);
+        json_uint(w, snapshot->gauges[i]);
+    }
+    json_end_object(w);
+
+    json_key(w, "stacks");
+    json_begin_object(w);
+    for (size_t i = 0; i < snapshot->task_count; ++i) {
+        json_key(w, snapshot->tasks[i].name);
+        json_uint(w, snapshot->tasks[i].free_stack);
+    }
+    json_end_object(w);
+
+    json_key(w, "latency");
+    json_begin_object(w);
+    for (int i = 0; i < METRIC_HIST_COUNT; ++i) {
+        const metrics_histogram_t* h = &snapshot->hist[i];
+        int used = METRICS_BUCKETS;
+        while (used > 0 && h->buckets[used - 1] == 0) {
+            used--;
+        }
+        json_key(w, hist_names[i]);
+        json_begin_array(w);
+        json_uint(w, h->count);
+        json_uint(w, h->sum_ms > UINT32_MAX ? UINT32_MAX : (uint32_t) h->sum_ms);
+        json_uint(w, h->max_ms);
+        json_begin_array(w);
+        for (int b = 0; b < used; ++b) {
+            json_uint(w, h->buckets[b]);
+        }
+        json_end_array(w);
+        json_end_array(w);
+    }
+    json_end_object(w);
+}
+
+void metrics_print(void)
+{
+    static metrics_snapshot_t snapshot;
+    metrics_snapshot(&snapshot);
+
+    printf("uptime %u s, heap free %u, min free %u\n", (unsigned) snapshot.uptime_s,
+           (unsigned) snapshot.free_heap, (unsigned) snapshot.min_free_heap);
+    for (int i = 0; i < METRIC_GAUGE_COUNT; ++i) {
+        printf("%-20s %u\n", gauge_names[i], (unsigned) snapshot.gauges[i]);
+    }
+    for (size_t i = 0; i < snapshot.task_count; ++i) {
+        printf("stack %-14s %u bytes free\n", snapshot.tasks[i].name, (unsigned) snapshot.tasks[i].free_stack);
+    }
+    for (int i = 0; i < METRIC_HIST_COUNT; ++i) {
+        const metrics_histogram_t* h = &snapshot.hist[i];
+        printf("%-20s n=%u avg=%u max=%u ms |", hist_names[i], (unsigned) h->count,
+               (unsigned) (h->count ? h->sum_ms / h->count : 0), (unsigned) h->max_ms);
+        for (int b = 0; b < METRICS_BUCKETS; ++b) {
+            printf(" %u", (unsigned) h->buckets[b]);
+        }
+        printf("\n");
+    }
+#ifdef CONFIG_HEAP_TRACE_GATE
+    heap_gate_stats_t gate;
+    get_heap_gate_stats(&gate);
+    printf("heap gate           %u cycles traced, %u allocated\n", (unsigned) gate.traced, (unsigned) gate.failed);
+#endif
+}
+
+#ifdef CONFIG_METRICS_CONSOLE
+static int metrics_command(int argc, char** argv)
+{
+    metrics_print();
+    return 0;
+}
+#endif
+
+void init_metrics(void)
+{
+#ifdef CONFIG_HEAP_TRACE_GATE
+    init_heap_gate();
+#endif
+#ifdef CONFIG_METRICS_CONSOLE
+    esp_console_repl_t* repl = NULL;
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    esp_console_dev_uart_config_t uart_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    repl_config.prompt = "pantry-io>";
+
+    const esp_console_cmd_t command = {
+        .command = "metrics",
+        .help = "Print latency histograms, queue high-water marks and stack watermarks",
+        .func = &metrics_command,
+    };
+    ESP_ERROR_CHECK(esp_console_new_repl_uart(&uart_config, &repl_config, &repl));
+    ESP_ERROR_CHECK(esp_console_cmd_register(&command));
+    ESP_ERROR_CHECK(esp_console_start_repl(repl));
+#endif
+}
@@ -1,16 +1,69 @@
 /* Functions related to non-voltatile storage */
+#ifndef _NVS_INIT_H_
+#define _NVS_INIT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 #define MAX_USERNAME_LENGTH 128
 #define MAX_PASSWD_LENGTH 128
 #define STR_LENGTH 128
+#define CFG_MAX_LISTENERS 8
+
+/* Every value is loaded from NVS once in init_nvs() and served from RAM afterwards */
+typedef enum {
+    CFG_WIFI_USER,
+    CFG_WIFI_PASSWD,
+    CFG_AUTH_TOKEN,
+    CFG_UNIT_ID,
+    CFG_WIFI_CACHE,
+    /* Set by the remote configuration document, unset means the built-in default */
+    CFG_API_HOST,
+    CFG_API_PATH,
+    CFG_HEARTBEAT_S,
+    CFG_COALESCE_MS,
+    CFG_MAX_BATCH,
+    CFG_BOUNCE_MS,
+    CFG_REMOTE_ETAG,     // ETag of the document the values above came from
+    CFG_KEY_COUNT
+} config_key_t;
+
+typedef enum {
+    CFG_TYPE_STR,
+    CFG_TYPE_U32,
+    CFG_TYPE_BLOB,
+} config_type_t;
+
+typedef void (*config_listener_t)(config_key_t key, void* ctx);
 
 void init_nvs(void);
-char* get_nvs_data(const char *val_name);
-char* get_wifi_passwd(void);
-char* get_wifi_user(void);
-char* get_auth_token(void);
-char* get_unit_id(void);
+
+const char* config_get_str(config_key_t key);
+uint32_t config_get_u32(config_key_t key, uint32_t default_value);
+size_t config_get_blob(config_key_t key, void* out, size_t len);
+bool config_is_set(config_key_t key);
+
+/*
+ * Values change in batches. config_begin() reserves the staging area for the
+ * calling task until config_commit() or config_discard() ends the batch, so the
+ * batches of different tasks never mix. Staging outside a batch fails.
+ */
+void config_begin(void);
+int config_stage_str(config_key_t key, const char* value);
+int config_stage_u32(config_key_t key, uint32_t value);
+int config_stage_blob(config_key_t key, const void* value, size_t len);
+int config_commit(void);
+void config_discard(void);
+int config_subscribe(config_listener_t listener, void* ctx);
+
+const char* get_wifi_passwd(void);
+const char* get_wifi_user(void);
+const char* get_auth_token(void);
+const char* get_unit_id(void);
 
 int save_wifi_credientials(const char* username, const char* passwd);
 int save_auth_token(const char* token);
 int save_unit_id(const char* id);
+
+#endif
@@ -7,14 +7,110 @@
 #include "nvs_flash.h"
 #include <string.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
 #define DATA_STORAGE "data"
 #define WIFI_PASSWD_KEY "wifi_passwd"
 #define WIFI_USERNAME_KEY "wifi_network"
 #define AUTH_TOKEN_KEY "auth_token"
 #define ID_KEY "id_key"
+#define WIFI_CACHE_KEY "wifi_cache"
+#define API_HOST_KEY "api_host"
+#define API_PATH_KEY "api_path"
+#define HEARTBEAT_KEY "heartbeat_s"
+#define COALESCE_KEY "coalesce_ms"
+#define MAX_BATCH_KEY "max_batch"
+#define BOUNCE_KEY "bounce_ms"
+#define REMOTE_ETAG_KEY "remote_etag"
 
 #define NVS_LOG_TAG "NVS"
 
+typedef struct {
+    const char* nvs_key;
+    config_type_t type;
+} config_def_t;
+
+typedef struct {
+    uint8_t data[STR_LENGTH];
+    size_t len;  // 0 when the value is not set, strings include the terminating NUL
+} config_value_t;
+
+typedef struct {
+    config_listener_t listener;
+    void* ctx;
+} config_subscriber_t;
+
+static const config_def_t config_defs[CFG_KEY_COUNT] = {
+    [CFG_WIFI_USER] = {WIFI_USERNAME_KEY, CFG_TYPE_STR},
+    [CFG_WIFI_PASSWD] = {WIFI_PASSWD_KEY, CFG_TYPE_STR},
+    [CFG_AUTH_TOKEN] = {AUTH_TOKEN_KEY, CFG_TYPE_STR},
+    [CFG_UNIT_ID] = {ID_KEY, CFG_TYPE_STR},
+    [CFG_WIFI_CACHE] = {WIFI_CACHE_KEY, CFG_TYPE_BLOB},
+    [CFG_API_HOST] = {API_HOST_KEY, CFG_TYPE_STR},
+    [CFG_API_PATH] = {API_PATH_KEY, CFG_TYPE_STR},
+    [CFG_HEARTBEAT_S] = {HEARTBEAT_KEY, CFG_TYPE_U32},
+    [CFG_COALESCE_MS] = {COALESCE_KEY, CFG_TYPE_U32},
+    [CFG_MAX_BATCH] = {MAX_BATCH_KEY, CFG_TYPE_U32},
+    [CFG_BOUNCE_MS] = {BOUNCE_KEY, CFG_TYPE_U32},
+    [CFG_REMOTE_ETAG] = {REMOTE_ETAG_KEY, CFG_TYPE_STR},
+};
+
+/*
+ * Two banks per value: a commit fills the inactive bank and then flips to it, so
+ * a pointer returned by config_get_str() stays valid until the commit after next.
+ */
+static config_value_t values[CFG_KEY_COUNT][2];
+static uint8_t active_bank[CFG_KEY_COUNT];
+static config_value_t staged[CFG_KEY_COUNT];
+static uint32_t staged_keys = 0;
+static SemaphoreHandle_t config_mutex = NULL;
+static config_subscriber_t subscribers[CFG_MAX_LISTENERS];
+static size_t subscriber_count = 0;
+
+static void load_value(nvs_handle_t handle, config_key_t key)
+{
+    config_value_t* value = &values[key][active_bank[key]];
+    size_t len = sizeof(value->data);
+    uint32_t number = 0;
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+
+    switch (config_defs[key].type) {
+    case CFG_TYPE_STR:
+        err = nvs_get_str(handle, config_defs[key].nvs_key, (char*) value->data, &len);
+        break;
+    case CFG_TYPE_U32:
+        err = nvs_get_u32(handle, config_defs[key].nvs_key, &number);
+        memcpy(value->data, &number, sizeof(number));
+        len = sizeof(number);
+        break;
+    case CFG_TYPE_BLOB:
+        err = nvs_get_blob(handle, config_defs[key].nvs_key, value->data, &len);
+        break;
+    }
+
+    value->len = (err == ESP_OK) ? len : 0;
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(NVS_LOG_TAG, "Error reading %s: %s", config_defs[key].nvs_key, esp_err_to_name(err));
+    }
+}
+
+static esp_err_t write_value(nvs_handle_t handle, config_key_t key, const config_value_t* value)
+{
+    uint32_t number = 0;
+
+    switch (config_defs[key].type) {
+    case CFG_TYPE_STR:
+        return nvs_set_str(handle, config_defs[key].nvs_key, (const char*) value->data);
+    case CFG_TYPE_U32:
+        memcpy(&number, value->data, sizeof(number));
+        return nvs_set_u32(handle, config_defs[key].nvs_key, number);
+    case CFG_TYPE_BLOB:
+        return nvs_set_blob(handle, config_defs[key].nvs_key, value->data, value->len);
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
 void init_nvs(void)
 {
     esp_err_t ret = nvs_flash_init();
@@ -23,81 +119,217 @@ void init_nvs(void)
         ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
+
+    if (config_mutex == NULL) {
+        config_mutex = xSemaphoreCreateMutex();
+    }
+
+    nvs_handle_t handle = 0;
+    ret = nvs_open(DATA_STORAGE, NVS_READONLY, &handle);
+    if (ret != ESP_OK) {
+        // A fresh device has no namespace yet, every value stays unset.
+        ESP_LOGI(NVS_LOG_TAG, "No stored configuration: %s", esp_err_to_name(ret));
+        return;
+    }
+    for (int key = 0; key < CFG_KEY_COUNT; ++key) {
+        load_value(handle, key);
+    }
+    nvs_close(handle);
 }
 
-char* get_wifi_passwd(void)
+static const config_value_t* get_value(config_key_t key, config_type_t type)
 {
-    return get_nvs_data(WIFI_PASSWD_KEY);
+    if (key >= CFG_KEY_COUNT || config_defs[key].type != type) {
+        return NULL;
+    }
+    const config_value_t* value = &values[key][active_bank[key]];
+    return value->len > 0 ? value : NULL;
 }
 
-char* get_wifi_user(void)
+const char* config_get_str(config_key_t key)
 {
-    return get_nvs_data(WIFI_USERNAME_KEY);
+    const config_value_t* value = get_value(key, CFG_TYPE_STR);
+    return value ? (const char*) value->data : "";
 }
 
-char* get_auth_token()
+uint32_t config_get_u32(config_key_t key, uint32_t default_value)
 {
-    return get_nvs_data(AUTH_TOKEN_KEY);
+    const config_value_t* value = get_value(key, CFG_TYPE_U32);
+    if (value == NULL) {
+        return default_value;
+    }
+    uint32_t number;
+    memcpy(&number, value->data, sizeof(number));
+    return number;
 }
 
-char* get_unit_id(void)
+size_t config_get_blob(config_key_t key, void* out, size_t len)
 {
-    return get_nvs_data(ID_KEY);
+    const config_value_t* value = get_value(key, CFG_TYPE_BLOB);
+    if (value == NULL || value->len > len) {
+        return 0;
+    }
+    memcpy(out, value->data, value->len);
+    return value->len;
 }
 
-char* get_nvs_data(const char* val_name)
+bool config_is_set(config_key_t key)
 {
-    nvs_handle my_handle = 0;
-    esp_err_t err = nvs_open(DATA_STORAGE, NVS_READONLY, &my_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(NVS_LOG_TAG, "Failed to open nvs: %s\n", esp_err_to_name(err));
-    }
+    return key < CFG_KEY_COUNT && values[key][active_bank[key]].len > 0;
+}
 
-    char* buffer = malloc(sizeof(char) * STR_LENGTH);
-    size_t data_len = sizeof(char) * STR_LENGTH;
-    err = nvs_get_str(my_handle, val_name, buffer, &data_len);
+static bool in_batch(void)
+{
+    return xSemaphoreGetMutexHolder(config_mutex) == xTaskGetCurrentTaskHandle();
+}
 
-    switch (err) {
-    case ESP_OK:
-        break;
-    case ESP_ERR_NVS_NOT_FOUND:
-        free(buffer);
-        buffer = NULL;
-        break;
-    default :
-        printf("Error reading saved data: %s\n", esp_err_to_name(err));
+void config_begin(void)
+{
+    xSemaphoreTake(config_mutex, portMAX_DELAY);
+}
+
+static void end_batch(void)
+{
+    staged_keys = 0;
+    xSemaphoreGive(config_mutex);
+}
+
+void config_discard(void)
+{
+    if (in_batch()) {
+        end_batch();
     }
-    nvs_close(my_handle);
-    if (buffer != NULL)
-        printf("Buffer: %s\n", buffer);
-    else
-        printf("Buffer is null\n");
-    return buffer;
 }
 
-int save_value(const char* value, const char* key)
+static int stage_value(config_key_t key, config_type_t type, const void* data, size_t len)
 {
-    nvs_handle v_nvs_handle = 0;
-    esp_err_t err = nvs_open(DATA_STORAGE, NVS_READWRITE, &v_nvs_handle);
+    if (key >= CFG_KEY_COUNT || config_defs[key].type != type || len > STR_LENGTH) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!in_batch()) {
+        ESP_LOGE(NVS_LOG_TAG, "%s staged outside a batch", config_defs[key].nvs_key);
+        return ESP_ERR_INVALID_STATE;
+    }
+    memcpy(staged[key].data, data, len);
+    staged[key].len = len;
+    staged_keys |= 1UL << key;
+    return ESP_OK;
+}
+
+int config_stage_str(config_key_t key, const char* value)
+{
+    return stage_value(key, CFG_TYPE_STR, value, strlen(value) + 1);
+}
+
+int config_stage_u32(config_key_t key, uint32_t value)
+{
+    return stage_value(key, CFG_TYPE_U32, &value, sizeof(value));
+}
+
+int config_stage_blob(config_key_t key, const void* value, size_t len)
+{
+    return stage_value(key, CFG_TYPE_BLOB, value, len);
+}
+
+int config_commit(void)
+{
+    /**
+     * Writes every staged value with one NVS handle and one nvs_commit. The values
+     * in RAM only change, and subscribers are only told, when all writes succeeded.
+     * The batch ends either way, a failed one is dropped.
+     */
+    uint32_t changed = 0;
+    nvs_handle_t handle = 0;
+
+    if (!in_batch()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (staged_keys == 0) {
+        end_batch();
+        return ESP_OK;
+    }
+    esp_err_t err = nvs_open(DATA_STORAGE, NVS_READWRITE, &handle);
     if (err != ESP_OK) {
-        ESP_LOGE(NVS_LOG_TAG, "Failed to open nvs: %s\n", esp_err_to_name(err));
+        ESP_LOGE(NVS_LOG_TAG, "Failed to open nvs: %s", esp_err_to_name(err));
+        end_batch();
         return err;
     }
-
-    err = nvs_set_str(v_nvs_handle, key, value);
+    for (int key = 0; key < CFG_KEY_COUNT && err == ESP_OK; ++key) {
+        if (staged_keys & (1UL << key)) {
+            err = write_value(handle, key, &staged[key]);
+        }
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
     if (err != ESP_OK) {
-        ESP_LOGE(NVS_LOG_TAG, "Failed to set nvs: %s\n", esp_err_to_name(err));
+        ESP_LOGE(NVS_LOG_TAG, "Failed to set nvs: %s", esp_err_to_name(err));
+        end_batch();
         return err;
+    }
+
+    for (int key = 0; key < CFG_KEY_COUNT; ++key) {
+        if (!(staged_keys & (1UL << key))) {
+            continue;
+        }
+        const config_value_t* current = &values[key][active_bank[key]];
+        if (current->len == staged[key].len && memcmp(current->data, staged[key].data, current->len) == 0) {
+            continue;
+        }
+        values[key][!active_bank[key]] = staged[key];
+        active_bank[key] = !active_bank[key];
+        changed |= 1UL << key;
+    }
+    end_batch();
 
+    for (int key = 0; key < CFG_KEY_COUNT; ++key) {
+        if (changed & (1UL << key)) {
+            for (size_t i = 0; i < subscriber_count; ++i) {
+                subscribers[i].listener(key, subscribers[i].ctx);
+            }
+        }
     }
-    nvs_close(v_nvs_handle);
     return ESP_OK;
 }
 
+int config_subscribe(config_listener_t listener, void* ctx)
+{
+    if (subscriber_count >= CFG_MAX_LISTENERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    subscribers[subscriber_count].listener = listener;
+    subscribers[subscriber_count].ctx = ctx;
+    subscriber_count++;
+    return ESP_OK;
+}
+
+const char* get_wifi_passwd(void)
+{
+    return config_get_str(CFG_WIFI_PASSWD);
+}
+
+const char* get_wifi_user(void)
+{
+    return config_get_str(CFG_WIFI_USER);
+}
+
+const char* get_auth_token()
+{
+    return config_get_str(CFG_AUTH_TOKEN);
+}
+
+const char* get_unit_id(void)
+{
+    return config_get_str(CFG_UNIT_ID);
+}
+
 int save_wifi_credientials(const char* wifi_name, const char* passwd)
 {
-    ESP_ERROR_CHECK(save_value(wifi_name, WIFI_USERNAME_KEY));
-    ESP_ERROR_CHECK(save_value(passwd, WIFI_PASSWD_KEY));
+    config_begin();
+    ESP_ERROR_CHECK(config_stage_str(CFG_WIFI_USER, wifi_name));
+    ESP_ERROR_CHECK(config_stage_str(CFG_WIFI_PASSWD, passwd));
+    ESP_ERROR_CHECK(config_commit());
 
     printf("Saved wifi network: %s\n", wifi_name);
     return 0;
@@ -105,14 +337,17 @@ int save_wifi_credientials(const char* wifi_name, const char* passwd)
 
 int save_auth_token(const char* token)
 {
-    ESP_ERROR_CHECK(save_value(token, AUTH_TOKEN_KEY));
+    config_begin();
+    ESP_ERROR_CHECK(config_stage_str(CFG_AUTH_TOKEN, token));
+    ESP_ERROR_CHECK(config_commit());
     printf("Saved auth token\n");
     return 0;
 }
 
 int save_unit_id(const char* id)
 {
-    ESP_ERROR_CHECK(save_value(id, ID_KEY));
+    config_begin();
+    ESP_ERROR_CHECK(config_stage_str(CFG_UNIT_ID, id));
+    ESP_ERROR_CHECK(config_commit());
     return 0;
 }
-
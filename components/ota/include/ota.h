@@ -0,0 +1,33 @@
+/* Firmware updates into the inactive app slot, with rollback */
+#ifndef _OTA_H_
+#define _OTA_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define OTA_MANIFEST_LEN 256
+#define OTA_VERSION_LEN 32
+#define OTA_PATH_LEN 128
+#define OTA_RETRY_MS 5000
+#define OTA_MAX_RETRIES 5           // Failed chunks in a row before the download is given up
+#define OTA_WIFI_TIMEOUT_MS 5000
+#define OTA_FIRST_CHECK_MS (1000*60)
+
+typedef struct {
+    uint32_t checks;
+    uint32_t downloads;         // Images written completely
+    uint32_t failed;
+    uint32_t resumes;           // Range requests that continued after a failed one
+    uint32_t skipped;           // Checks that found the version that was rolled back
+    uint32_t last_bytes;
+    uint32_t last_ms;           // Duration of the last complete download
+} ota_stats_t;
+
+void init_ota(void);
+/* Checks the manifest now instead of waiting for the period */
+void ota_check_now(void);
+/* Called after every successful upload, confirms a freshly updated image */
+void ota_upload_succeeded(void);
+void get_ota_stats(ota_stats_t* stats);
+
+#endif
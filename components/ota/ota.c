@@ -0,0 +1,219 @@
+#include "ota.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_ota_ops.h"
+#include "esp_app_desc.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_log.h"
+
+#include "http.h"
+#include "wifi.h"
+#include "metrics.h"
+
+#ifdef CONFIG_OTA_UPDATES
+
+/*
+ * The image is requested CONFIG_OTA_CHUNK_SIZE bytes at a time and every piece
+ * goes to esp_ota_write() from the response sink as it arrives, nothing bigger
+ * than the HTTP client's receive buffer is held in RAM. A failed request is
+ * retried from the last byte written, within the same boot.
+ */
+static TaskHandle_t ota_task_handle = NULL;
+static esp_timer_handle_t verify_timer = NULL;
+static volatile bool pending_verify = false;
+static ota_stats_t ota_stats;
+
+typedef struct {
+    esp_ota_handle_t handle;
+    http_response_t* response;
+    size_t written;
+    bool failed;
+} download_t;
+
+static int write_image(void* ctx, const char* data, size_t len)
+{
+    download_t* download = ctx;
+    if (download->failed) {
+        return -1;
+    }
+    // A 200 is the whole file, only usable if nothing was written yet.
+    int status = download->response->status;
+    if (status != 206 && !(status == 200 && download->written == 0)) {
+        ESP_LOGE(__func__, "Unexpected status %d for a range request", status);
+        download->failed = true;
+        return -1;
+    }
+    if (esp_ota_write(download->handle, data, len) != ESP_OK) {
+        download->failed = true;
+        return -1;
+    }
+    download->written += len;
+    return 0;
+}
+
+static bool download_image(const char* path, size_t size)
+{
+    const esp_partition_t* partition = esp_ota_get_next_update_partition(NULL);
+    if (partition == NULL || size > partition->size) {
+        ESP_LOGE(__func__, "No app slot for a %u byte image", (unsigned) size);
+        return false;
+    }
+    download_t download = {0};
+    if (esp_ota_begin(partition, size, &download.handle) != ESP_OK) {
+        return false;
+    }
+
+    int64_t start = esp_timer_get_time();
+    http_response_t response = {
+        .sink = write_image,
+        .sink_ctx = &download,
+    };
+    download.response = &response;
+    int retries = 0;
+    while (download.written < size && !download.failed) {
+        size_t offset = download.written;
+        size_t len = size - offset < CONFIG_OTA_CHUNK_SIZE ? size - offset : CONFIG_OTA_CHUNK_SIZE;
+        http_result_t result = http_get_range(CONFIG_OTA_HOST, path, &response, offset, len, true);
+        if (result == HTTP_RESULT_OK && download.written > offset) {
+            retries = 0;
+            continue;
+        }
+        if (result == HTTP_RESULT_REJECTED || ++retries > OTA_MAX_RETRIES) {
+            break;
+        }
+        // Whatever arrived is already in flash, the next request starts after it.
+        ESP_LOGW(__func__, "Chunk at %u failed (%d), resuming", (unsigned) download.written, result);
+        ota_stats.resumes++;
+        vTaskDelay(pdMS_TO_TICKS(OTA_RETRY_MS));
+    }
+
+    if (download.written != size || download.failed) {
+        esp_ota_abort(download.handle);
+        return false;
+    }
+    // esp_ota_end() checks the image before it can be booted.
+    if (esp_ota_end(download.handle) != ESP_OK || esp_ota_set_boot_partition(partition) != ESP_OK) {
+        return false;
+    }
+    uint32_t ms = (esp_timer_get_time() - start) / 1000;
+    ota_stats.last_bytes = size;
+    ota_stats.last_ms = ms;
+    ota_stats.downloads++;
+    printf("OTA: %u bytes in %u ms, %u kB/s\n", (unsigned) size, (unsigned) ms,
+           (unsigned) (ms > 0 ? size / ms : 0));
+    return true;
+}
+
+static bool rolled_back(const char* version)
+{
+    /* The bootloader marked this version invalid, fetching it again would only repeat that */
+    const esp_partition_t* invalid = esp_ota_get_last_invalid_partition();
+    esp_app_desc_t desc;
+    return invalid != NULL && esp_ota_get_partition_description(invalid, &desc) == ESP_OK &&
+           strncmp(desc.version, version, sizeof(desc.version)) == 0;
+}
+
+static void check_for_update(void)
+{
+    /* The manifest is one line: <version> <image size> <image path> */
+    char manifest[OTA_MANIFEST_LEN];
+    char version[OTA_VERSION_LEN];
+    char path[OTA_PATH_LEN];
+    unsigned size = 0;
+    http_response_t response = {
+        .buf = manifest,
+        .size = sizeof(manifest),
+    };
+
+    ota_stats.checks++;
+    if (http_get(CONFIG_OTA_HOST, CONFIG_OTA_MANIFEST_PATH, &response, true) != HTTP_RESULT_OK) {
+        return;
+    }
+    if (sscanf(manifest, "%31s %u %127s", version, &size, path) != 3) {
+        ESP_LOGE(__func__, "Bad manifest: %s", manifest);
+        return;
+    }
+    const esp_app_desc_t* app = esp_app_get_description();
+    if (strcmp(version, app->version) == 0) {
+        return;
+    }
+    if (rolled_back(version)) {
+        ESP_LOGW(__func__, "Version %s was rolled back, waiting for a newer one", version);
+        ota_stats.skipped++;
+        return;
+    }
+    printf("OTA: updating from %s to %s\n", app->version, version);
+    if (!download_image(path, size)) {
+        ota_stats.failed++;
+        return;
+    }
+    esp_restart();
+}
+
+static void ota_task(void* arg)
+{
+    TickType_t wait = pdMS_TO_TICKS(OTA_FIRST_CHECK_MS);
+    for(;;) {
+        ulTaskNotifyTake(pdTRUE, wait);
+        wait = pdMS_TO_TICKS(CONFIG_OTA_CHECK_PERIOD_S * 1000);
+        // No update while the running image still has to prove itself.
+        if (!pending_verify && wifi_wait_connected(OTA_WIFI_TIMEOUT_MS)) {
+            check_for_update();
+        }
+    }
+}
+
+static void verify_timeout(void* arg)
+{
+    ESP_LOGE(__func__, "No upload since the update, rolling back");
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+}
+
+void ota_upload_succeeded(void)
+{
+    if (!pending_verify) {
+        return;
+    }
+    pending_verify = false;
+    esp_timer_stop(verify_timer);
+    esp_ota_mark_app_valid_cancel_rollback();
+    printf("OTA: image confirmed\n");
+}
+
+void ota_check_now(void)
+{
+    if (ota_task_handle != NULL) {
+        xTaskNotifyGive(ota_task_handle);
+    }
+}
+
+void get_ota_stats(ota_stats_t* stats)
+{
+    *stats = ota_stats;
+}
+
+void init_ota(void)
+{
+    esp_ota_img_states_t state;
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    if (esp_ota_get_state_partition(running, &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY) {
+        // Booting the new image for the first time, the bootloader rolls back on the next reset.
+        const esp_timer_create_args_t verify_args = {
+            .callback = verify_timeout,
+            .name = "ota_verify",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&verify_args, &verify_timer));
+        ESP_ERROR_CHECK(esp_timer_start_once(verify_timer, CONFIG_OTA_VERIFY_TIMEOUT_S * 1000000ULL));
+        pending_verify = true;
+    }
+    xTaskCreatePinnedToCore(ota_task, "ota_task", CONFIG_NETWORK_TASK_STACK, NULL,
+                            CONFIG_NETWORK_TASK_PRIORITY, &ota_task_handle, CONFIG_NETWORK_TASK_CORE);
+    metrics_register_task(ota_task_handle);
+}
+
+#endif
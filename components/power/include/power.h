@@ -0,0 +1,17 @@
+/* CPU frequency scaling and automatic light sleep, see CONFIG_POWER_MANAGEMENT */
+#ifndef _POWER_H_
+#define _POWER_H_
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t network_locks;     // TLS and HTTP sections run at full speed
+    uint32_t network_ms;        // Time spent in them
+} power_stats_t;
+
+void init_power(void);
+void power_network_begin(void);
+void power_network_end(void);
+void get_power_stats(power_stats_t* stats);
+
+#endif
@@ -0,0 +1,68 @@
+#include "power.h"
+
+#include <stdio.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "esp_err.h"
+#include "esp_log.h"
+
+#ifdef CONFIG_POWER_MANAGEMENT
+
+/*
+ * The CPU idles at CONFIG_POWER_MIN_FREQ_MHZ and, with tickless idle, light-sleeps
+ * whenever no task is ready. Only the TLS and HTTP work holds network_lock, which
+ * keeps the CPU at the full CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ so handshakes do not
+ * get slower. Wi-Fi keeps its own locks while it needs the radio.
+ */
+static esp_pm_lock_handle_t network_lock = NULL;
+static portMUX_TYPE power_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t network_since = 0;
+static uint32_t network_depth = 0;
+static power_stats_t power_stats;
+
+void power_network_begin(void)
+{
+    esp_pm_lock_acquire(network_lock);
+    portENTER_CRITICAL(&power_lock);
+    if (network_depth++ == 0) {
+        network_since = esp_timer_get_time();
+        power_stats.network_locks++;
+    }
+    portEXIT_CRITICAL(&power_lock);
+}
+
+void power_network_end(void)
+{
+    portENTER_CRITICAL(&power_lock);
+    if (network_depth > 0 && --network_depth == 0) {
+        power_stats.network_ms += (esp_timer_get_time() - network_since) / 1000;
+    }
+    portEXIT_CRITICAL(&power_lock);
+    esp_pm_lock_release(network_lock);
+}
+
+void get_power_stats(power_stats_t* stats)
+{
+    portENTER_CRITICAL(&power_lock);
+    *stats = power_stats;
+    portEXIT_CRITICAL(&power_lock);
+}
+
+void init_power(void)
+{
+    esp_pm_config_t config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_POWER_MIN_FREQ_MHZ,
+#ifdef CONFIG_POWER_LIGHT_SLEEP
+        .light_sleep_enable = true,
+#endif
+    };
+    ESP_ERROR_CHECK(esp_pm_configure(&config));
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "network", &network_lock));
+    printf("Power management: %d-%d MHz, light sleep %s\n", CONFIG_POWER_MIN_FREQ_MHZ,
+           CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, config.light_sleep_enable ? "on" : "off");
+}
+
+#endif
@@ -0,0 +1,33 @@
+/* Persistent MQTT connection for uploads and server commands */
+#ifndef _PUSH_H_
+#define _PUSH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "transport.h"
+
+#define PUSH_TOPIC_PREFIX "pantry-io/"
+#define PUSH_COMMAND_TOPIC "/cmd"
+#define PUSH_TOPIC_MAX_LEN 192
+#define PUSH_PAYLOAD_MAX_LEN 3072   // JSON is built in RAM first, MQTT needs the whole message
+#define PUSH_COMMAND_MAX_LEN 128
+#define PUSH_MAX_LISTENERS 2
+
+/* Called from the MQTT task with a NUL terminated command, must not block */
+typedef void (*push_command_fn)(const char* command, void* ctx);
+
+typedef struct {
+    uint32_t publishes;     // Acknowledged by the broker
+    uint32_t failed;        // Not connected, or no acknowledgement in time
+    uint32_t bytes;         // Payload bytes of acknowledged publishes
+    uint32_t commands;
+    uint32_t connects;
+} push_stats_t;
+
+extern const transport_t push_transport;
+
+void init_push(void);
+int subscribe_push_commands(push_command_fn listener, void* ctx);
+void get_push_stats(push_stats_t* stats);
+
+#endif
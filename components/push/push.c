@@ -0,0 +1,218 @@
+#include "push.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "mqtt_client.h"
+#include "esp_timer.h"
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "nvs_init.h"
+#include "json-writer.h"
+#include "metrics.h"
+#ifdef CONFIG_HEAP_TRACE_GATE
+#include "heap-gate.h"
+#endif
+#ifdef CONFIG_POWER_MANAGEMENT
+#include "power.h"
+#endif
+
+#ifdef CONFIG_PUSH_MQTT
+
+/*
+ * esp-mqtt owns the connection and reconnects on its own. A post publishes with
+ * QoS 1 and waits until the broker acknowledges its message id, so the caller
+ * gets the same kind of answer as from an HTTPS request. Only the uploader posts,
+ * publish_lock keeps a second caller from mixing up the acknowledgements.
+ */
+static esp_mqtt_client_handle_t client = NULL;
+static SemaphoreHandle_t publish_lock = NULL;
+static SemaphoreHandle_t acked = NULL;
+static volatile int acked_msg_id = -1;
+static volatile bool connected = false;
+static char payload[PUSH_PAYLOAD_MAX_LEN];
+static char command_topic[PUSH_TOPIC_MAX_LEN];
+static push_stats_t push_stats;
+
+typedef struct {
+    push_command_fn listener;
+    void* ctx;
+} push_subscriber_t;
+
+static push_subscriber_t push_subscribers[PUSH_MAX_LISTENERS];
+static size_t push_subscriber_count = 0;
+
+static void dispatch_command(const esp_mqtt_event_handle_t event)
+{
+    char command[PUSH_COMMAND_MAX_LEN];
+    // Commands are short, a fragmented message is a bigger payload than we accept.
+    if (event->total_data_len != event->data_len || event->data_len >= sizeof(command)) {
+        ESP_LOGW(__func__, "Ignoring a %d byte command", event->total_data_len);
+        return;
+    }
+    memcpy(command, event->data, event->data_len);
+    command[event->data_len] = '\0';
+    push_stats.commands++;
+    for (size_t i = 0; i < push_subscriber_count; ++i) {
+        push_subscribers[i].listener(command, push_subscribers[i].ctx);
+    }
+}
+
+static void mqtt_event_handler(void* arg, esp_event_base_t base, int32_t event_id, void* data)
+{
+    esp_mqtt_event_handle_t event = data;
+    switch (event->event_id) {
+        case MQTT_EVENT_CONNECTED:
+            ESP_LOGI(__func__, "Connected, session %s", event->session_present ? "resumed" : "new");
+            connected = true;
+            push_stats.connects++;
+            esp_mqtt_client_subscribe(client, command_topic, 1);
+            break;
+        case MQTT_EVENT_DISCONNECTED:
+            ESP_LOGI(__func__, "Disconnected");
+            connected = false;
+            // Nothing will be acknowledged on this connection, wake the waiting post.
+            xSemaphoreGive(acked);
+            break;
+        case MQTT_EVENT_PUBLISHED:
+            acked_msg_id = event->msg_id;
+            xSemaphoreGive(acked);
+            break;
+        case MQTT_EVENT_DATA:
+            if (event->topic_len == strlen(command_topic) &&
+                strncmp(event->topic, command_topic, event->topic_len) == 0) {
+                dispatch_command(event);
+            }
+            break;
+        case MQTT_EVENT_ERROR:
+            ESP_LOGW(__func__, "MQTT error type %d", event->error_handle->error_type);
+            break;
+        default:
+            break;
+    }
+}
+
+static http_result_t publish(const char* path, http_response_t* response, const char* data, size_t len)
+{
+    char topic[PUSH_TOPIC_MAX_LEN];
+    snprintf(topic, sizeof(topic), PUSH_TOPIC_PREFIX "%s%s", get_unit_id(), path);
+    if (response != NULL) {
+        // There is no response body, an acknowledged publish is the 2xx.
+        response->len = 0;
+        response->total = 0;
+        response->status = 0;
+        response->truncated = false;
+        if (response->buf != NULL && response->size > 0) {
+            response->buf[0] = '\0';
+        }
+    }
+    if (!connected) {
+        push_stats.failed++;
+        return HTTP_RESULT_NETWORK;
+    }
+
+    int64_t start = esp_timer_get_time();
+    int64_t deadline = start + CONFIG_PUSH_MQTT_ACK_TIMEOUT_MS * 1000LL;
+#ifdef CONFIG_POWER_MANAGEMENT
+    // The TLS record is encrypted here, the wait for PUBACK can run at the idle clock.
+    power_network_begin();
+#endif
+#ifdef CONFIG_HEAP_TRACE_GATE
+    // esp-mqtt copies a QoS 1 message into its outbox, that is its allocation, not ours.
+    heap_gate_pause();
+#endif
+    int msg_id = esp_mqtt_client_publish(client, topic, data, len, 1, 0);
+#ifdef CONFIG_HEAP_TRACE_GATE
+    heap_gate_resume();
+#endif
+#ifdef CONFIG_POWER_MANAGEMENT
+    power_network_end();
+#endif
+    // The acknowledgement can arrive before we wait for it, acked_msg_id keeps it.
+    while (msg_id >= 0 && acked_msg_id != msg_id && connected) {
+        int64_t left_us = deadline - esp_timer_get_time();
+        if (left_us <= 0 || xSemaphoreTake(acked, pdMS_TO_TICKS(left_us / 1000) + 1) != pdTRUE) {
+            break;
+        }
+    }
+    if (msg_id < 0 || acked_msg_id != msg_id) {
+        push_stats.failed++;
+        return HTTP_RESULT_NETWORK;
+    }
+    metrics_record_us(METRIC_PUSH_PUBLISH, esp_timer_get_time() - start);
+    push_stats.publishes++;
+    push_stats.bytes += len;
+    return HTTP_RESULT_OK;
+}
+
+static http_result_t push_post_data(const char* host, const char* path, http_response_t* response,
+                                    const char* content_type, const uint8_t* data, size_t len)
+{
+    // MQTT 3.1.1 has no Content-Type, frames start with their version byte and JSON with '{'.
+    xSemaphoreTake(publish_lock, portMAX_DELAY);
+    http_result_t result = publish(path, response, (const char*) data, len);
+    xSemaphoreGive(publish_lock);
+    return result;
+}
+
+static http_result_t push_post_json(const char* host, const char* path, http_response_t* response,
+                                    json_build_fn build, void* ctx)
+{
+    xSemaphoreTake(publish_lock, portMAX_DELAY);
+    int len = json_build(payload, sizeof(payload), build, ctx);
+    http_result_t result;
+    if (len < 0) {
+        ESP_LOGE(__func__, "Payload for %s does not fit in %d bytes", path, PUSH_PAYLOAD_MAX_LEN);
+        result = HTTP_RESULT_REJECTED;
+    } else {
+        result = publish(path, response, payload, len);
+    }
+    xSemaphoreGive(publish_lock);
+    return result;
+}
+
+const transport_t push_transport = {
+    .name = "mqtt",
+    .post_json = push_post_json,
+    .post_data = push_post_data,
+};
+
+int subscribe_push_commands(push_command_fn listener, void* ctx)
+{
+    if (push_subscriber_count >= PUSH_MAX_LISTENERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    push_subscribers[push_subscriber_count].listener = listener;
+    push_subscribers[push_subscriber_count].ctx = ctx;
+    push_subscriber_count++;
+    return ESP_OK;
+}
+
+void get_push_stats(push_stats_t* stats)
+{
+    *stats = push_stats;
+}
+
+void init_push(void)
+{
+    publish_lock = xSemaphoreCreateMutex();
+    acked = xSemaphoreCreateBinary();
+    snprintf(command_topic, sizeof(command_topic), PUSH_TOPIC_PREFIX "%s" PUSH_COMMAND_TOPIC, get_unit_id());
+
+    esp_mqtt_client_config_t config = {
+        .broker.address.uri = CONFIG_PUSH_MQTT_URI,
+        .credentials.username = get_unit_id(),
+        .credentials.authentication.password = get_auth_token(),
+        .session.keepalive = CONFIG_PUSH_MQTT_KEEPALIVE_S,
+        .session.disable_clean_session = true,
+    };
+    client = esp_mqtt_client_init(&config);
+    ESP_ERROR_CHECK(esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL));
+    ESP_ERROR_CHECK(esp_mqtt_client_start(client));
+    set_transport(&push_transport);
+}
+
+#endif
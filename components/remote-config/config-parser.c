@@ -0,0 +1,189 @@
+#include "config-parser.h"
+
+#include <string.h>
+
+enum {
+    PARSE_START,        // Before '{'
+    PARSE_KEY_START,    // Before the first key or '}'
+    PARSE_KEY_NEXT,     // After ',', a key has to follow
+    PARSE_KEY,
+    PARSE_KEY_ESCAPE,
+    PARSE_COLON,
+    PARSE_VALUE_START,
+    PARSE_STRING,
+    PARSE_STRING_ESCAPE,
+    PARSE_LITERAL,      // Numbers, true, false and null
+    PARSE_NEXT,         // After a value, before ',' or '}'
+    PARSE_DONE,
+    PARSE_ERROR,
+};
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool is_literal(char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '-' || c == '+' || c == '.' || c == 'E';
+}
+
+void config_parser_init(config_parser_t *parser, config_member_fn member, void *ctx)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->member = member;
+    parser->ctx = ctx;
+    parser->state = PARSE_START;
+}
+
+static void append(char *buf, size_t size, size_t *len, bool *overflow, char c)
+{
+    if (*len + 1 < size) {
+        buf[(*len)++] = c;
+    } else {
+        *overflow = true;
+    }
+}
+
+static void emit(config_parser_t *parser, bool is_string)
+{
+    if (!parser->overflow) {
+        parser->key[parser->key_len] = '\0';
+        parser->value[parser->value_len] = '\0';
+        parser->member(parser->ctx, parser->key, parser->value, is_string);
+    }
+    parser->overflow = false;
+    parser->key_len = 0;
+    parser->value_len = 0;
+}
+
+static char unescape(char c)
+{
+    // \uXXXX is not supported, the hex digits are kept as they are.
+    switch (c) {
+    case 'n': return '\n';
+    case 't': return '\t';
+    case 'r': return '\r';
+    default: return c;
+    }
+}
+
+int config_parser_feed(config_parser_t *parser, const char *data, size_t len)
+{
+    for (size_t i = 0; i < len && parser->state != PARSE_ERROR; ++i) {
+        char c = data[i];
+
+        switch (parser->state) {
+        case PARSE_START:
+            if (c == '{') {
+                parser->state = PARSE_KEY_START;
+            } else if (!is_space(c)) {
+                parser->state = PARSE_ERROR;
+            }
+            break;
+
+        case PARSE_KEY_START:
+            if (c == '"') {
+                parser->state = PARSE_KEY;
+            } else if (c == '}') {
+                parser->state = PARSE_DONE;
+            } else if (!is_space(c)) {
+                parser->state = PARSE_ERROR;
+            }
+            break;
+
+        case PARSE_KEY_NEXT:
+            if (c == '"') {
+                parser->state = PARSE_KEY;
+            } else if (!is_space(c)) {
+                parser->state = PARSE_ERROR;
+            }
+            break;
+
+        case PARSE_KEY:
+            if (c == '"') {
+                parser->state = PARSE_COLON;
+            } else if (c == '\\') {
+                parser->state = PARSE_KEY_ESCAPE;
+            } else {
+                append(parser->key, sizeof(parser->key), &parser->key_len, &parser->overflow, c);
+            }
+            break;
+
+        case PARSE_KEY_ESCAPE:
+            append(parser->key, sizeof(parser->key), &parser->key_len, &parser->overflow, unescape(c));
+            parser->state = PARSE_KEY;
+            break;
+
+        case PARSE_COLON:
+            if (c == ':') {
+                parser->state = PARSE_VALUE_START;
+            } else if (!is_space(c)) {
+                parser->state = PARSE_ERROR;
+            }
+            break;
+
+        case PARSE_VALUE_START:
+            if (c == '"') {
+                parser->state = PARSE_STRING;
+            } else if (is_literal(c)) {
+                append(parser->value, sizeof(parser->value), &parser->value_len, &parser->overflow, c);
+                parser->state = PARSE_LITERAL;
+            } else if (!is_space(c)) {
+                parser->state = PARSE_ERROR;
+            }
+            break;
+
+        case PARSE_STRING:
+            if (c == '"') {
+                emit(parser, true);
+                parser->state = PARSE_NEXT;
+            } else if (c == '\\') {
+                parser->state = PARSE_STRING_ESCAPE;
+            } else {
+                append(parser->value, sizeof(parser->value), &parser->value_len, &parser->overflow, c);
+            }
+            break;
+
+        case PARSE_STRING_ESCAPE:
+            append(parser->value, sizeof(parser->value), &parser->value_len, &parser->overflow, unescape(c));
+            parser->state = PARSE_STRING;
+            break;
+
+        case PARSE_LITERAL:
+            if (is_literal(c)) {
+                append(parser->value, sizeof(parser->value), &parser->value_len, &parser->overflow, c);
+                // A number that does not fit cannot be skipped like a string, it is malformed.
+                if (parser->overflow) {
+                    parser->state = PARSE_ERROR;
+                }
+                break;
+            }
+            emit(parser, false);
+            parser->state = PARSE_NEXT;
+            // The byte that ended the literal is the separator.
+            /* fall through */
+        case PARSE_NEXT:
+            if (c == ',') {
+                parser->state = PARSE_KEY_NEXT;
+            } else if (c == '}') {
+                parser->state = PARSE_DONE;
+            } else if (!is_space(c)) {
+                parser->state = PARSE_ERROR;
+            }
+            break;
+
+        case PARSE_DONE:
+            if (!is_space(c)) {
+                parser->state = PARSE_ERROR;
+            }
+            break;
+        }
+    }
+    return parser->state == PARSE_ERROR ? -1 : 0;
+}
+
+bool config_parser_done(const config_parser_t *parser)
+{
+    return parser->state == PARSE_DONE;
+}
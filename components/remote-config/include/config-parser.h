@@ -0,0 +1,40 @@
+/* One-pass parser for the flat JSON configuration document */
+#ifndef _CONFIG_PARSER_H_
+#define _CONFIG_PARSER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "nvs_init.h"
+
+/*
+ * The document is a single object of string and number members, for example
+ * {"api_host":"example.com","heartbeat_s":3600}. Every member is handed to the
+ * callback as soon as its value ends, nothing else is kept. Nested objects,
+ * arrays, a trailing comma and a number that does not fit are errors. Members
+ * whose key or string value does not fit are skipped.
+ */
+#define CONFIG_PARSER_KEY_MAX 24
+
+/* value is NUL terminated, is_string tells "1" from 1 */
+typedef void (*config_member_fn)(void *ctx, const char *key, const char *value, bool is_string);
+
+typedef struct {
+    config_member_fn member;
+    void *ctx;
+    uint8_t state;
+    bool overflow;
+    char key[CONFIG_PARSER_KEY_MAX];
+    size_t key_len;
+    char value[STR_LENGTH];
+    size_t value_len;
+} config_parser_t;
+
+void config_parser_init(config_parser_t *parser, config_member_fn member, void *ctx);
+/* Returns -1 once the document is malformed, 0 otherwise */
+int config_parser_feed(config_parser_t *parser, const char *data, size_t len);
+/* True when the closing brace was seen and nothing was malformed */
+bool config_parser_done(const config_parser_t *parser);
+
+#endif
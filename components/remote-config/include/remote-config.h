@@ -0,0 +1,21 @@
+/* Configuration document fetched from the API and kept in NVS */
+#ifndef _REMOTE_CONFIG_H_
+#define _REMOTE_CONFIG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define REMOTE_CONFIG_ETAG_LEN 64
+
+typedef struct {
+    uint32_t checks;
+    uint32_t not_modified;  // Answered with a 304
+    uint32_t applied;       // New documents stored and applied
+    uint32_t rejected;      // Malformed documents or values out of range
+} remote_config_stats_t;
+
+/* Fetches the document unless it is unchanged, returns true when new values were applied */
+bool remote_config_check(const char* host);
+void get_remote_config_stats(remote_config_stats_t* stats);
+
+#endif
@@ -0,0 +1,170 @@
+#include "remote-config.h"
+#include "config-parser.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "nvs_init.h"
+#include "http.h"
+#include "button-states.h"
+
+/*
+ * The document is parsed from the response sink as it arrives and the values are
+ * collected here first. Only a complete document with every known member in range
+ * is staged, together with its ETag, and committed in one go. config_commit()
+ * then tells the subscribers, which apply the values.
+ */
+
+typedef struct {
+    const char* name;
+    config_key_t key;
+    config_type_t type;
+    uint32_t min;           // Range of numbers, or of the string length
+    uint32_t max;
+} remote_field_t;
+
+static const remote_field_t fields[] = {
+    {"api_host", CFG_API_HOST, CFG_TYPE_STR, 1, STR_LENGTH - 1},
+    {"api_path", CFG_API_PATH, CFG_TYPE_STR, 0, STR_LENGTH / 2},
+    {"heartbeat_s", CFG_HEARTBEAT_S, CFG_TYPE_U32, 60, 60 * 60 * 24},
+    {"coalesce_ms", CFG_COALESCE_MS, CFG_TYPE_U32, 0, 1000 * 60 * 10},
+    {"max_batch", CFG_MAX_BATCH, CFG_TYPE_U32, 1, DEFAULT_MAX_BATCH},
+    {"bounce_ms", CFG_BOUNCE_MS, CFG_TYPE_U32, 5, 1000},
+};
+
+#define FIELD_COUNT (sizeof(fields) / sizeof(fields[0]))
+
+typedef struct {
+    config_parser_t parser;
+    char strings[FIELD_COUNT][STR_LENGTH];
+    uint32_t numbers[FIELD_COUNT];
+    uint32_t present;       // One bit per field
+    bool invalid;
+} document_t;
+
+static remote_config_stats_t remote_stats;
+
+static bool valid_string(const remote_field_t* field, const char* value)
+{
+    size_t len = strlen(value);
+    if (len < field->min || len > field->max) {
+        return false;
+    }
+    if (field->key == CFG_API_HOST) {
+        return strchr(value, '/') == NULL && strchr(value, ' ') == NULL;
+    }
+    // Paths are joined with "/events" and friends, so no trailing slash.
+    return len == 0 || (value[0] == '/' && value[len - 1] != '/');
+}
+
+static void on_member(void* ctx, const char* key, const char* value, bool is_string)
+{
+    document_t* doc = ctx;
+    for (size_t i = 0; i < FIELD_COUNT; ++i) {
+        const remote_field_t* field = &fields[i];
+        if (strcmp(key, field->name) != 0) {
+            continue;
+        }
+        if (field->type == CFG_TYPE_STR) {
+            if (!is_string || !valid_string(field, value)) {
+                doc->invalid = true;
+                return;
+            }
+            strcpy(doc->strings[i], value);
+        } else {
+            char* end = NULL;
+            errno = 0;
+            unsigned long number = strtoul(value, &end, 10);
+            if (is_string || value[0] == '-' || *end != '\0' || errno == ERANGE ||
+                number < field->min || number > field->max) {
+                doc->invalid = true;
+                return;
+            }
+            doc->numbers[i] = number;
+        }
+        doc->present |= 1UL << i;
+        return;
+    }
+    // Members this firmware does not know are left for newer versions.
+}
+
+static int parse_body(void* ctx, const char* data, size_t len)
+{
+    document_t* doc = ctx;
+    return config_parser_feed(&doc->parser, data, len);
+}
+
+static bool store(const document_t* doc, const char* etag)
+{
+    /* The ETag is only kept with its values, a failed store is fetched again next time */
+    int err = ESP_OK;
+    config_begin();
+    for (size_t i = 0; i < FIELD_COUNT && err == ESP_OK; ++i) {
+        if (!(doc->present & (1UL << i))) {
+            continue;
+        }
+        if (fields[i].type == CFG_TYPE_STR) {
+            err = config_stage_str(fields[i].key, doc->strings[i]);
+        } else {
+            err = config_stage_u32(fields[i].key, doc->numbers[i]);
+        }
+    }
+    if (err == ESP_OK) {
+        err = config_stage_str(CFG_REMOTE_ETAG, etag);
+    }
+    if (err != ESP_OK) {
+        config_discard();
+    } else {
+        err = config_commit();
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(__func__, "Storing the configuration failed: %s", esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+bool remote_config_check(const char* host)
+{
+    static document_t doc;      // Only used by the uploader, too big for its stack
+    char etag[REMOTE_CONFIG_ETAG_LEN];
+
+    memset(&doc, 0, sizeof(doc));
+    config_parser_init(&doc.parser, on_member, &doc);
+    http_response_t response = {
+        .sink = parse_body,
+        .sink_ctx = &doc,
+        .etag = etag,
+        .etag_size = sizeof(etag),
+    };
+    remote_stats.checks++;
+    http_result_t result = http_get_if_none_match(host, CONFIG_REMOTE_CONFIG_PATH, &response,
+                                                  config_get_str(CFG_REMOTE_ETAG), true);
+    if (result != HTTP_RESULT_OK) {
+        return false;
+    }
+    if (response.status == 304) {
+        remote_stats.not_modified++;
+        return false;
+    }
+    if (response.truncated || !config_parser_done(&doc.parser) || doc.invalid) {
+        ESP_LOGE(__func__, "Configuration document rejected");
+        remote_stats.rejected++;
+        return false;
+    }
+    if (!store(&doc, etag)) {
+        return false;
+    }
+    remote_stats.applied++;
+    printf("Applied remote configuration %s\n", etag);
+    return true;
+}
+
+void get_remote_config_stats(remote_config_stats_t* stats)
+{
+    *stats = remote_stats;
+}
@@ -0,0 +1,54 @@
+/* Compact binary encoding of the slot state, the alternative to the JSON payloads */
+#ifndef _STATE_FRAME_H_
+#define _STATE_FRAME_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define STATE_FRAME_VERSION 1
+#define STATE_FRAME_CONTENT_TYPE "application/vnd.pantry-io.frame"
+
+/*
+ * Every frame starts with a header:
+ *   u8 version, u8 type | flags, varint unit id length, unit id bytes, varint seq
+ * Varints are LEB128, signed values are zigzag encoded first.
+ *
+ * STATE_FRAME_SNAPSHOT: varint slot count, (count + 7) / 8 bytes of slot bits,
+ *   slot 0 is the lowest bit of the first byte. With STATE_FRAME_QUANTITIES:
+ *   varint channel count, one signed varint per channel.
+ * STATE_FRAME_EVENTS: varint dropped, u8 replay, varint event count, then per
+ *   event varint seq delta, varint timestamp delta and varint slot << 1 | state.
+ *   The first seq is relative to the header seq, the first timestamp to zero,
+ *   deltas wrap modulo 2^32.
+ */
+typedef enum {
+    STATE_FRAME_SNAPSHOT = 0,
+    STATE_FRAME_EVENTS = 1,
+} state_frame_type_t;
+
+#define STATE_FRAME_QUANTITIES 0x80
+
+typedef struct {
+    uint8_t *buf;           // NULL only counts the length
+    size_t size;
+    size_t len;
+    bool overflow;
+} frame_writer_t;
+
+typedef void (*frame_build_fn)(frame_writer_t *writer, void *ctx);
+
+void frame_writer_init(frame_writer_t *writer, uint8_t *buf, size_t size);
+/* Returns the frame length, or -1 if it did not fit */
+int frame_writer_finish(frame_writer_t *writer);
+
+void frame_header(frame_writer_t *writer, state_frame_type_t type, uint8_t flags,
+                  const char *unit_id, uint32_t seq);
+void frame_u8(frame_writer_t *writer, uint8_t value);
+void frame_varint(frame_writer_t *writer, uint32_t value);
+void frame_svarint(frame_writer_t *writer, int32_t value);
+void frame_bits(frame_writer_t *writer, const uint32_t *bits, size_t count);
+
+int frame_build(uint8_t *buf, size_t size, frame_build_fn build, void *ctx);
+
+#endif
@@ -0,0 +1,83 @@
+#include "state-frame.h"
+
+#include <string.h>
+
+static void put(frame_writer_t *w, const void *data, size_t n)
+{
+    if (w->overflow) {
+        return;
+    }
+    if (w->buf != NULL) {
+        if (w->len + n > w->size) {
+            w->overflow = true;
+            return;
+        }
+        memcpy(w->buf + w->len, data, n);
+    }
+    w->len += n;
+}
+
+void frame_writer_init(frame_writer_t *writer, uint8_t *buf, size_t size)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->buf = buf;
+    writer->size = size;
+}
+
+int frame_writer_finish(frame_writer_t *writer)
+{
+    return writer->overflow ? -1 : (int) writer->len;
+}
+
+void frame_u8(frame_writer_t *w, uint8_t value)
+{
+    put(w, &value, 1);
+}
+
+void frame_varint(frame_writer_t *w, uint32_t value)
+{
+    uint8_t out[5];
+    size_t n = 0;
+    do {
+        out[n] = value & 0x7f;
+        value >>= 7;
+        if (value) {
+            out[n] |= 0x80;
+        }
+        n++;
+    } while (value);
+    put(w, out, n);
+}
+
+void frame_svarint(frame_writer_t *w, int32_t value)
+{
+    frame_varint(w, ((uint32_t) value << 1) ^ (uint32_t) (value >> 31));
+}
+
+void frame_header(frame_writer_t *w, state_frame_type_t type, uint8_t flags,
+                  const char *unit_id, uint32_t seq)
+{
+    size_t id_len = unit_id != NULL ? strlen(unit_id) : 0;
+    frame_u8(w, STATE_FRAME_VERSION);
+    frame_u8(w, (uint8_t) type | flags);
+    frame_varint(w, id_len);
+    put(w, unit_id, id_len);
+    frame_varint(w, seq);
+}
+
+void frame_bits(frame_writer_t *w, const uint32_t *bits, size_t count)
+{
+    // Little-endian bytes of the slot words, so slot n is bit n % 8 of byte n / 8.
+    frame_varint(w, count);
+    for (size_t i = 0; i < (count + 7) / 8; ++i) {
+        frame_u8(w, (bits[i / 4] >> (8 * (i % 4))) & 0xff);
+    }
+}
+
+int frame_build(uint8_t *buf, size_t size, frame_build_fn build, void *ctx)
+{
+    frame_writer_t writer;
+    frame_writer_init(&writer, buf, size);
+    build(&writer, ctx);
+    return frame_writer_finish(&writer);
+}
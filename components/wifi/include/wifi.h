@@ -1,3 +1,34 @@
 /* Set the SSID and Password via project configuration, or can set directly here */
+#ifndef _WIFI_H_
+#define _WIFI_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Last working access point and lease, kept in the config store */
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t valid;
+    uint32_t ip;
+    uint32_t netmask;
+    uint32_t gw;
+    uint32_t dns;
+} wifi_cache_t;
+
+typedef struct {
+    uint32_t connect_ms;   // Start of connect until associated and authenticated
+    uint32_t ip_ms;        // Associated until an IP address was set
+    uint32_t total_ms;
+    uint32_t attempts;     // Connect attempts this time, 1 when the first one worked
+    bool used_cache;       // Connected to the cached BSSID/channel without a scan
+} wifi_timing_t;
 
 void fast_scan(void);
+bool wifi_wait_connected(uint32_t timeout_ms);
+bool wifi_is_connected(void);
+void wifi_get_timing(wifi_timing_t *timing);
+/* Outcome of a request, the first one after connecting on a cached lease decides whether it is kept */
+void wifi_request_done(bool reached_server);
+
+#endif
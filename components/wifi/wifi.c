@@ -1,36 +1,219 @@
 #include <stdio.h>
 #include "wifi.h"
 #include "nvs_init.h"
+#include "backoff.h"
 #include <string.h>
 
 #include <stdio.h>
 #include "esp_wifi.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
 
 #define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 #include "esp_log.h"
 #include "esp_event.h"
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
 #define DEFAULT_SCAN_METHOD WIFI_FAST_SCAN
 #define DEFAULT_SORT_METHOD WIFI_CONNECT_AP_BY_SIGNAL
 #define DEFAULT_AUTHMODE WIFI_AUTH_WPA2_PSK
 #define DEFAULT_RSSI -127
 
+#define WIFI_CONNECTED_BIT BIT0
+
+static EventGroupHandle_t wifi_events = NULL;
+static esp_netif_t *sta_netif = NULL;
+static esp_timer_handle_t reconnect_timer = NULL;
+static wifi_config_t wifi_config;
+static wifi_cache_t cache;
+static bool using_cache = false;
+static volatile bool cached_ip_unproven = false;  // Connected on the cached lease, no request reached a server yet
+static uint32_t failed_attempts = 0;
+static int64_t connect_start = 0;
+static int64_t connected_at = 0;
+static wifi_timing_t timing;
+
+static void set_address(const wifi_cache_t *lease)
+{
+    /* Use a known address instead of asking DHCP, lease == NULL goes back to DHCP. */
+    if (lease == NULL) {
+        esp_netif_dhcpc_start(sta_netif);
+        return;
+    }
+    esp_netif_ip_info_t ip_info = {
+        .ip.addr = lease->ip,
+        .netmask.addr = lease->netmask,
+        .gw.addr = lease->gw,
+    };
+    esp_netif_dns_info_t dns = {
+        .ip.u_addr.ip4.addr = lease->dns,
+        .ip.type = ESP_IPADDR_TYPE_V4,
+    };
+    esp_netif_dhcpc_stop(sta_netif);
+    esp_netif_set_ip_info(sta_netif, &ip_info);
+    esp_netif_set_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &dns);
+}
+
+static void use_cache(bool enable)
+{
+    using_cache = enable;
+    wifi_config.sta.bssid_set = enable;
+    if (enable) {
+        // With the channel set only that channel is scanned.
+        memcpy(wifi_config.sta.bssid, cache.bssid, sizeof(cache.bssid));
+        wifi_config.sta.channel = cache.channel;
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+    } else {
+        memset(wifi_config.sta.bssid, 0, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.channel = 0;
+        wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    }
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+
+#ifdef CONFIG_WIFI_IP_CACHED
+    set_address(enable && cache.ip != 0 ? &cache : NULL);
+#endif
+}
+
+static void save_cache(const wifi_cache_t *new_cache)
+{
+    if (memcmp(&cache, new_cache, sizeof(cache)) == 0) {
+        return;
+    }
+    cache = *new_cache;
+    config_begin();
+    config_stage_blob(CFG_WIFI_CACHE, &cache, sizeof(cache));
+    config_commit();
+}
+
+static void reconnect(void* arg)
+{
+    // The timing covers this attempt, not the backoff that led to it.
+    connect_start = esp_timer_get_time();
+    esp_wifi_connect();
+}
+
+static void schedule_reconnect(void)
+{
+    // failed_attempts counts the disconnect that got us here.
+    uint32_t delay_ms = backoff_delay_ms(failed_attempts - 1, CONFIG_WIFI_BACKOFF_MIN_MS, CONFIG_WIFI_BACKOFF_MAX_MS);
+    ESP_LOGI(__func__, "Reconnect in %u ms", (unsigned) delay_ms);
+    esp_timer_stop(reconnect_timer);
+    esp_timer_start_once(reconnect_timer, (uint64_t) delay_ms * 1000);
+}
+
 static void event_handler(void* arg, esp_event_base_t event_base,
                           int32_t event_id, void* event_data)
 {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+        connect_start = esp_timer_get_time();
         esp_wifi_connect();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        wifi_event_sta_connected_t* event = (wifi_event_sta_connected_t*) event_data;
+        connected_at = esp_timer_get_time();
+        timing.connect_ms = (connected_at - connect_start) / 1000;
+        ESP_LOGI(__func__, "associated on channel %d in %u ms", event->channel, (unsigned) timing.connect_ms);
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        esp_wifi_connect();
+        wifi_event_sta_disconnected_t* event = (wifi_event_sta_disconnected_t*) event_data;
+        bool was_connected = xEventGroupGetBits(wifi_events) & WIFI_CONNECTED_BIT;
+        xEventGroupClearBits(wifi_events, WIFI_CONNECTED_BIT);
+        cached_ip_unproven = false;
+        ESP_LOGI(__func__, "disconnected, reason %d", event->reason);
+
+        if (was_connected) {
+            failed_attempts = 0;
+        } else if (using_cache) {
+            // The cached access point did not work, scan all channels from now on.
+            ESP_LOGI(__func__, "cached connect failed, falling back to a full scan");
+            use_cache(false);
+        }
+        failed_attempts++;
+        schedule_reconnect();
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        ESP_LOGI(__func__, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+        if (xEventGroupGetBits(wifi_events) & WIFI_CONNECTED_BIT) {
+            // DHCP replaced a cached address that did not work, the association stayed up.
+            ESP_LOGI(__func__, "new lease, ip:" IPSTR, IP2STR(&event->ip_info.ip));
+        } else {
+            int64_t now = esp_timer_get_time();
+            timing.ip_ms = (now - connected_at) / 1000;
+            timing.total_ms = (now - connect_start) / 1000;
+            timing.attempts = failed_attempts + 1;
+            timing.used_cache = using_cache;
+            failed_attempts = 0;
+            ESP_LOGI(__func__, "got ip:" IPSTR " in %u ms (connect %u ms, ip %u ms, cached %d)",
+                     IP2STR(&event->ip_info.ip), (unsigned) timing.total_ms,
+                     (unsigned) timing.connect_ms, (unsigned) timing.ip_ms, timing.used_cache);
+#ifdef CONFIG_WIFI_IP_CACHED
+            cached_ip_unproven = using_cache && cache.ip != 0;
+#endif
+        }
+
+        wifi_ap_record_t ap;
+        if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+            esp_netif_dns_info_t dns = {0};
+            esp_netif_get_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &dns);
+            wifi_cache_t new_cache = {
+                .channel = ap.primary,
+                .valid = 1,
+                .ip = event->ip_info.ip.addr,
+                .netmask = event->ip_info.netmask.addr,
+                .gw = event->ip_info.gw.addr,
+                .dns = dns.ip.u_addr.ip4.addr,
+            };
+            memcpy(new_cache.bssid, ap.bssid, sizeof(new_cache.bssid));
+            save_cache(&new_cache);
+        }
+        xEventGroupSetBits(wifi_events, WIFI_CONNECTED_BIT);
     }
 }
 
+bool wifi_wait_connected(uint32_t timeout_ms)
+{
+    if (wifi_events == NULL) {
+        return false;
+    }
+    return xEventGroupWaitBits(wifi_events, WIFI_CONNECTED_BIT, pdFALSE, pdTRUE,
+                               pdMS_TO_TICKS(timeout_ms)) & WIFI_CONNECTED_BIT;
+}
+
+bool wifi_is_connected(void)
+{
+    return wifi_events != NULL && (xEventGroupGetBits(wifi_events) & WIFI_CONNECTED_BIT);
+}
+
+void wifi_get_timing(wifi_timing_t *out)
+{
+    *out = timing;
+}
+
+void wifi_request_done(bool reached_server)
+{
+    /**
+     * Associating proves nothing about a cached address, the lease may have run out
+     * or been handed to another host. If the first request on it reaches no server,
+     * the address is forgotten and DHCP asked for a new one.
+     */
+    if (!cached_ip_unproven) {
+        return;
+    }
+    cached_ip_unproven = false;
+    if (reached_server) {
+        return;
+    }
+    ESP_LOGW(__func__, "nothing reachable on the cached address, asking DHCP");
+    wifi_cache_t new_cache = cache;
+    new_cache.ip = 0;
+    save_cache(&new_cache);
+    set_address(NULL);
+}
+
 /* Initialize Wi-Fi as sta and set scan method */
 void fast_scan(void)
 {
+    wifi_events = xEventGroupCreate();
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
@@ -40,14 +223,20 @@ void fast_scan(void)
     ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL, NULL));
     ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL, NULL));
 
+    const esp_timer_create_args_t reconnect_args = {
+        .callback = reconnect,
+        .name = "wifi_reconnect",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&reconnect_args, &reconnect_timer));
+
     // Initialize default station as network interface instance (esp-netif)
-    esp_netif_t *sta_netif = esp_netif_create_default_wifi_sta();
+    sta_netif = esp_netif_create_default_wifi_sta();
     assert(sta_netif);
     const char *ssid = get_wifi_user();
     const char *pwd = get_wifi_passwd();
 
     // Initialize and start WiFi
-    wifi_config_t wifi_config = {
+    wifi_config_t default_config = {
         .sta = {
             .scan_method = DEFAULT_SCAN_METHOD,
             .sort_method = DEFAULT_SORT_METHOD,
@@ -55,16 +244,33 @@ void fast_scan(void)
             .threshold.authmode = DEFAULT_AUTHMODE,
         },
     };
-    memcpy(wifi_config.sta.ssid, ssid, strlen(ssid));
-    memcpy(wifi_config.sta.password, pwd, strlen(pwd));
-
+    wifi_config = default_config;
+    memcpy(wifi_config.sta.ssid, ssid, strnlen(ssid, sizeof(wifi_config.sta.ssid)));
+    memcpy(wifi_config.sta.password, pwd, strnlen(pwd, sizeof(wifi_config.sta.password)));
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+
+#ifdef CONFIG_WIFI_IP_STATIC
+    wifi_cache_t static_lease = {
+        .ip = esp_ip4addr_aton(CONFIG_WIFI_STATIC_IP),
+        .netmask = esp_ip4addr_aton(CONFIG_WIFI_STATIC_NETMASK),
+        .gw = esp_ip4addr_aton(CONFIG_WIFI_STATIC_GW),
+        .dns = esp_ip4addr_aton(CONFIG_WIFI_STATIC_GW),
+    };
+    set_address(&static_lease);
+#endif
+
+    // Skip the scan (and DHCP, if configured) when the last access point is known.
+    if (config_get_blob(CFG_WIFI_CACHE, &cache, sizeof(cache)) == sizeof(cache) && cache.valid) {
+        use_cache(true);
+    } else {
+        memset(&cache, 0, sizeof(cache));
+    }
     ESP_ERROR_CHECK(esp_wifi_start());
 }
 
 void test(void)
 {
     esp_wifi_disconnect();
-}
\ No newline at end of file
+}
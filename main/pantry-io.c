@@ -17,11 +17,50 @@
 #include "wifi.h"
 #include "http.h"
 #include "button-states.h"
+#include "journal.h"
+#include "metrics.h"
+#include "local-api.h"
+#include "load-cells.h"
+#include "push.h"
+#include "ota.h"
+#include "dlog.h"
+#include "power.h"
 
 void app_main(void)
 {
+    init_dlog();
+#ifdef CONFIG_POWER_MANAGEMENT
+    init_power();
+#endif
     init_nvs();
+    init_journal();
+    init_metrics();
+#ifdef CONFIG_BUTTON_DEEP_SLEEP
+    // One cycle per wakeup, Wi-Fi only comes up when there is something to send.
+    if (sleep_cycle_collect()) {
+        fast_scan();
+        init_http();
+        if (wifi_wait_connected(CONFIG_BUTTON_SLEEP_WIFI_TIMEOUT_MS)) {
+            sleep_cycle_upload();
+        }
+    }
+    sleep_cycle_enter();
+#else
     fast_scan();
+    init_http();
+#ifdef CONFIG_PUSH_MQTT
+    init_push();
+#endif
     init_gpio();
+#ifdef CONFIG_LOAD_CELLS
+    init_load_cells();
+#endif
     init_state_sender();
+#ifdef CONFIG_LOCAL_API
+    init_local_api();
+#endif
+#ifdef CONFIG_OTA_UPDATES
+    init_ota();
+#endif
+#endif
 }
@@ -0,0 +1,153 @@
+#include "esp_ota_ops.h"
+#include "fake-ota.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+static const esp_partition_t slots[2] = {
+    {.type = ESP_PARTITION_TYPE_APP, .subtype = 0x10, .address = 0x10000,
+     .size = FAKE_OTA_SLOT_SIZE, .label = "ota_0"},
+    {.type = ESP_PARTITION_TYPE_APP, .subtype = 0x11, .address = 0x10000 + FAKE_OTA_SLOT_SIZE,
+     .size = FAKE_OTA_SLOT_SIZE, .label = "ota_1"},
+};
+
+static uint8_t image[FAKE_OTA_SLOT_SIZE];
+static size_t image_size = 0;
+static size_t written = 0;
+static bool writing = false;
+static size_t accepted = 0;
+static const esp_partition_t* boot = NULL;
+static char rolled_back[32];
+
+void fake_ota_reset(void)
+{
+    writing = false;
+    written = 0;
+    accepted = 0;
+    boot = NULL;
+    rolled_back[0] = '\0';
+}
+
+void fake_ota_set_rolled_back(const char* version)
+{
+    snprintf(rolled_back, sizeof(rolled_back), "%s", version != NULL ? version : "");
+}
+
+const uint8_t* fake_ota_image(size_t* len)
+{
+    *len = accepted;
+    return image;
+}
+
+const esp_partition_t* fake_ota_boot_partition(void)
+{
+    return boot;
+}
+
+const esp_partition_t* esp_ota_get_running_partition(void)
+{
+    return &slots[0];
+}
+
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from)
+{
+    return &slots[1];
+}
+
+const esp_partition_t* esp_ota_get_last_invalid_partition(void)
+{
+    return rolled_back[0] != '\0' ? &slots[1] : NULL;
+}
+
+esp_err_t esp_ota_get_state_partition(const esp_partition_t* partition, esp_ota_img_states_t* ota_state)
+{
+    if (partition == &slots[0]) {
+        *ota_state = ESP_OTA_IMG_VALID;
+    } else {
+        *ota_state = rolled_back[0] != '\0' ? ESP_OTA_IMG_INVALID : ESP_OTA_IMG_UNDEFINED;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_get_partition_description(const esp_partition_t* partition, esp_app_desc_t* app_desc)
+{
+    if (partition == &slots[0]) {
+        *app_desc = *esp_app_get_description();
+        return ESP_OK;
+    }
+    if (rolled_back[0] == '\0') {
+        return ESP_ERR_NOT_FOUND;
+    }
+    memset(app_desc, 0, sizeof(*app_desc));
+    snprintf(app_desc->version, sizeof(app_desc->version), "%s", rolled_back);
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t* partition, size_t size, esp_ota_handle_t* out_handle)
+{
+    if (partition != &slots[1] || writing) {
+        return ESP_ERR_OTA_PARTITION_CONFLICT;
+    }
+    if (size != OTA_SIZE_UNKNOWN && size > FAKE_OTA_SLOT_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memset(image, 0xff, sizeof(image));
+    image_size = size;
+    written = 0;
+    writing = true;
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void* data, size_t size)
+{
+    if (handle != 1 || !writing) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (size > FAKE_OTA_SLOT_SIZE - written) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(image + written, data, size);
+    written += size;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+    if (handle != 1 || !writing) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    writing = false;
+    // Stands in for the image check, a short or long image would not verify.
+    if (image_size != OTA_SIZE_UNKNOWN && written != image_size) {
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    accepted = written;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t handle)
+{
+    writing = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition)
+{
+    if (partition != &slots[0] && partition != &slots[1]) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    boot = partition;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot(void)
+{
+    return ESP_FAIL;
+}
@@ -0,0 +1,41 @@
+/* Host fake of the OTA API, two app slots in RAM, see fake-ota.h */
+#ifndef _ESP_OTA_OPS_H_
+#define _ESP_OTA_OPS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "esp_app_desc.h"
+
+#define ESP_ERR_OTA_BASE                0x1500
+#define ESP_ERR_OTA_PARTITION_CONFLICT  (ESP_ERR_OTA_BASE + 0x01)
+#define ESP_ERR_OTA_SELECT_INFO_INVALID (ESP_ERR_OTA_BASE + 0x02)
+#define ESP_ERR_OTA_VALIDATE_FAILED     (ESP_ERR_OTA_BASE + 0x03)
+#define OTA_SIZE_UNKNOWN 0xffffffff
+
+typedef uint32_t esp_ota_handle_t;
+
+typedef enum {
+    ESP_OTA_IMG_NEW             = 0x0U,
+    ESP_OTA_IMG_PENDING_VERIFY  = 0x1U,
+    ESP_OTA_IMG_VALID           = 0x2U,
+    ESP_OTA_IMG_INVALID         = 0x3U,
+    ESP_OTA_IMG_ABORTED         = 0x4U,
+    ESP_OTA_IMG_UNDEFINED       = 0xFFFFFFFFU,
+} esp_ota_img_states_t;
+
+const esp_partition_t* esp_ota_get_running_partition(void);
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from);
+const esp_partition_t* esp_ota_get_last_invalid_partition(void);
+esp_err_t esp_ota_get_state_partition(const esp_partition_t* partition, esp_ota_img_states_t* ota_state);
+esp_err_t esp_ota_get_partition_description(const esp_partition_t* partition, esp_app_desc_t* app_desc);
+esp_err_t esp_ota_begin(const esp_partition_t* partition, size_t image_size, esp_ota_handle_t* out_handle);
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void* data, size_t size);
+esp_err_t esp_ota_end(esp_ota_handle_t handle);
+esp_err_t esp_ota_abort(esp_ota_handle_t handle);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition);
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void);
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot(void);
+
+#endif
@@ -0,0 +1,20 @@
+/* Control of the fake OTA slots */
+#ifndef _FAKE_OTA_H_
+#define _FAKE_OTA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_partition.h"
+
+#define FAKE_OTA_SLOT_SIZE 65536
+
+/* Clears both slots, the image running from ota_0 is valid */
+void fake_ota_reset(void);
+/* The bootloader rolled back from the other slot, which holds version, NULL for none */
+void fake_ota_set_rolled_back(const char* version);
+/* Bytes of the last image that esp_ota_end() accepted */
+const uint8_t* fake_ota_image(size_t* len);
+/* The slot set to boot next, NULL if it was not changed */
+const esp_partition_t* fake_ota_boot_partition(void);
+
+#endif
@@ -0,0 +1,105 @@
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "fake-driver.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+struct spi_device_t {
+    spi_host_device_t host;
+    spi_device_interface_config_t config;
+};
+
+static uint8_t levels[GPIO_PIN_COUNT];
+static uint64_t outputs = 0;
+static uint8_t inputs[FAKE_SHIFT_REG_MAX_CHIPS];
+static uint8_t latched[FAKE_SHIFT_REG_MAX_CHIPS];
+static size_t chip_count = 0;
+static uint32_t load_pulses = 0;
+static bool bus_ready[SPI3_HOST + 1];
+static struct spi_device_t devices[SPI3_HOST + 1];
+
+void fake_driver_reset(void)
+{
+    memset(levels, 0, sizeof(levels));
+    memset(bus_ready, 0, sizeof(bus_ready));
+    outputs = 0;
+    load_pulses = 0;
+    chip_count = 0;
+}
+
+void fake_shift_register_set(const uint8_t* chip_levels, size_t chips)
+{
+    chip_count = chips < FAKE_SHIFT_REG_MAX_CHIPS ? chips : FAKE_SHIFT_REG_MAX_CHIPS;
+    memcpy(inputs, chip_levels, chip_count);
+}
+
+uint32_t fake_gpio_load_pulses(void)
+{
+    return load_pulses;
+}
+
+esp_err_t gpio_config(const gpio_config_t* config)
+{
+    if (config->pin_bit_mask >> GPIO_PIN_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->mode == GPIO_MODE_OUTPUT) {
+        outputs |= config->pin_bit_mask;
+    } else {
+        outputs &= ~config->pin_bit_mask;
+    }
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_PIN_COUNT || !(outputs & (1ULL << gpio_num))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (levels[gpio_num] == 0 && level != 0) {
+        load_pulses++;
+        memcpy(latched, inputs, sizeof(latched));
+    }
+    levels[gpio_num] = level != 0;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    return gpio_num >= 0 && gpio_num < GPIO_PIN_COUNT ? levels[gpio_num] : 0;
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host_id, const spi_bus_config_t* bus_config, spi_dma_chan_t dma_chan)
+{
+    if (host_id > SPI3_HOST || bus_ready[host_id]) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    bus_ready[host_id] = true;
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host_id, const spi_device_interface_config_t* dev_config,
+                             spi_device_handle_t* handle)
+{
+    if (host_id > SPI3_HOST || !bus_ready[host_id]) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    devices[host_id].host = host_id;
+    devices[host_id].config = *dev_config;
+    *handle = &devices[host_id];
+    return ESP_OK;
+}
+
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle, spi_transaction_t* trans_desc)
+{
+    if (handle == NULL || trans_desc->length % 8 != 0 || trans_desc->rxlength > trans_desc->length) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Past the end of the chain the serial input of the last chip is read, it is tied high.
+    uint8_t* rx = trans_desc->rx_buffer;
+    for (size_t i = 0; rx != NULL && i < trans_desc->rxlength / 8; ++i) {
+        rx[i] = i < chip_count ? latched[i] : 0xff;
+    }
+    return ESP_OK;
+}
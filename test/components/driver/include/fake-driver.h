@@ -0,0 +1,20 @@
+/* Control of the fake GPIO and SPI drivers */
+#ifndef _FAKE_DRIVER_H_
+#define _FAKE_DRIVER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FAKE_SHIFT_REG_MAX_CHIPS 32
+
+/*
+ * Input levels of the 74HC165 chain, one byte per chip starting with the chip
+ * next to the ESP32, bit 7 is input H. The chain takes them over when an output
+ * pin goes from low to high (the parallel load pulse) and shifts them out MSB first.
+ */
+void fake_shift_register_set(const uint8_t* levels, size_t chips);
+/* Rising edges seen on output pins since the last reset */
+uint32_t fake_gpio_load_pulses(void);
+void fake_driver_reset(void);
+
+#endif
@@ -0,0 +1,12 @@
+#include "esp_app_desc.h"
+
+static const esp_app_desc_t app_desc = {
+    .magic_word = 0xabcd5432,
+    .version = FAKE_APP_VERSION,
+    .project_name = "pantry-io-test",
+};
+
+const esp_app_desc_t* esp_app_get_description(void)
+{
+    return &app_desc;
+}
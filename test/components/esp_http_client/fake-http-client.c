@@ -0,0 +1,369 @@
+#include "esp_http_client.h"
+#include "esp_tls.h"
+#include "fake-http-server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/*
+ * Keeps the parts of esp_http_client that http.c depends on: one connection per
+ * client that stays open between requests, HTTP_EVENT_ON_CONNECTED only when a
+ * request had to connect, headers and the URL kept between requests, and both the
+ * perform() and the open()/write()/fetch_headers()/read() way of sending one.
+ * Nothing goes over a socket, the handler of the test answers every request.
+ */
+#define FAKE_HTTP_DATA_CHUNK 512
+
+struct esp_http_client {
+    http_event_handle_cb event_handler;
+    void* user_data;
+    int timeout_ms;
+    esp_http_client_method_t method;
+    char url[FAKE_HTTP_URL_LEN];
+    size_t header_count;
+    char keys[FAKE_HTTP_MAX_HEADERS][FAKE_HTTP_HEADER_LEN];
+    char values[FAKE_HTTP_MAX_HEADERS][FAKE_HTTP_HEADER_LEN];
+    const char* post_data;
+    int post_len;
+    bool connected;
+    fake_http_request_t request;
+    fake_http_response_t response;
+    size_t read_pos;
+    bool finished;
+};
+
+static struct {
+    fake_http_handler_t handler;
+    void* ctx;
+    bool dropped;
+    bool refuse;
+    fake_http_stats_t stats;
+    fake_http_request_t last_request;
+} server;
+
+void fake_http_server_set(fake_http_handler_t handler, void* ctx)
+{
+    server.handler = handler;
+    server.ctx = ctx;
+    server.dropped = false;
+    server.refuse = false;
+    memset(&server.stats, 0, sizeof(server.stats));
+}
+
+void fake_http_server_drop(void)
+{
+    server.dropped = true;
+}
+
+void fake_http_server_refuse(bool refuse)
+{
+    server.refuse = refuse;
+}
+
+void fake_http_server_stats(fake_http_stats_t* stats)
+{
+    *stats = server.stats;
+}
+
+const fake_http_request_t* fake_http_last_request(void)
+{
+    return &server.last_request;
+}
+
+const char* fake_http_request_header(const fake_http_request_t* request, const char* key)
+{
+    for (size_t i = 0; i < request->header_count; ++i) {
+        if (strcasecmp(request->keys[i], key) == 0) {
+            return request->values[i];
+        }
+    }
+    return NULL;
+}
+
+static void emit(esp_http_client_handle_t client, esp_http_client_event_id_t id, const void* data, int len,
+                 const char* key, const char* value)
+{
+    if (client->event_handler == NULL) {
+        return;
+    }
+    esp_http_client_event_t evt = {
+        .event_id = id,
+        .client = client,
+        .data = (void*) data,
+        .data_len = len,
+        .user_data = client->user_data,
+        .header_key = (char*) key,
+        .header_value = (char*) value,
+    };
+    client->event_handler(&evt);
+}
+
+static esp_err_t connect_client(esp_http_client_handle_t client)
+{
+    if (client->connected && server.dropped) {
+        // Like a kept-alive socket the server closed, it only shows when it is used.
+        server.dropped = false;
+        server.stats.broken++;
+        client->connected = false;
+        return ESP_ERR_HTTP_FETCH_HEADER;
+    }
+    if (client->connected) {
+        return ESP_OK;
+    }
+    if (server.refuse) {
+        return ESP_ERR_HTTP_CONNECT;
+    }
+    server.dropped = false;
+    server.stats.connects++;
+    client->connected = true;
+    emit(client, HTTP_EVENT_ON_CONNECTED, NULL, 0, NULL, NULL);
+    return ESP_OK;
+}
+
+static void begin_request(esp_http_client_handle_t client)
+{
+    fake_http_request_t* request = &client->request;
+    request->method = client->method;
+    snprintf(request->url, sizeof(request->url), "%s", client->url);
+    request->header_count = client->header_count;
+    memcpy(request->keys, client->keys, sizeof(request->keys));
+    memcpy(request->values, client->values, sizeof(request->values));
+    request->body_len = 0;
+    client->read_pos = 0;
+    client->finished = false;
+}
+
+static void append_body(esp_http_client_handle_t client, const char* data, size_t len)
+{
+    fake_http_request_t* request = &client->request;
+    size_t room = sizeof(request->body) - request->body_len;
+    memcpy(request->body + request->body_len, data, len < room ? len : room);
+    request->body_len += len < room ? len : room;
+}
+
+static void answer(esp_http_client_handle_t client)
+{
+    fake_http_response_t* response = &client->response;
+    memset(response, 0, sizeof(*response));
+    response->status = 200;
+    response->drop_after = -1;
+    server.stats.requests++;
+    if (server.handler != NULL) {
+        server.handler(&client->request, response, server.ctx);
+    }
+    server.last_request = client->request;
+    if (response->etag != NULL) {
+        emit(client, HTTP_EVENT_ON_HEADER, NULL, 0, "ETag", response->etag);
+    }
+}
+
+static size_t body_limit(const fake_http_response_t* response)
+{
+    if (response->drop_after >= 0 && (size_t) response->drop_after < response->body_len) {
+        return response->drop_after;
+    }
+    return response->body_len;
+}
+
+static void break_connection(esp_http_client_handle_t client)
+{
+    client->connected = false;
+    emit(client, HTTP_EVENT_DISCONNECTED, NULL, 0, NULL, NULL);
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t* config)
+{
+    esp_http_client_handle_t client = calloc(1, sizeof(struct esp_http_client));
+    if (client == NULL) {
+        return NULL;
+    }
+    client->event_handler = config->event_handler;
+    client->user_data = config->user_data;
+    client->timeout_ms = config->timeout_ms;
+    if (config->url != NULL) {
+        snprintf(client->url, sizeof(client->url), "%s", config->url);
+    } else {
+        snprintf(client->url, sizeof(client->url), "https://%s%s", config->host,
+                 config->path != NULL ? config->path : "/");
+    }
+    return client;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    if (client == NULL) {
+        return ESP_FAIL;
+    }
+    esp_http_client_close(client);
+    free(client);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char* url)
+{
+    snprintf(client->url, sizeof(client->url), "%s", url);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method)
+{
+    client->method = method;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char* key, const char* value)
+{
+    size_t i = 0;
+    while (i < client->header_count && strcasecmp(client->keys[i], key) != 0) {
+        i++;
+    }
+    if (i == FAKE_HTTP_MAX_HEADERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    snprintf(client->keys[i], sizeof(client->keys[i]), "%s", key);
+    snprintf(client->values[i], sizeof(client->values[i]), "%s", value);
+    if (i == client->header_count) {
+        client->header_count++;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char* key)
+{
+    for (size_t i = 0; i < client->header_count; ++i) {
+        if (strcasecmp(client->keys[i], key) == 0) {
+            client->header_count--;
+            memmove(client->keys[i], client->keys[i + 1], (client->header_count - i) * sizeof(client->keys[0]));
+            memmove(client->values[i], client->values[i + 1], (client->header_count - i) * sizeof(client->values[0]));
+            return ESP_OK;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char* data, int len)
+{
+    // Like the real client the body is not copied, it has to outlive the request.
+    client->post_data = data;
+    client->post_len = data != NULL ? len : 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_user_data(esp_http_client_handle_t client, void* data)
+{
+    client->user_data = data;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_timeout_ms(esp_http_client_handle_t client, int timeout_ms)
+{
+    client->timeout_ms = timeout_ms;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client)
+{
+    esp_err_t err = connect_client(client);
+    if (err != ESP_OK) {
+        return err;
+    }
+    begin_request(client);
+    if (client->post_data != NULL) {
+        append_body(client, client->post_data, client->post_len);
+    }
+    answer(client);
+
+    const fake_http_response_t* response = &client->response;
+    size_t limit = body_limit(response);
+    for (size_t pos = 0; pos < limit; pos += FAKE_HTTP_DATA_CHUNK) {
+        size_t len = limit - pos < FAKE_HTTP_DATA_CHUNK ? limit - pos : FAKE_HTTP_DATA_CHUNK;
+        emit(client, HTTP_EVENT_ON_DATA, response->body + pos, len, NULL, NULL);
+    }
+    if (limit < response->body_len) {
+        break_connection(client);
+        return ESP_FAIL;
+    }
+    emit(client, HTTP_EVENT_ON_FINISH, NULL, 0, NULL, NULL);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+    esp_err_t err = connect_client(client);
+    if (err != ESP_OK) {
+        return err;
+    }
+    begin_request(client);
+    return ESP_OK;
+}
+
+int esp_http_client_write(esp_http_client_handle_t client, const char* buffer, int len)
+{
+    if (!client->connected) {
+        return -1;
+    }
+    append_body(client, buffer, len);
+    return len;
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+    if (!client->connected) {
+        return ESP_FAIL;
+    }
+    answer(client);
+    return client->response.body_len;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char* buffer, int len)
+{
+    const fake_http_response_t* response = &client->response;
+    size_t limit = body_limit(response);
+    if (client->read_pos == limit) {
+        if (limit < response->body_len) {
+            break_connection(client);
+            return -1;
+        }
+        if (!client->finished) {
+            client->finished = true;
+            emit(client, HTTP_EVENT_ON_FINISH, NULL, 0, NULL, NULL);
+        }
+        return 0;
+    }
+    size_t n = limit - client->read_pos < (size_t) len ? limit - client->read_pos : (size_t) len;
+    memcpy(buffer, response->body + client->read_pos, n);
+    emit(client, HTTP_EVENT_ON_DATA, buffer, n, NULL, NULL);
+    client->read_pos += n;
+    return n;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    if (client->connected) {
+        break_connection(client);
+    }
+    return ESP_OK;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->response.status;
+}
+
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client)
+{
+    return client->response.body_len;
+}
+
+esp_err_t esp_tls_get_and_clear_last_error(esp_tls_error_handle_t h, int* esp_tls_code, int* esp_tls_flags)
+{
+    if (esp_tls_code != NULL) {
+        *esp_tls_code = 0;
+    }
+    if (esp_tls_flags != NULL) {
+        *esp_tls_flags = 0;
+    }
+    return ESP_OK;
+}
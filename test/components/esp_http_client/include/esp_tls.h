@@ -0,0 +1,11 @@
+/* The part of esp-tls that esp_http_client users see, for the host fake */
+#ifndef _ESP_TLS_H_
+#define _ESP_TLS_H_
+
+#include "esp_err.h"
+
+typedef struct esp_tls_last_error* esp_tls_error_handle_t;
+
+esp_err_t esp_tls_get_and_clear_last_error(esp_tls_error_handle_t h, int* esp_tls_code, int* esp_tls_flags);
+
+#endif
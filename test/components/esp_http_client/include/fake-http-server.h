@@ -0,0 +1,55 @@
+/* Stand-in server behind the fake esp_http_client */
+#ifndef _FAKE_HTTP_SERVER_H_
+#define _FAKE_HTTP_SERVER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_http_client.h"
+
+#define FAKE_HTTP_MAX_HEADERS 8
+#define FAKE_HTTP_HEADER_LEN 128
+#define FAKE_HTTP_URL_LEN 256
+#define FAKE_HTTP_BODY_LEN 4096
+
+/* What the client sent, copied so the test can look at it after the call */
+typedef struct {
+    esp_http_client_method_t method;
+    char url[FAKE_HTTP_URL_LEN];
+    size_t header_count;
+    char keys[FAKE_HTTP_MAX_HEADERS][FAKE_HTTP_HEADER_LEN];
+    char values[FAKE_HTTP_MAX_HEADERS][FAKE_HTTP_HEADER_LEN];
+    char body[FAKE_HTTP_BODY_LEN];
+    size_t body_len;
+} fake_http_request_t;
+
+typedef struct {
+    int status;
+    const char* etag;       // Sent as an ETag header when not NULL
+    const char* body;
+    size_t body_len;
+    int drop_after;         // Body bytes sent before the connection breaks, -1 for all of them
+} fake_http_response_t;
+
+/* Fills in the response to one request, called on the requesting task */
+typedef void (*fake_http_handler_t)(const fake_http_request_t* request, fake_http_response_t* response, void* ctx);
+
+typedef struct {
+    uint32_t connects;      // New connections, every one fires HTTP_EVENT_ON_CONNECTED
+    uint32_t requests;      // Requests that reached the handler
+    uint32_t broken;        // Requests that failed on a connection the server had closed
+} fake_http_stats_t;
+
+/* Replaces the handler and clears the stats, a NULL handler answers 200 with no body */
+void fake_http_server_set(fake_http_handler_t handler, void* ctx);
+/* Closes the kept-alive connection on the server side, the next request on it fails */
+void fake_http_server_drop(void);
+/* Refuses new connections until called again with false */
+void fake_http_server_refuse(bool refuse);
+void fake_http_server_stats(fake_http_stats_t* stats);
+/* The last request that reached the handler */
+const fake_http_request_t* fake_http_last_request(void);
+/* Value of a header of the request, NULL if it was not sent */
+const char* fake_http_request_header(const fake_http_request_t* request, const char* key);
+
+#endif
@@ -0,0 +1,114 @@
+#include "esp_partition.h"
+#include "fake-partition.h"
+
+#include <string.h>
+
+/*
+ * NOR flash: an erase sets a sector to 0xFF, programming can only clear bits.
+ * A write that was cut short leaves the bytes after the cut untouched, which is
+ * what a torn journal record looks like after a power loss.
+ */
+#define FAKE_SECTOR_SIZE 4096
+#define FAKE_PARTITION_SIZE (FAKE_PARTITION_SECTORS * FAKE_SECTOR_SIZE)
+
+static const esp_partition_t journal_partition = {
+    .type = ESP_PARTITION_TYPE_DATA,
+    .subtype = 0x40,
+    .address = 0x3f0000,
+    .size = FAKE_PARTITION_SIZE,
+    .erase_size = FAKE_SECTOR_SIZE,
+    .label = "journal",
+};
+
+static uint8_t flash[FAKE_PARTITION_SIZE];
+static long budget = -1;
+static size_t operations = 0;
+static bool initialized = false;
+
+void fake_partition_reset(void)
+{
+    memset(flash, 0xff, sizeof(flash));
+    budget = -1;
+    operations = 0;
+    initialized = true;
+}
+
+void fake_partition_power_cut(long bytes)
+{
+    budget = bytes;
+}
+
+void fake_partition_power_on(void)
+{
+    budget = -1;
+}
+
+size_t fake_partition_operations(void)
+{
+    return operations;
+}
+
+/* How much of an operation of len units happens before the power is gone */
+static size_t powered_units(size_t len)
+{
+    if (budget < 0) {
+        return len;
+    }
+    size_t n = (size_t) budget < len ? (size_t) budget : len;
+    budget -= n;
+    return n;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label)
+{
+    if (!initialized) {
+        fake_partition_reset();
+    }
+    if (type != journal_partition.type || subtype != journal_partition.subtype ||
+        (label != NULL && strcmp(label, journal_partition.label) != 0)) {
+        return NULL;
+    }
+    return &journal_partition;
+}
+
+static bool in_range(const esp_partition_t* partition, size_t offset, size_t size)
+{
+    return partition == &journal_partition && offset <= FAKE_PARTITION_SIZE && size <= FAKE_PARTITION_SIZE - offset;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size)
+{
+    if (!in_range(partition, src_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, flash + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size)
+{
+    if (!in_range(partition, dst_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    // The firmware sees a successful write either way, it is the next boot that finds out.
+    size_t n = powered_units(size);
+    const uint8_t* bytes = src;
+    for (size_t i = 0; i < n; ++i) {
+        flash[dst_offset + i] &= bytes[i];
+    }
+    operations += size;
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size)
+{
+    if (!in_range(partition, offset, size) || offset % FAKE_SECTOR_SIZE != 0 || size % FAKE_SECTOR_SIZE != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (powered_units(1) == 1) {
+        memset(flash + offset, 0xff, size);
+    }
+    operations++;
+    return ESP_OK;
+}
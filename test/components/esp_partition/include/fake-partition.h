@@ -0,0 +1,22 @@
+/* Control of the fake journal partition */
+#ifndef _FAKE_PARTITION_H_
+#define _FAKE_PARTITION_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FAKE_PARTITION_SECTORS 3
+
+/* Erases the whole partition and restores the power */
+void fake_partition_reset(void);
+/*
+ * Cuts the power after budget more bytes were programmed, an erase counts as one.
+ * The write that runs out is applied up to the last byte paid for, later writes
+ * and erases are lost. A negative budget never cuts.
+ */
+void fake_partition_power_cut(long budget);
+void fake_partition_power_on(void);
+/* Bytes programmed plus erases, the unit of the budget */
+size_t fake_partition_operations(void);
+
+#endif
@@ -0,0 +1,97 @@
+#include "heap-gate.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifdef CONFIG_HEAP_TRACE_GATE
+
+/*
+ * The host has no heap_trace, malloc, calloc and realloc are wrapped at link time
+ * instead and count the calls of the gated task like the allocation hook of the
+ * real gate does. A failed cycle is only recorded, the test checks the stats.
+ */
+static TaskHandle_t gated_task = NULL;
+static volatile bool paused = false;
+static volatile uint32_t allocations = 0;
+static uint32_t cycles = 0;
+static heap_gate_stats_t gate_stats;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+static void count_allocation(void)
+{
+    if (gated_task != NULL && !paused && xTaskGetCurrentTaskHandle() == gated_task) {
+        allocations++;
+    }
+}
+
+void* __wrap_malloc(size_t size)
+{
+    count_allocation();
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size)
+{
+    count_allocation();
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    count_allocation();
+    return __real_realloc(ptr, size);
+}
+
+void heap_gate_begin(void)
+{
+    if (++cycles <= CONFIG_HEAP_TRACE_GATE_WARMUP) {
+        return;
+    }
+    allocations = 0;
+    paused = false;
+    gated_task = xTaskGetCurrentTaskHandle();
+}
+
+void heap_gate_pause(void)
+{
+    paused = true;
+}
+
+void heap_gate_resume(void)
+{
+    paused = false;
+}
+
+void heap_gate_end(const char* cycle)
+{
+    if (gated_task != xTaskGetCurrentTaskHandle()) {
+        return;
+    }
+    gated_task = NULL;
+    gate_stats.traced++;
+    if (allocations == 0) {
+        return;
+    }
+    gate_stats.failed++;
+    gate_stats.allocations = allocations;
+    printf("Heap gate: %s cycle allocated %u times\n", cycle, (unsigned) allocations);
+}
+
+void get_heap_gate_stats(heap_gate_stats_t* stats)
+{
+    *stats = gate_stats;
+}
+
+void init_heap_gate(void)
+{
+}
+
+#endif
@@ -0,0 +1,76 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_timer.h"
+
+/* Same buckets as the real metrics, without the console, heap and stack numbers of the device */
+static metrics_histogram_t histograms[METRIC_HIST_COUNT];
+static uint32_t gauges[METRIC_GAUGE_COUNT];
+
+static int bucket_of(uint32_t ms)
+{
+    int bucket = ms == 0 ? 0 : 32 - __builtin_clz(ms);
+    return bucket < METRICS_BUCKETS ? bucket : METRICS_BUCKETS - 1;
+}
+
+void init_metrics(void)
+{
+    memset(histograms, 0, sizeof(histograms));
+    memset(gauges, 0, sizeof(gauges));
+}
+
+void metrics_record_ms(metric_hist_t hist, uint32_t ms)
+{
+    if (hist >= METRIC_HIST_COUNT) {
+        return;
+    }
+    metrics_histogram_t* h = &histograms[hist];
+    h->buckets[bucket_of(ms)]++;
+    h->count++;
+    h->sum_ms += ms;
+    if (ms > h->max_ms) {
+        h->max_ms = ms;
+    }
+}
+
+void metrics_record_us(metric_hist_t hist, int64_t us)
+{
+    metrics_record_ms(hist, us > 0 ? us / 1000 : 0);
+}
+
+void metrics_gauge_max(metric_gauge_t gauge, uint32_t value)
+{
+    if (gauge < METRIC_GAUGE_COUNT && value > gauges[gauge]) {
+        gauges[gauge] = value;
+    }
+}
+
+void metrics_register_task(TaskHandle_t task)
+{
+}
+
+void metrics_snapshot(metrics_snapshot_t* snapshot)
+{
+    memset(snapshot, 0, sizeof(*snapshot));
+    memcpy(snapshot->hist, histograms, sizeof(snapshot->hist));
+    memcpy(snapshot->gauges, gauges, sizeof(snapshot->gauges));
+    snapshot->uptime_s = esp_timer_get_time() / 1000000;
+}
+
+void metrics_write_json(json_writer_t* writer, const metrics_snapshot_t* snapshot)
+{
+    json_begin_object(writer);
+    json_key(writer, "uptime_s");
+    json_uint(writer, snapshot->uptime_s);
+    json_end_object(writer);
+}
+
+void metrics_print(void)
+{
+    for (int i = 0; i < METRIC_HIST_COUNT; ++i) {
+        printf("hist %d: %u samples, max %u ms\n", i, (unsigned) histograms[i].count,
+               (unsigned) histograms[i].max_ms);
+    }
+}
@@ -0,0 +1,242 @@
+#include "nvs_flash.h"
+#include "fake-nvs.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+/*
+ * Values are kept per namespace and key. Writes stay with their handle until
+ * nvs_commit, so a failed commit leaves the store as it was.
+ */
+#define FAKE_NVS_ENTRIES 32
+#define FAKE_NVS_HANDLES 4
+#define FAKE_NVS_PENDING 16
+#define FAKE_NVS_NAME_LEN 16
+#define FAKE_NVS_VALUE_LEN 256
+
+typedef enum {
+    ENTRY_STR,
+    ENTRY_U32,
+    ENTRY_BLOB,
+} entry_type_t;
+
+typedef struct {
+    bool used;
+    char ns[FAKE_NVS_NAME_LEN];
+    char key[FAKE_NVS_NAME_LEN];
+    entry_type_t type;
+    uint8_t data[FAKE_NVS_VALUE_LEN];
+    size_t len;
+} entry_t;
+
+typedef struct {
+    bool open;
+    nvs_open_mode_t mode;
+    char ns[FAKE_NVS_NAME_LEN];
+    entry_t pending[FAKE_NVS_PENDING];
+    size_t pending_count;
+} handle_t;
+
+static entry_t entries[FAKE_NVS_ENTRIES];
+static handle_t handles[FAKE_NVS_HANDLES];
+static esp_err_t set_error = ESP_OK;
+static esp_err_t commit_error = ESP_OK;
+static unsigned commits = 0;
+
+void fake_nvs_fail_set(esp_err_t err)
+{
+    set_error = err;
+}
+
+void fake_nvs_fail_commit(esp_err_t err)
+{
+    commit_error = err;
+}
+
+unsigned fake_nvs_commits(void)
+{
+    return commits;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    memset(entries, 0, sizeof(entries));
+    commits = 0;
+    return ESP_OK;
+}
+
+static handle_t* get_handle(nvs_handle_t handle)
+{
+    if (handle == 0 || handle > FAKE_NVS_HANDLES || !handles[handle - 1].open) {
+        return NULL;
+    }
+    return &handles[handle - 1];
+}
+
+static entry_t* find(const char* ns, const char* key)
+{
+    for (size_t i = 0; i < FAKE_NVS_ENTRIES; ++i) {
+        if (entries[i].used && strcmp(entries[i].ns, ns) == 0 &&
+            (key == NULL || strcmp(entries[i].key, key) == 0)) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t nvs_open(const char* namespace_name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle)
+{
+    if (strlen(namespace_name) >= FAKE_NVS_NAME_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Like NVS, a namespace only exists once something was written to it.
+    if (open_mode == NVS_READONLY && find(namespace_name, NULL) == NULL) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    for (size_t i = 0; i < FAKE_NVS_HANDLES; ++i) {
+        if (!handles[i].open) {
+            memset(&handles[i], 0, sizeof(handles[i]));
+            handles[i].open = true;
+            handles[i].mode = open_mode;
+            strcpy(handles[i].ns, namespace_name);
+            *out_handle = i + 1;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    handle_t* h = get_handle(handle);
+    if (h != NULL) {
+        h->open = false;
+    }
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    handle_t* h = get_handle(handle);
+    if (h == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (commit_error != ESP_OK) {
+        esp_err_t err = commit_error;
+        commit_error = ESP_OK;
+        h->pending_count = 0;
+        return err;
+    }
+    for (size_t i = 0; i < h->pending_count; ++i) {
+        entry_t* entry = find(h->ns, h->pending[i].key);
+        for (size_t j = 0; entry == NULL && j < FAKE_NVS_ENTRIES; ++j) {
+            if (!entries[j].used) {
+                entry = &entries[j];
+            }
+        }
+        if (entry == NULL) {
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+        *entry = h->pending[i];
+    }
+    h->pending_count = 0;
+    commits++;
+    return ESP_OK;
+}
+
+static esp_err_t get_value(nvs_handle_t handle, const char* key, entry_type_t type, void* out, size_t* length)
+{
+    handle_t* h = get_handle(handle);
+    if (h == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    const entry_t* entry = find(h->ns, key);
+    if (entry == NULL) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (entry->type != type) {
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+    if (out == NULL) {
+        *length = entry->len;
+        return ESP_OK;
+    }
+    if (*length < entry->len) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(out, entry->data, entry->len);
+    *length = entry->len;
+    return ESP_OK;
+}
+
+static esp_err_t set_value(nvs_handle_t handle, const char* key, entry_type_t type, const void* value, size_t len)
+{
+    handle_t* h = get_handle(handle);
+    if (h == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (h->mode == NVS_READONLY) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    if (strlen(key) >= FAKE_NVS_NAME_LEN || len > FAKE_NVS_VALUE_LEN) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    if (set_error != ESP_OK) {
+        esp_err_t err = set_error;
+        set_error = ESP_OK;
+        return err;
+    }
+    size_t i = 0;
+    while (i < h->pending_count && strcmp(h->pending[i].key, key) != 0) {
+        i++;
+    }
+    if (i == FAKE_NVS_PENDING) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    entry_t* entry = &h->pending[i];
+    entry->used = true;
+    strcpy(entry->ns, h->ns);
+    strcpy(entry->key, key);
+    entry->type = type;
+    memcpy(entry->data, value, len);
+    entry->len = len;
+    if (i == h->pending_count) {
+        h->pending_count++;
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char* key, char* out_value, size_t* length)
+{
+    return get_value(handle, key, ENTRY_STR, out_value, length);
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char* key, uint32_t* out_value)
+{
+    size_t length = sizeof(*out_value);
+    return get_value(handle, key, ENTRY_U32, out_value, &length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length)
+{
+    return get_value(handle, key, ENTRY_BLOB, out_value, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value)
+{
+    return set_value(handle, key, ENTRY_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char* key, uint32_t value)
+{
+    return set_value(handle, key, ENTRY_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length)
+{
+    return set_value(handle, key, ENTRY_BLOB, value, length);
+}
@@ -0,0 +1,14 @@
+/* Control of the fake NVS store */
+#ifndef _FAKE_NVS_H_
+#define _FAKE_NVS_H_
+
+#include "nvs.h"
+
+/* The next nvs_set_* returns err, or ESP_OK to stop failing */
+void fake_nvs_fail_set(esp_err_t err);
+/* The next nvs_commit returns err and drops the writes of its handle */
+void fake_nvs_fail_commit(esp_err_t err);
+/* Committed writes since the store was erased */
+unsigned fake_nvs_commits(void);
+
+#endif
@@ -0,0 +1,10 @@
+/* Host fake of nvs_flash, see fake-nvs.h */
+#ifndef _NVS_FLASH_H_
+#define _NVS_FLASH_H_
+
+#include "nvs.h"
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
+
+#endif
@@ -0,0 +1,34 @@
+#include "wifi.h"
+#include "fake-wifi.h"
+
+#include <string.h>
+
+static volatile bool connected = true;
+
+void fake_wifi_set_connected(bool value)
+{
+    connected = value;
+}
+
+void fast_scan(void)
+{
+}
+
+bool wifi_wait_connected(uint32_t timeout_ms)
+{
+    return connected;
+}
+
+bool wifi_is_connected(void)
+{
+    return connected;
+}
+
+void wifi_get_timing(wifi_timing_t *timing)
+{
+    memset(timing, 0, sizeof(*timing));
+}
+
+void wifi_request_done(bool reached_server)
+{
+}
@@ -0,0 +1,10 @@
+/* Control of the fake Wi-Fi station */
+#ifndef _FAKE_WIFI_H_
+#define _FAKE_WIFI_H_
+
+#include <stdbool.h>
+
+/* Connected unless set otherwise */
+void fake_wifi_set_connected(bool connected);
+
+#endif
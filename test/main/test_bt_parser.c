@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "unity.h"
+#include "bt-parser.h"
+#include "tests.h"
+
+static const char message[] =
+    "username{my wifi}usernamepassword{secret}passwordauthkey{0123abcd}authkeyid{unit-7}id";
+
+static void test_all_fields_in_one_packet(void)
+{
+    bt_parser_t parser;
+    bt_parser_init(&parser);
+    TEST_ASSERT_EQUAL_HEX32(BT_FIELDS_ALL, bt_parser_feed(&parser, message, strlen(message)));
+    TEST_ASSERT_EQUAL_STRING("my wifi", bt_parser_value(&parser, BT_FIELD_USERNAME));
+    TEST_ASSERT_EQUAL_STRING("secret", bt_parser_value(&parser, BT_FIELD_PASSWORD));
+    TEST_ASSERT_EQUAL_STRING("0123abcd", bt_parser_value(&parser, BT_FIELD_AUTHKEY));
+    TEST_ASSERT_EQUAL_STRING("unit-7", bt_parser_value(&parser, BT_FIELD_ID));
+}
+
+static void test_fields_span_packets(void)
+{
+    bt_parser_t parser;
+    bt_parser_init(&parser);
+    uint32_t completed = 0;
+    for (size_t i = 0; i < strlen(message); ++i) {
+        completed |= bt_parser_feed(&parser, message + i, 1);
+    }
+    TEST_ASSERT_EQUAL_HEX32(BT_FIELDS_ALL, completed);
+    TEST_ASSERT_EQUAL_STRING("my wifi", bt_parser_value(&parser, BT_FIELD_USERNAME));
+    TEST_ASSERT_EQUAL_STRING("unit-7", bt_parser_value(&parser, BT_FIELD_ID));
+}
+
+static void test_brace_inside_value(void)
+{
+    static const char data[] = "password{a}b}passw}password";
+    bt_parser_t parser;
+    bt_parser_init(&parser);
+    TEST_ASSERT_EQUAL_HEX32(BT_FIELD_BIT(BT_FIELD_PASSWORD), bt_parser_feed(&parser, data, strlen(data)));
+    TEST_ASSERT_EQUAL_STRING("a}b}passw", bt_parser_value(&parser, BT_FIELD_PASSWORD));
+}
+
+static void test_noise_between_fields(void)
+{
+    static const char data[] = "\r\n>>xusername{u}username ## id{1}id";
+    bt_parser_t parser;
+    bt_parser_init(&parser);
+    bt_parser_feed(&parser, data, strlen(data));
+    TEST_ASSERT_EQUAL_STRING("u", bt_parser_value(&parser, BT_FIELD_USERNAME));
+    TEST_ASSERT_EQUAL_STRING("1", bt_parser_value(&parser, BT_FIELD_ID));
+    TEST_ASSERT_NULL(bt_parser_value(&parser, BT_FIELD_PASSWORD));
+}
+
+static void test_long_value_is_dropped(void)
+{
+    char data[STR_LENGTH + 32];
+    size_t len = sprintf(data, "authkey{");
+    memset(data + len, 'k', STR_LENGTH);
+    len += STR_LENGTH;
+    len += sprintf(data + len, "}authkey");
+
+    bt_parser_t parser;
+    bt_parser_init(&parser);
+    TEST_ASSERT_EQUAL_HEX32(0, bt_parser_feed(&parser, data, len));
+    TEST_ASSERT_NULL(bt_parser_value(&parser, BT_FIELD_AUTHKEY));
+    TEST_ASSERT_EQUAL_HEX32(BT_FIELD_BIT(BT_FIELD_AUTHKEY), parser.overflowed);
+
+    // A value that fits replaces it.
+    static const char retry[] = "authkey{short}authkey";
+    TEST_ASSERT_EQUAL_HEX32(BT_FIELD_BIT(BT_FIELD_AUTHKEY), bt_parser_feed(&parser, retry, strlen(retry)));
+    TEST_ASSERT_EQUAL_STRING("short", bt_parser_value(&parser, BT_FIELD_AUTHKEY));
+}
+
+void run_bt_parser_tests(void)
+{
+    RUN_TEST(test_all_fields_in_one_packet);
+    RUN_TEST(test_fields_span_packets);
+    RUN_TEST(test_brace_inside_value);
+    RUN_TEST(test_noise_between_fields);
+    RUN_TEST(test_long_value_is_dropped);
+}
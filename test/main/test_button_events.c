@@ -0,0 +1,60 @@
+#include "unity.h"
+#include "button-events.h"
+#include "tests.h"
+
+static void drain(void)
+{
+    button_events_ack(button_events_last_seq());
+}
+
+static void test_events_stay_until_acknowledged(void)
+{
+    drain();
+    uint32_t first = button_event_push(3, true, 100);
+    button_event_push(4, false, 110);
+    button_event_push(3, false, 120);
+    TEST_ASSERT_EQUAL(3, button_events_pending());
+
+    button_event_t events[4];
+    TEST_ASSERT_EQUAL(3, button_events_peek(events, 4));
+    TEST_ASSERT_EQUAL_UINT32(first, events[0].seq);
+    TEST_ASSERT_EQUAL_UINT32(first + 2, events[2].seq);
+    TEST_ASSERT_EQUAL_UINT16(4, events[1].slot);
+    TEST_ASSERT_FALSE(events[1].state);
+    TEST_ASSERT_EQUAL_UINT32(120, events[2].timestamp);
+
+    // A peek does not consume, an ack removes up to and including the sequence number.
+    TEST_ASSERT_EQUAL(3, button_events_peek(events, 4));
+    button_events_ack(first + 1);
+    TEST_ASSERT_EQUAL(1, button_events_peek(events, 4));
+    TEST_ASSERT_EQUAL_UINT32(first + 2, events[0].seq);
+    drain();
+    TEST_ASSERT_EQUAL(0, button_events_pending());
+}
+
+static void test_full_ring_drops_the_oldest(void)
+{
+    drain();
+    uint32_t dropped = button_events_dropped();
+    uint32_t first = button_events_last_seq() + 1;
+    for (int i = 0; i < BUTTON_EVENT_QUEUE_LEN + 3; ++i) {
+        button_event_push(i % 8, i & 1, i);
+    }
+    TEST_ASSERT_EQUAL(BUTTON_EVENT_QUEUE_LEN, button_events_pending());
+    TEST_ASSERT_EQUAL_UINT32(dropped + 3, button_events_dropped());
+
+    button_event_t oldest;
+    TEST_ASSERT_EQUAL(1, button_events_peek(&oldest, 1));
+    TEST_ASSERT_EQUAL_UINT32(first + 3, oldest.seq);
+
+    // Acknowledging events that were already overwritten removes nothing.
+    button_events_ack(first + 1);
+    TEST_ASSERT_EQUAL(BUTTON_EVENT_QUEUE_LEN, button_events_pending());
+    drain();
+}
+
+void run_button_events_tests(void)
+{
+    RUN_TEST(test_events_stay_until_acknowledged);
+    RUN_TEST(test_full_ring_drops_the_oldest);
+}
@@ -0,0 +1,119 @@
+#include <string.h>
+
+#include "unity.h"
+#include "config-parser.h"
+#include "tests.h"
+
+#define MAX_MEMBERS 8
+
+typedef struct {
+    size_t count;
+    char keys[MAX_MEMBERS][CONFIG_PARSER_KEY_MAX];
+    char values[MAX_MEMBERS][STR_LENGTH];
+    bool strings[MAX_MEMBERS];
+} members_t;
+
+static void collect(void* ctx, const char* key, const char* value, bool is_string)
+{
+    members_t* members = ctx;
+    TEST_ASSERT_LESS_THAN(MAX_MEMBERS, members->count);
+    strcpy(members->keys[members->count], key);
+    strcpy(members->values[members->count], value);
+    members->strings[members->count] = is_string;
+    members->count++;
+}
+
+static const char document[] =
+    " {\"api_host\" : \"example.com\",\n\"heartbeat_s\":3600, \"api_path\":\"/a\\\"b\",\"bounce_ms\":25}\n";
+
+static void check_document(const members_t* members)
+{
+    TEST_ASSERT_EQUAL(4, members->count);
+    TEST_ASSERT_EQUAL_STRING("api_host", members->keys[0]);
+    TEST_ASSERT_EQUAL_STRING("example.com", members->values[0]);
+    TEST_ASSERT_TRUE(members->strings[0]);
+    TEST_ASSERT_EQUAL_STRING("heartbeat_s", members->keys[1]);
+    TEST_ASSERT_EQUAL_STRING("3600", members->values[1]);
+    TEST_ASSERT_FALSE(members->strings[1]);
+    TEST_ASSERT_EQUAL_STRING("/a\"b", members->values[2]);
+    TEST_ASSERT_EQUAL_STRING("25", members->values[3]);
+}
+
+static void test_document_in_one_piece(void)
+{
+    members_t members = {0};
+    config_parser_t parser;
+    config_parser_init(&parser, collect, &members);
+    TEST_ASSERT_EQUAL(0, config_parser_feed(&parser, document, strlen(document)));
+    TEST_ASSERT_TRUE(config_parser_done(&parser));
+    check_document(&members);
+}
+
+static void test_document_byte_by_byte(void)
+{
+    members_t members = {0};
+    config_parser_t parser;
+    config_parser_init(&parser, collect, &members);
+    for (size_t i = 0; i < strlen(document); ++i) {
+        TEST_ASSERT_EQUAL(0, config_parser_feed(&parser, document + i, 1));
+    }
+    TEST_ASSERT_TRUE(config_parser_done(&parser));
+    check_document(&members);
+}
+
+static bool parses(const char* data)
+{
+    members_t members = {0};
+    config_parser_t parser;
+    config_parser_init(&parser, collect, &members);
+    return config_parser_feed(&parser, data, strlen(data)) == 0 && config_parser_done(&parser);
+}
+
+static void test_malformed_documents(void)
+{
+    TEST_ASSERT_TRUE(parses("{}"));
+    TEST_ASSERT_FALSE(parses("{\"a\":1,}"));
+    TEST_ASSERT_FALSE(parses("{\"a\":1,,\"b\":2}"));
+    TEST_ASSERT_FALSE(parses("{\"a\":{\"b\":1}}"));
+    TEST_ASSERT_FALSE(parses("{\"a\":[1]}"));
+    TEST_ASSERT_FALSE(parses("{\"a\" 1}"));
+    TEST_ASSERT_FALSE(parses("{\"a\":1} x"));
+    TEST_ASSERT_FALSE(parses("[]"));
+    TEST_ASSERT_FALSE(parses("{\"a\":1"));
+}
+
+static void test_long_number_is_an_error(void)
+{
+    char data[STR_LENGTH + 16];
+    strcpy(data, "{\"a\":");
+    size_t len = strlen(data);
+    memset(data + len, '9', STR_LENGTH);
+    strcpy(data + len + STR_LENGTH, "}");
+    TEST_ASSERT_FALSE(parses(data));
+}
+
+static void test_long_string_is_skipped(void)
+{
+    char data[STR_LENGTH + 64];
+    strcpy(data, "{\"a\":\"");
+    size_t len = strlen(data);
+    memset(data + len, 'x', STR_LENGTH);
+    strcpy(data + len + STR_LENGTH, "\",\"b\":2}");
+
+    members_t members = {0};
+    config_parser_t parser;
+    config_parser_init(&parser, collect, &members);
+    TEST_ASSERT_EQUAL(0, config_parser_feed(&parser, data, strlen(data)));
+    TEST_ASSERT_TRUE(config_parser_done(&parser));
+    TEST_ASSERT_EQUAL(1, members.count);
+    TEST_ASSERT_EQUAL_STRING("b", members.keys[0]);
+}
+
+void run_config_parser_tests(void)
+{
+    RUN_TEST(test_document_in_one_piece);
+    RUN_TEST(test_document_byte_by_byte);
+    RUN_TEST(test_malformed_documents);
+    RUN_TEST(test_long_number_is_an_error);
+    RUN_TEST(test_long_string_is_skipped);
+}
@@ -0,0 +1,123 @@
+#include <string.h>
+
+#include "unity.h"
+#include "nvs_flash.h"
+#include "nvs_init.h"
+#include "fake-nvs.h"
+#include "esp_err.h"
+#include "tests.h"
+
+static uint32_t notified = 0;
+
+static void on_change(config_key_t key, void* ctx)
+{
+    notified |= 1UL << key;
+}
+
+static void fresh_store(void)
+{
+    // init_nvs() keeps what is in RAM while the namespace is missing, one stored value makes it reload every key.
+    static bool subscribed = false;
+    nvs_flash_erase();
+    init_nvs();
+    save_unit_id("unit-1");
+    init_nvs();
+    if (!subscribed) {
+        TEST_ASSERT_EQUAL(ESP_OK, config_subscribe(on_change, NULL));
+        subscribed = true;
+    }
+    notified = 0;
+}
+
+static void test_batch_is_written_and_announced(void)
+{
+    fresh_store();
+    TEST_ASSERT_FALSE(config_is_set(CFG_API_HOST));
+
+    unsigned commits = fake_nvs_commits();
+    config_begin();
+    TEST_ASSERT_EQUAL(ESP_OK, config_stage_str(CFG_API_HOST, "example.com"));
+    TEST_ASSERT_EQUAL(ESP_OK, config_stage_u32(CFG_HEARTBEAT_S, 600));
+    TEST_ASSERT_EQUAL(ESP_OK, config_commit());
+    TEST_ASSERT_EQUAL(commits + 1, fake_nvs_commits());
+    TEST_ASSERT_EQUAL_HEX32((1UL << CFG_API_HOST) | (1UL << CFG_HEARTBEAT_S), notified);
+
+    // The values come back from NVS after a restart.
+    init_nvs();
+    TEST_ASSERT_EQUAL_STRING("example.com", config_get_str(CFG_API_HOST));
+    TEST_ASSERT_EQUAL_UINT32(600, config_get_u32(CFG_HEARTBEAT_S, 0));
+
+    // Unchanged values are written but not announced.
+    notified = 0;
+    config_begin();
+    config_stage_u32(CFG_HEARTBEAT_S, 600);
+    TEST_ASSERT_EQUAL(ESP_OK, config_commit());
+    TEST_ASSERT_EQUAL_HEX32(0, notified);
+}
+
+static void test_failed_commit_drops_the_batch(void)
+{
+    fresh_store();
+    config_begin();
+    config_stage_str(CFG_API_HOST, "old.example.com");
+    TEST_ASSERT_EQUAL(ESP_OK, config_commit());
+    notified = 0;
+
+    config_begin();
+    config_stage_str(CFG_API_HOST, "new.example.com");
+    config_stage_u32(CFG_BOUNCE_MS, 40);
+    fake_nvs_fail_commit(ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_ENOUGH_SPACE, config_commit());
+    TEST_ASSERT_EQUAL_STRING("old.example.com", config_get_str(CFG_API_HOST));
+    TEST_ASSERT_FALSE(config_is_set(CFG_BOUNCE_MS));
+    TEST_ASSERT_EQUAL_HEX32(0, notified);
+
+    // Nothing of the failed batch is carried into the next one.
+    config_begin();
+    config_stage_u32(CFG_COALESCE_MS, 200);
+    TEST_ASSERT_EQUAL(ESP_OK, config_commit());
+    TEST_ASSERT_EQUAL_HEX32(1UL << CFG_COALESCE_MS, notified);
+    init_nvs();
+    TEST_ASSERT_EQUAL_STRING("old.example.com", config_get_str(CFG_API_HOST));
+    TEST_ASSERT_FALSE(config_is_set(CFG_BOUNCE_MS));
+}
+
+static void test_failed_write_drops_the_batch(void)
+{
+    fresh_store();
+    unsigned commits = fake_nvs_commits();
+    config_begin();
+    config_stage_str(CFG_API_PATH, "/v2");
+    config_stage_u32(CFG_MAX_BATCH, 8);
+    fake_nvs_fail_set(ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_ENOUGH_SPACE, config_commit());
+    TEST_ASSERT_EQUAL(commits, fake_nvs_commits());
+    TEST_ASSERT_FALSE(config_is_set(CFG_API_PATH));
+    TEST_ASSERT_FALSE(config_is_set(CFG_MAX_BATCH));
+}
+
+static void test_discard_and_staging_outside_a_batch(void)
+{
+    fresh_store();
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, config_stage_u32(CFG_BOUNCE_MS, 30));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, config_commit());
+
+    config_begin();
+    config_stage_u32(CFG_BOUNCE_MS, 30);
+    config_discard();
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, config_stage_u32(CFG_BOUNCE_MS, 30));
+
+    config_begin();
+    config_stage_u32(CFG_HEARTBEAT_S, 60);
+    TEST_ASSERT_EQUAL(ESP_OK, config_commit());
+    TEST_ASSERT_FALSE(config_is_set(CFG_BOUNCE_MS));
+    TEST_ASSERT_EQUAL_HEX32(1UL << CFG_HEARTBEAT_S, notified);
+}
+
+void run_config_store_tests(void)
+{
+    RUN_TEST(test_batch_is_written_and_announced);
+    RUN_TEST(test_failed_commit_drops_the_batch);
+    RUN_TEST(test_failed_write_drops_the_batch);
+    RUN_TEST(test_discard_and_staging_outside_a_batch);
+}
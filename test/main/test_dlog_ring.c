@@ -0,0 +1,74 @@
+#include <string.h>
+
+#include "unity.h"
+#include "dlog-ring.h"
+#include "tests.h"
+
+#define RING_SLOTS 8
+
+static void test_record_round_trip(void)
+{
+    dlog_slot_t slots[RING_SLOTS];
+    dlog_ring_t ring;
+    dlog_ring_init(&ring, slots, RING_SLOTS);
+
+    const uint32_t args[] = {7, (uint32_t) -3};
+    TEST_ASSERT_TRUE(dlog_ring_push(&ring, 12, 123456, args, 2, "/api/state"));
+    dlog_record_t record;
+    TEST_ASSERT_TRUE(dlog_ring_pop(&ring, &record));
+    TEST_ASSERT_FALSE(dlog_ring_pop(&ring, &record));
+    TEST_ASSERT_EQUAL_UINT16(12, record.id);
+    TEST_ASSERT_EQUAL_UINT32(123456, record.time_us);
+
+    char line[64];
+    dlog_format(line, sizeof(line), "slot %u moved %d on %s (100%%)", &record);
+    TEST_ASSERT_EQUAL_STRING("slot 7 moved -3 on /api/state (100%)", line);
+}
+
+static void test_string_gets_the_rest_of_the_payload(void)
+{
+    dlog_slot_t slots[RING_SLOTS];
+    dlog_ring_t ring;
+    dlog_ring_init(&ring, slots, RING_SLOTS);
+
+    const uint32_t args[] = {1, 2, 3, 4};
+    dlog_ring_push(&ring, 1, 0, args, 4, "0123456789abcdef");
+    dlog_record_t record;
+    TEST_ASSERT_TRUE(dlog_ring_pop(&ring, &record));
+    TEST_ASSERT_EQUAL(DLOG_PAYLOAD_LEN, record.len);
+
+    char line[64];
+    dlog_format(line, sizeof(line), "%u %u %u %u %s %u", &record);
+    TEST_ASSERT_EQUAL_STRING("1 2 3 4 01234567 ?", line);
+    // A short buffer is cut and still terminated.
+    TEST_ASSERT_EQUAL(5, dlog_format(line, 6, "%u %u %u %u", &record));
+    TEST_ASSERT_EQUAL_STRING("1 2 3", line);
+}
+
+static void test_full_ring_drops_new_records(void)
+{
+    dlog_slot_t slots[RING_SLOTS];
+    dlog_ring_t ring;
+    dlog_ring_init(&ring, slots, RING_SLOTS);
+
+    for (uint32_t i = 0; i < RING_SLOTS + 2; ++i) {
+        dlog_ring_push(&ring, i, i, &i, 1, NULL);
+    }
+    TEST_ASSERT_EQUAL_UINT32(2, dlog_ring_dropped(&ring));
+
+    dlog_record_t record;
+    for (uint16_t i = 0; i < RING_SLOTS; ++i) {
+        TEST_ASSERT_TRUE(dlog_ring_pop(&ring, &record));
+        TEST_ASSERT_EQUAL_UINT16(i, record.id);
+    }
+    TEST_ASSERT_FALSE(dlog_ring_pop(&ring, &record));
+    // Popping freed the slots again.
+    TEST_ASSERT_TRUE(dlog_ring_push(&ring, 99, 0, NULL, 0, NULL));
+}
+
+void run_dlog_ring_tests(void)
+{
+    RUN_TEST(test_record_round_trip);
+    RUN_TEST(test_string_gets_the_rest_of_the_payload);
+    RUN_TEST(test_full_ring_drops_new_records);
+}
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+
+#include "unity.h"
+#include "sdkconfig.h"
+#include "http.h"
+#include "nvs_init.h"
+#include "fake-http-server.h"
+#include "tests.h"
+
+#ifdef CONFIG_HEAP_TRACE_GATE
+#include "heap-gate.h"
+
+#define HOST "api.example.com"
+#define GATED_CYCLES 5
+
+static void warm_up(void)
+{
+    for (int i = 0; i < CONFIG_HEAP_TRACE_GATE_WARMUP; ++i) {
+        heap_gate_begin();
+        heap_gate_end("warm-up");
+    }
+}
+
+static void build_report(json_writer_t* w, void* ctx)
+{
+    json_begin_object(w);
+    json_key(w, "slot");
+    json_uint(w, *(const uint32_t*) ctx);
+    json_key(w, "state");
+    json_bool(w, true);
+    json_end_object(w);
+}
+
+static void start(void)
+{
+    init_nvs();
+    save_auth_token("secret");
+    init_http();
+    http_close();
+    fake_http_server_set(NULL, NULL);
+    warm_up();
+}
+
+static void test_report_cycles_do_not_allocate(void)
+{
+    static const uint8_t frame[] = {0x01, 0x00, 0x24, 0x81, 0x01, 0x02, 0x03};
+    char buf[32];
+    http_response_t response = {.buf = buf, .size = sizeof(buf)};
+    start();
+    heap_gate_stats_t before;
+    get_heap_gate_stats(&before);
+
+    // The first cycle connects, a later one finds the kept-alive connection closed.
+    for (uint32_t slot = 0; slot < GATED_CYCLES; ++slot) {
+        if (slot == 2) {
+            fake_http_server_drop();
+        }
+        heap_gate_begin();
+        TEST_ASSERT_EQUAL(HTTP_RESULT_OK, http_post_json(HOST, "/state", &response, build_report, &slot, true));
+        heap_gate_end("json report");
+    }
+    for (int i = 0; i < GATED_CYCLES; ++i) {
+        heap_gate_begin();
+        TEST_ASSERT_EQUAL(HTTP_RESULT_OK, http_post_data(HOST, "/state", &response, "application/octet-stream",
+                                                         frame, sizeof(frame), true));
+        heap_gate_end("frame report");
+    }
+
+    heap_gate_stats_t after;
+    get_heap_gate_stats(&after);
+    TEST_ASSERT_EQUAL_UINT32(before.traced + 2 * GATED_CYCLES, after.traced);
+    TEST_ASSERT_EQUAL_UINT32(before.failed, after.failed);
+}
+
+static void test_allocation_fails_the_cycle(void)
+{
+    warm_up();
+    heap_gate_stats_t before;
+    get_heap_gate_stats(&before);
+
+    heap_gate_begin();
+    void* volatile block = malloc(16);
+    free(block);
+    heap_gate_end("malloc");
+
+    heap_gate_stats_t after;
+    get_heap_gate_stats(&after);
+    TEST_ASSERT_EQUAL_UINT32(before.traced + 1, after.traced);
+    TEST_ASSERT_EQUAL_UINT32(before.failed + 1, after.failed);
+    TEST_ASSERT_EQUAL_UINT32(1, after.allocations);
+}
+
+static void test_paused_allocation_is_not_counted(void)
+{
+    warm_up();
+    heap_gate_stats_t before;
+    get_heap_gate_stats(&before);
+
+    heap_gate_begin();
+    heap_gate_pause();
+    void* volatile block = malloc(16);
+    heap_gate_resume();
+    free(block);
+    heap_gate_end("paused malloc");
+
+    heap_gate_stats_t after;
+    get_heap_gate_stats(&after);
+    TEST_ASSERT_EQUAL_UINT32(before.traced + 1, after.traced);
+    TEST_ASSERT_EQUAL_UINT32(before.failed, after.failed);
+}
+
+void run_heap_gate_tests(void)
+{
+    RUN_TEST(test_report_cycles_do_not_allocate);
+    RUN_TEST(test_allocation_fails_the_cycle);
+    RUN_TEST(test_paused_allocation_is_not_counted);
+}
+
+#else
+
+void run_heap_gate_tests(void)
+{
+}
+
+#endif
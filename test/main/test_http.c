@@ -0,0 +1,187 @@
+#include <string.h>
+
+#include "unity.h"
+#include "http.h"
+#include "nvs_init.h"
+#include "fake-http-server.h"
+#include "tests.h"
+
+#define HOST "api.example.com"
+
+typedef struct {
+    int status;
+    const char* body;
+    const char* etag;
+} reply_t;
+
+static void answer(const fake_http_request_t* request, fake_http_response_t* response, void* ctx)
+{
+    const reply_t* reply = ctx;
+    response->status = reply->status;
+    response->body = reply->body;
+    response->body_len = reply->body != NULL ? strlen(reply->body) : 0;
+    // Answers the conditional GET with a 304 once the client has the current ETag.
+    const char* match = fake_http_request_header(request, "If-None-Match");
+    if (reply->etag != NULL && match != NULL && strcmp(match, reply->etag) == 0) {
+        response->status = 304;
+        response->body_len = 0;
+    }
+    response->etag = reply->etag;
+}
+
+static void build_event(json_writer_t* w, void* ctx)
+{
+    json_begin_object(w);
+    json_key(w, "slot");
+    json_uint(w, *(const uint32_t*) ctx);
+    json_end_object(w);
+}
+
+static void start(reply_t* reply)
+{
+    init_nvs();
+    save_auth_token("secret");
+    init_http();
+    http_close();
+    fake_http_server_set(answer, reply);
+}
+
+static void test_connection_is_kept_alive(void)
+{
+    reply_t reply = {.status = 200, .body = "{}"};
+    start(&reply);
+    http_stats_t before;
+    http_get_stats(&before);
+
+    for (uint32_t slot = 0; slot < 3; ++slot) {
+        TEST_ASSERT_EQUAL(HTTP_RESULT_OK, http_post_json(HOST, "/state", NULL, build_event, &slot, true));
+    }
+    const fake_http_request_t* request = fake_http_last_request();
+    TEST_ASSERT_EQUAL(HTTP_METHOD_POST, request->method);
+    TEST_ASSERT_EQUAL_STRING("https://" HOST "/state", request->url);
+    TEST_ASSERT_EQUAL_STRING("application/json", fake_http_request_header(request, "Content-Type"));
+    TEST_ASSERT_EQUAL_STRING("Bearer secret", fake_http_request_header(request, "Authorization"));
+    TEST_ASSERT_EQUAL(strlen("{\"slot\":2}"), request->body_len);
+    TEST_ASSERT_EQUAL_MEMORY("{\"slot\":2}", request->body, request->body_len);
+
+    fake_http_stats_t server;
+    fake_http_server_stats(&server);
+    TEST_ASSERT_EQUAL_UINT32(1, server.connects);
+    TEST_ASSERT_EQUAL_UINT32(3, server.requests);
+    http_stats_t after;
+    http_get_stats(&after);
+    TEST_ASSERT_EQUAL_UINT32(before.cold_requests + 1, after.cold_requests);
+    TEST_ASSERT_EQUAL_UINT32(before.warm_requests + 2, after.warm_requests);
+}
+
+static void test_closed_connection_is_reopened(void)
+{
+    reply_t reply = {.status = 200, .body = "ok"};
+    uint32_t slot = 1;
+    start(&reply);
+    http_stats_t before;
+    http_get_stats(&before);
+
+    TEST_ASSERT_EQUAL(HTTP_RESULT_OK, http_post_json(HOST, "/state", NULL, build_event, &slot, true));
+    fake_http_server_drop();
+    TEST_ASSERT_EQUAL(HTTP_RESULT_OK, http_post_json(HOST, "/state", NULL, build_event, &slot, true));
+    fake_http_server_drop();
+    char buf[16];
+    http_response_t response = {.buf = buf, .size = sizeof(buf)};
+    TEST_ASSERT_EQUAL(HTTP_RESULT_OK, http_get(HOST, "/config", &response, true));
+    TEST_ASSERT_EQUAL_STRING("ok", buf);
+
+    fake_http_stats_t server;
+    fake_http_server_stats(&server);
+    TEST_ASSERT_EQUAL_UINT32(3, server.connects);
+    TEST_ASSERT_EQUAL_UINT32(2, server.broken);
+    http_stats_t after;
+    http_get_stats(&after);
+    TEST_ASSERT_EQUAL_UINT32(before.reconnects + 2, after.reconnects);
+    TEST_ASSERT_EQUAL_UINT32(before.failed_requests, after.failed_requests);
+}
+
+static void test_headers_do_not_stick(void)
+{
+    reply_t reply = {.status = 206, .body = "0123456789"};
+    start(&reply);
+    char body[] = "{\"a\":1}";
+
+    TEST_ASSERT_EQUAL(HTTP_RESULT_OK, http_post(HOST, "/state", NULL, body, true));
+    TEST_ASSERT_NOT_NULL(fake_http_request_header(fake_http_last_request(), "Content-Type"));
+
+    TEST_ASSERT_EQUAL(HTTP_RESULT_OK, http_get_range(HOST, "/image", NULL, 10, 10, true));
+    const fake_http_request_t* request = fake_http_last_request();
+    TEST_ASSERT_EQUAL(HTTP_METHOD_GET, request->method);
+    TEST_ASSERT_EQUAL_STRING("bytes=10-19", fake_http_request_header(request, "Range"));
+    TEST_ASSERT_NULL(fake_http_request_header(request, "Content-Type"));
+    TEST_ASSERT_EQUAL(0, request->body_len);
+
+    TEST_ASSERT_EQUAL(HTTP_RESULT_OK, http_get(HOST, "/manifest", NULL, false));
+    request = fake_http_last_request();
+    TEST_ASSERT_NULL(fake_http_request_header(request, "Range"));
+    TEST_ASSERT_NULL(fake_http_request_header(request, "Authorization"));
+    TEST_ASSERT_NULL(fake_http_request_header(request, "Content-Type"));
+}
+
+static void test_conditional_get(void)
+{
+    reply_t reply = {.status = 200, .body = "{\"heartbeat_s\":60}", .etag = "\"v1\""};
+    start(&reply);
+    char buf[64];
+    char etag[16];
+    http_response_t response = {.buf = buf, .size = sizeof(buf), .etag = etag, .etag_size = sizeof(etag)};
+
+    TEST_ASSERT_EQUAL(HTTP_RESULT_OK, http_get_if_none_match(HOST, "/config", &response, "", true));
+    TEST_ASSERT_EQUAL(200, response.status);
+    TEST_ASSERT_EQUAL_STRING(reply.body, buf);
+    TEST_ASSERT_EQUAL_STRING("\"v1\"", etag);
+    TEST_ASSERT_NULL(fake_http_request_header(fake_http_last_request(), "If-None-Match"));
+
+    char known[16];
+    strcpy(known, etag);
+    TEST_ASSERT_EQUAL(HTTP_RESULT_OK, http_get_if_none_match(HOST, "/config", &response, known, true));
+    TEST_ASSERT_EQUAL(304, response.status);
+    TEST_ASSERT_EQUAL(0, response.len);
+}
+
+static void test_result_classes(void)
+{
+    reply_t reply = {.status = 500};
+    start(&reply);
+    TEST_ASSERT_EQUAL(HTTP_RESULT_SERVER, http_get(HOST, "/", NULL, true));
+    reply.status = 429;
+    TEST_ASSERT_EQUAL(HTTP_RESULT_SERVER, http_get(HOST, "/", NULL, true));
+    reply.status = 415;
+    TEST_ASSERT_EQUAL(HTTP_RESULT_REJECTED, http_get(HOST, "/", NULL, true));
+    reply.status = 204;
+    TEST_ASSERT_EQUAL(HTTP_RESULT_OK, http_get(HOST, "/", NULL, true));
+
+    http_close();
+    fake_http_server_refuse(true);
+    TEST_ASSERT_EQUAL(HTTP_RESULT_NETWORK, http_get(HOST, "/", NULL, true));
+    fake_http_server_refuse(false);
+}
+
+static void test_long_body_is_truncated(void)
+{
+    reply_t reply = {.status = 200, .body = "0123456789abcdefghij"};
+    start(&reply);
+    char buf[8];
+    http_response_t response = {.buf = buf, .size = sizeof(buf)};
+    TEST_ASSERT_EQUAL(HTTP_RESULT_OK, http_get(HOST, "/", &response, true));
+    TEST_ASSERT_TRUE(response.truncated);
+    TEST_ASSERT_EQUAL(7, response.len);
+    TEST_ASSERT_EQUAL(20, response.total);
+    TEST_ASSERT_EQUAL_STRING("0123456", buf);
+}
+
+void run_http_tests(void)
+{
+    RUN_TEST(test_connection_is_kept_alive);
+    RUN_TEST(test_closed_connection_is_reopened);
+    RUN_TEST(test_headers_do_not_stick);
+    RUN_TEST(test_conditional_get);
+    RUN_TEST(test_result_classes);
+    RUN_TEST(test_long_body_is_truncated);
+}
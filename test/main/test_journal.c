@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "unity.h"
+#include "journal.h"
+#include "fake-partition.h"
+#include "tests.h"
+
+/*
+ * Every scenario is run once to count its flash operations, then again with the
+ * power cut after each possible number of them. After the reboot the journal has
+ * to replay exactly the events past the old or the new cursor, and keep working.
+ */
+
+// A sector holds a 16 byte header and 16 byte records.
+#define SECTOR_RECORDS (JOURNAL_SECTOR_SIZE / 16 - 1)
+#define MAX_REPLAY (FAKE_PARTITION_SECTORS * SECTOR_RECORDS)
+#define LATE_SEQ 100000
+
+typedef struct {
+    const char* name;
+    void (*setup)(void);
+    void (*step)(void);
+    uint32_t first;        // First event replayed either way
+    uint32_t last_before;  // Last event replayed if the step did not happen
+    uint32_t last_after;   // Last event replayed if it did
+    bool may_drain;        // A finished step leaves nothing to replay
+} scenario_t;
+
+static journal_event_t events[MAX_REPLAY + 1];
+static uint32_t next_seq;
+
+static void append(size_t count)
+{
+    for (size_t i = 0; i < count; ++i, ++next_seq) {
+        events[i].seq = next_seq;
+        events[i].timestamp = next_seq * 250;
+        events[i].slot = next_seq % 64;
+        events[i].state = next_seq & 1;
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, journal_append(events, count));
+}
+
+static void read_and_commit(size_t max_events)
+{
+    journal_pos_t next;
+    journal_read(events, max_events, &next);
+    TEST_ASSERT_EQUAL(ESP_OK, journal_commit(next));
+}
+
+static void fresh_journal(void)
+{
+    fake_partition_reset();
+    TEST_ASSERT_EQUAL(ESP_OK, init_journal());
+    next_seq = 1;
+}
+
+/* Events 1..5 written, 1 and 2 uploaded */
+static void setup_mid_sector(void)
+{
+    fresh_journal();
+    append(5);
+    read_and_commit(2);
+}
+
+/* All three sectors used, the last one is full and events 509..761 are pending */
+static void setup_full_ring(void)
+{
+    fresh_journal();
+    append(SECTOR_RECORDS);
+    read_and_commit(MAX_REPLAY);
+    // The sectors after the first one start with a carried cursor and the commit.
+    append(SECTOR_RECORDS - 2);
+    read_and_commit(MAX_REPLAY);
+    append(SECTOR_RECORDS - 2);
+}
+
+static void append_one(void)
+{
+    append(1);
+}
+
+static void commit_all(void)
+{
+    read_and_commit(MAX_REPLAY);
+}
+
+static size_t replay(void)
+{
+    journal_pos_t next;
+    return journal_read(events, MAX_REPLAY + 1, &next);
+}
+
+static void check_after_power_loss(const scenario_t* scenario, long budget)
+{
+    char message[64];
+    snprintf(message, sizeof(message), "%s, power cut after %ld", scenario->name, budget);
+
+    fake_partition_power_on();
+    TEST_ASSERT_EQUAL_MESSAGE(ESP_OK, init_journal(), message);
+    size_t n = replay();
+    if (n == 0) {
+        TEST_ASSERT_TRUE_MESSAGE(scenario->may_drain, message);
+    } else {
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(scenario->first, events[0].seq, message);
+        for (size_t i = 1; i < n; ++i) {
+            TEST_ASSERT_EQUAL_UINT32_MESSAGE(events[i - 1].seq + 1, events[i].seq, message);
+        }
+        uint32_t last = events[n - 1].seq;
+        TEST_ASSERT_TRUE_MESSAGE(last == scenario->last_before || last == scenario->last_after, message);
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(last * 250, events[n - 1].timestamp, message);
+    }
+
+    // Whatever the cut left behind, the next append is replayed after the rest.
+    next_seq = LATE_SEQ;
+    append(1);
+    TEST_ASSERT_EQUAL_MESSAGE(n + 1, replay(), message);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(LATE_SEQ, events[n].seq, message);
+}
+
+static void run_with_power_cuts(const scenario_t* scenario)
+{
+    scenario->setup();
+    size_t start = fake_partition_operations();
+    scenario->step();
+    long operations = fake_partition_operations() - start;
+    TEST_ASSERT_GREATER_THAN(0, operations);
+
+    for (long budget = 0; budget <= operations; ++budget) {
+        scenario->setup();
+        fake_partition_power_cut(budget);
+        scenario->step();
+        check_after_power_loss(scenario, budget);
+    }
+}
+
+static void test_power_loss_in_append(void)
+{
+    const scenario_t scenario = {"append", setup_mid_sector, append_one, 3, 5, 6, false};
+    run_with_power_cuts(&scenario);
+}
+
+static void test_power_loss_in_commit(void)
+{
+    const scenario_t scenario = {"commit", setup_mid_sector, commit_all, 3, 5, 5, true};
+    run_with_power_cuts(&scenario);
+}
+
+static void test_power_loss_in_append_rollover(void)
+{
+    uint32_t first = 2 * SECTOR_RECORDS - 1;
+    uint32_t last = 3 * SECTOR_RECORDS - 4;
+    const scenario_t scenario = {"append rollover", setup_full_ring, append_one, first, last, last + 1, false};
+    run_with_power_cuts(&scenario);
+}
+
+static void test_power_loss_in_commit_rollover(void)
+{
+    uint32_t first = 2 * SECTOR_RECORDS - 1;
+    uint32_t last = 3 * SECTOR_RECORDS - 4;
+    const scenario_t scenario = {"commit rollover", setup_full_ring, commit_all, first, last, last, true};
+    run_with_power_cuts(&scenario);
+}
+
+static void test_rollover_keeps_the_cursor(void)
+{
+    setup_full_ring();
+    uint32_t lost = journal_lost_records();
+    // The rollover erases the oldest sector, its events were uploaded already.
+    append_one();
+    TEST_ASSERT_EQUAL_UINT32(lost, journal_lost_records());
+    TEST_ASSERT_EQUAL(ESP_OK, init_journal());
+    TEST_ASSERT_EQUAL(SECTOR_RECORDS - 1, replay());
+    TEST_ASSERT_EQUAL_UINT32(2 * SECTOR_RECORDS - 1, events[0].seq);
+}
+
+void run_journal_tests(void)
+{
+    RUN_TEST(test_power_loss_in_append);
+    RUN_TEST(test_power_loss_in_commit);
+    RUN_TEST(test_power_loss_in_append_rollover);
+    RUN_TEST(test_power_loss_in_commit_rollover);
+    RUN_TEST(test_rollover_keeps_the_cursor);
+}
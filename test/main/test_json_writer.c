@@ -0,0 +1,108 @@
+#include <string.h>
+
+#include "unity.h"
+#include "json-writer.h"
+#include "tests.h"
+
+static const char expected[] =
+    "{\"id\":\"a\\\"b\\\\c\\n\\u0001\",\"seq\":4294967295,\"delta\":-2147483648,"
+    "\"events\":[{\"slot\":0,\"state\":true},{\"slot\":17,\"state\":false}],\"extra\":null,\"empty\":[]}";
+
+static void build_document(json_writer_t* w, void* ctx)
+{
+    json_begin_object(w);
+    json_key(w, "id");
+    json_string(w, "a\"b\\c\n\x01");
+    json_key(w, "seq");
+    json_uint(w, UINT32_MAX);
+    json_key(w, "delta");
+    json_int(w, INT32_MIN);
+    json_key(w, "events");
+    json_begin_array(w);
+    for (int i = 0; i < 2; ++i) {
+        json_begin_object(w);
+        json_key(w, "slot");
+        json_uint(w, i * 17);
+        json_key(w, "state");
+        json_bool(w, i == 0);
+        json_end_object(w);
+    }
+    json_end_array(w);
+    json_key(w, "extra");
+    json_null(w);
+    json_key(w, "empty");
+    json_begin_array(w);
+    json_end_array(w);
+    json_end_object(w);
+}
+
+typedef struct {
+    char out[512];
+    size_t len;
+    int flushes;
+    int fail_at;
+} sink_t;
+
+static int collect(void* ctx, const char* data, size_t len)
+{
+    sink_t* sink = ctx;
+    if (++sink->flushes == sink->fail_at) {
+        return -1;
+    }
+    memcpy(sink->out + sink->len, data, len);
+    sink->len += len;
+    return 0;
+}
+
+static void test_document_into_buffer(void)
+{
+    char buf[512];
+    TEST_ASSERT_EQUAL(strlen(expected), json_build(buf, sizeof(buf), build_document, NULL));
+    TEST_ASSERT_EQUAL_STRING(expected, buf);
+}
+
+static void test_measure_matches_output(void)
+{
+    TEST_ASSERT_EQUAL(strlen(expected), json_measure(build_document, NULL));
+}
+
+static void test_overflow_leaves_empty_buffer(void)
+{
+    char buf[32];
+    TEST_ASSERT_EQUAL(-1, json_build(buf, sizeof(buf), build_document, NULL));
+    TEST_ASSERT_EQUAL_STRING("", buf);
+}
+
+static void test_chunks_are_flushed(void)
+{
+    char chunk[7];
+    sink_t sink = {0};
+    json_writer_t writer;
+    json_writer_init(&writer, chunk, sizeof(chunk), collect, &sink);
+    build_document(&writer, NULL);
+    TEST_ASSERT_EQUAL(strlen(expected), json_writer_finish(&writer));
+    TEST_ASSERT_EQUAL(strlen(expected), sink.len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, sink.out, sink.len);
+    TEST_ASSERT_EQUAL((strlen(expected) + sizeof(chunk) - 1) / sizeof(chunk), sink.flushes);
+}
+
+static void test_failed_flush_stops_writing(void)
+{
+    char chunk[16];
+    sink_t sink = {.fail_at = 3};
+    json_writer_t writer;
+    json_writer_init(&writer, chunk, sizeof(chunk), collect, &sink);
+    build_document(&writer, NULL);
+    TEST_ASSERT_EQUAL(-1, json_writer_finish(&writer));
+    TEST_ASSERT_EQUAL(3, sink.flushes);
+    TEST_ASSERT_EQUAL(2 * sizeof(chunk), sink.len);
+}
+
+void run_json_writer_tests(void)
+{
+    RUN_TEST(test_document_into_buffer);
+    RUN_TEST(test_measure_matches_output);
+    RUN_TEST(test_overflow_leaves_empty_buffer);
+    RUN_TEST(test_chunks_are_flushed);
+    RUN_TEST(test_failed_flush_stops_writing);
+}
@@ -0,0 +1,78 @@
+#include "unity.h"
+#include "load-filter.h"
+#include "tests.h"
+
+static const load_filter_config_t config = {
+    .iir_shift = 3,
+    .hysteresis = 100,
+};
+
+static bool run_constant(load_filter_t* filter, int32_t value, size_t n)
+{
+    bool reported = false;
+    for (size_t i = 0; i < n; ++i) {
+        reported |= load_filter_run(filter, &config, &value, 1);
+    }
+    return reported;
+}
+
+static void test_first_median_primes_the_filter(void)
+{
+    load_filter_t filter;
+    load_filter_init(&filter);
+    TEST_ASSERT_FALSE(run_constant(&filter, 1000, LOAD_MEDIAN_WINDOW - 1));
+    TEST_ASSERT_TRUE(run_constant(&filter, 1000, 1));
+    TEST_ASSERT_EQUAL_INT32(1000, load_filter_value(&filter));
+}
+
+static void test_spikes_are_dropped(void)
+{
+    const int32_t samples[] = {1000, 1000, 0x7fffff, 1000, 1000, -0x800000, 1000, 1000, 1000, 1000};
+    load_filter_t filter;
+    load_filter_init(&filter);
+    run_constant(&filter, 1000, LOAD_MEDIAN_WINDOW);
+    TEST_ASSERT_FALSE(load_filter_run(&filter, &config, samples, 10));
+    TEST_ASSERT_EQUAL_INT32(1000, load_filter_value(&filter));
+}
+
+static void test_step_reports_past_hysteresis(void)
+{
+    load_filter_t filter;
+    load_filter_init(&filter);
+    run_constant(&filter, 1000, LOAD_MEDIAN_WINDOW);
+
+    // The first median after the step moves the output 1/8 of the way, 250 counts.
+    TEST_ASSERT_TRUE(run_constant(&filter, 3000, LOAD_MEDIAN_WINDOW));
+    TEST_ASSERT_EQUAL_INT32(1250, load_filter_value(&filter));
+
+    int reports = 0;
+    for (int i = 0; i < 100; ++i) {
+        reports += run_constant(&filter, 3000, LOAD_MEDIAN_WINDOW);
+    }
+    TEST_ASSERT_INT32_WITHIN(8, 3000, load_filter_value(&filter));
+    TEST_ASSERT_GREATER_THAN(0, reports);
+    // Once settled, the remaining drift stays below the hysteresis.
+    TEST_ASSERT_FALSE(run_constant(&filter, 3000, 10 * LOAD_MEDIAN_WINDOW));
+}
+
+static void test_batches_keep_the_window(void)
+{
+    const int32_t samples[7] = {500, 500, 500, 500, 500, 500, 500};
+    load_filter_t split;
+    load_filter_t whole;
+    load_filter_init(&split);
+    load_filter_init(&whole);
+    load_filter_run(&split, &config, samples, 3);
+    load_filter_run(&split, &config, samples + 3, 4);
+    load_filter_run(&whole, &config, samples, 7);
+    TEST_ASSERT_EQUAL_INT32(load_filter_value(&whole), load_filter_value(&split));
+    TEST_ASSERT_EQUAL(whole.fill, split.fill);
+}
+
+void run_load_filter_tests(void)
+{
+    RUN_TEST(test_first_median_primes_the_filter);
+    RUN_TEST(test_spikes_are_dropped);
+    RUN_TEST(test_step_reports_past_hysteresis);
+    RUN_TEST(test_batches_keep_the_window);
+}
@@ -0,0 +1,39 @@
+#include <stdlib.h>
+
+#include "unity.h"
+#include "sdkconfig.h"
+#include "tests.h"
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void app_main(void)
+{
+    UNITY_BEGIN();
+    run_bt_parser_tests();
+    run_json_writer_tests();
+    run_state_frame_tests();
+    run_config_parser_tests();
+    run_load_filter_tests();
+    run_button_events_tests();
+    run_slot_scanner_tests();
+    run_dlog_ring_tests();
+    run_config_store_tests();
+    run_journal_tests();
+    run_http_tests();
+    run_heap_gate_tests();
+    run_ota_tests();
+    int failures = UNITY_END();
+
+#ifdef CONFIG_TEST_BENCHMARKS
+    if (failures == 0) {
+        run_benchmarks();
+    }
+#endif
+    exit(failures != 0);
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "unity.h"
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ota.h"
+#include "http.h"
+#include "nvs_init.h"
+#include "fake-http-server.h"
+#include "fake-ota.h"
+#include "tests.h"
+
+#ifdef CONFIG_OTA_UPDATES
+
+/*
+ * The OTA task runs for real against a stand-in server that hands out the
+ * manifest and answers range requests from an image in RAM. esp_restart() is
+ * wrapped at link time, the test only notes that it was called.
+ */
+#define IMAGE_SIZE 10000
+#define IMAGE_PATH "/fw.bin"
+// The resume waits OTA_RETRY_MS before the next range request.
+#define DOWNLOAD_TIMEOUT_MS (3 * OTA_RETRY_MS)
+
+typedef struct {
+    const char* manifest;
+    uint32_t range_requests;
+    uint32_t drop_request;  // Range request that breaks off mid-body, 0 for none
+    int drop_after;
+} ota_server_t;
+
+static uint8_t image[IMAGE_SIZE];
+static volatile bool restarted = false;
+
+void __wrap_esp_restart(void)
+{
+    restarted = true;
+}
+
+static void serve(const fake_http_request_t* request, fake_http_response_t* response, void* ctx)
+{
+    ota_server_t* server = ctx;
+    const char* path = strstr(request->url, "://");
+    path = path != NULL ? strchr(path + 3, '/') : NULL;
+    if (path != NULL && strcmp(path, CONFIG_OTA_MANIFEST_PATH) == 0) {
+        response->body = server->manifest;
+        response->body_len = strlen(server->manifest);
+        return;
+    }
+    unsigned first = 0;
+    unsigned last = 0;
+    const char* range = fake_http_request_header(request, "Range");
+    if (path == NULL || strcmp(path, IMAGE_PATH) != 0 || range == NULL ||
+        sscanf(range, "bytes=%u-%u", &first, &last) != 2 || first > last || last >= IMAGE_SIZE) {
+        response->status = 416;
+        return;
+    }
+    server->range_requests++;
+    response->status = 206;
+    response->body = (const char*) image + first;
+    response->body_len = last - first + 1;
+    if (server->range_requests == server->drop_request) {
+        response->drop_after = server->drop_after;
+    }
+}
+
+static void start(ota_server_t* server)
+{
+    static bool ota_started = false;
+    for (size_t i = 0; i < IMAGE_SIZE; ++i) {
+        image[i] = i * 7 + 3;
+    }
+    fake_ota_reset();
+    restarted = false;
+    init_nvs();
+    save_auth_token("secret");
+    init_http();
+    http_close();
+    fake_http_server_set(serve, server);
+    if (!ota_started) {
+        init_ota();
+        ota_started = true;
+    }
+}
+
+/* Runs one check on the OTA task and waits until it counted as skipped, failed or restarted */
+static void check_and_wait(const ota_stats_t* before, int timeout_ms)
+{
+    ota_stats_t now;
+    ota_check_now();
+    for (int waited = 0; waited < timeout_ms; waited += 50) {
+        vTaskDelay(pdMS_TO_TICKS(50));
+        get_ota_stats(&now);
+        if (restarted || now.skipped != before->skipped || now.failed != before->failed) {
+            return;
+        }
+    }
+}
+
+static void test_rolled_back_version_is_skipped(void)
+{
+    ota_server_t server = {.manifest = "1.0.1 10000 " IMAGE_PATH};
+    start(&server);
+    fake_ota_set_rolled_back("1.0.1");
+    ota_stats_t before;
+    get_ota_stats(&before);
+
+    check_and_wait(&before, 2000);
+    ota_stats_t after;
+    get_ota_stats(&after);
+    TEST_ASSERT_EQUAL_UINT32(before.checks + 1, after.checks);
+    TEST_ASSERT_EQUAL_UINT32(before.skipped + 1, after.skipped);
+    TEST_ASSERT_EQUAL_UINT32(0, server.range_requests);
+    TEST_ASSERT_FALSE(restarted);
+    TEST_ASSERT_NULL(fake_ota_boot_partition());
+}
+
+static void test_broken_download_is_resumed(void)
+{
+    // The second chunk breaks off after 1000 bytes, they are in flash already.
+    ota_server_t server = {.manifest = "1.0.2 10000 " IMAGE_PATH, .drop_request = 2, .drop_after = 1000};
+    start(&server);
+    ota_stats_t before;
+    get_ota_stats(&before);
+
+    check_and_wait(&before, DOWNLOAD_TIMEOUT_MS);
+    ota_stats_t after;
+    get_ota_stats(&after);
+    TEST_ASSERT_TRUE(restarted);
+    TEST_ASSERT_EQUAL_UINT32(before.downloads + 1, after.downloads);
+    TEST_ASSERT_EQUAL_UINT32(before.resumes + 1, after.resumes);
+    TEST_ASSERT_EQUAL_UINT32(before.failed, after.failed);
+    TEST_ASSERT_EQUAL_UINT32(IMAGE_SIZE, after.last_bytes);
+    // 4096 bytes, 1000 of the next 4096, then 4096 from the break and the last 808.
+    TEST_ASSERT_EQUAL_UINT32(4, server.range_requests);
+
+    size_t len = 0;
+    const uint8_t* written = fake_ota_image(&len);
+    TEST_ASSERT_EQUAL(IMAGE_SIZE, len);
+    TEST_ASSERT_EQUAL_MEMORY(image, written, IMAGE_SIZE);
+    TEST_ASSERT_NOT_NULL(fake_ota_boot_partition());
+    TEST_ASSERT_EQUAL_STRING("ota_1", fake_ota_boot_partition()->label);
+}
+
+void run_ota_tests(void)
+{
+    RUN_TEST(test_rolled_back_version_is_skipped);
+    RUN_TEST(test_broken_download_is_resumed);
+}
+
+#else
+
+void run_ota_tests(void)
+{
+}
+
+#endif
@@ -0,0 +1,65 @@
+#include "unity.h"
+#include "sdkconfig.h"
+#include "slot-scanner.h"
+#include "fake-driver.h"
+#include "tests.h"
+
+#ifdef CONFIG_BUTTON_FRONTEND_SHIFT_REG
+
+static void test_chain_length_is_checked(void)
+{
+    fake_driver_reset();
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, init_slot_scanner(0));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, init_slot_scanner(33));
+}
+
+static void test_pressed_slots_become_set_bits(void)
+{
+    // Switches pull low. Chip 0 input H is slot 0, chip 1 input A is slot 15, chip 4 input G is slot 33.
+    const uint8_t levels[5] = {0x7f, 0xfe, 0xff, 0xff, 0xbf};
+    uint32_t bits[2] = {0xffffffff, 0xffffffff};
+
+    fake_driver_reset();
+    fake_shift_register_set(levels, 5);
+    TEST_ASSERT_EQUAL(ESP_OK, init_slot_scanner(5));
+    uint32_t pulses = fake_gpio_load_pulses();
+    TEST_ASSERT_EQUAL(ESP_OK, slot_scanner_read(bits, 2));
+    TEST_ASSERT_EQUAL_UINT32(pulses + 1, fake_gpio_load_pulses());
+    TEST_ASSERT_EQUAL_HEX32(0x00008001, bits[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x00000002, bits[1]);
+
+    slot_scanner_stats_t stats;
+    slot_scanner_get_stats(&stats);
+    TEST_ASSERT_GREATER_OR_EQUAL(1, stats.scans);
+}
+
+static void test_inputs_are_latched_per_read(void)
+{
+    const uint8_t released[1] = {0xff};
+    const uint8_t pressed[1] = {0x00};
+    uint32_t bits;
+
+    fake_driver_reset();
+    fake_shift_register_set(released, 1);
+    TEST_ASSERT_EQUAL(ESP_OK, init_slot_scanner(1));
+    TEST_ASSERT_EQUAL(ESP_OK, slot_scanner_read(&bits, 1));
+    TEST_ASSERT_EQUAL_HEX32(0, bits);
+    fake_shift_register_set(pressed, 1);
+    TEST_ASSERT_EQUAL(ESP_OK, slot_scanner_read(&bits, 1));
+    TEST_ASSERT_EQUAL_HEX32(0xff, bits);
+}
+
+void run_slot_scanner_tests(void)
+{
+    RUN_TEST(test_chain_length_is_checked);
+    RUN_TEST(test_pressed_slots_become_set_bits);
+    RUN_TEST(test_inputs_are_latched_per_read);
+}
+
+#else
+
+void run_slot_scanner_tests(void)
+{
+}
+
+#endif
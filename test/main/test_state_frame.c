@@ -0,0 +1,62 @@
+#include <string.h>
+
+#include "unity.h"
+#include "state-frame.h"
+#include "tests.h"
+
+static void test_varints(void)
+{
+    static const uint8_t expected[] = {
+        0x00, 0x7f, 0x80, 0x01, 0xff, 0xff, 0xff, 0xff, 0x0f,   // 0, 127, 128, UINT32_MAX
+        0x00, 0x01, 0x02, 0xff, 0xff, 0xff, 0xff, 0x0f,         // 0, -1, 1, INT32_MIN zigzagged
+    };
+    uint8_t buf[32];
+    frame_writer_t writer;
+    frame_writer_init(&writer, buf, sizeof(buf));
+    frame_varint(&writer, 0);
+    frame_varint(&writer, 127);
+    frame_varint(&writer, 128);
+    frame_varint(&writer, UINT32_MAX);
+    frame_svarint(&writer, 0);
+    frame_svarint(&writer, -1);
+    frame_svarint(&writer, 1);
+    frame_svarint(&writer, INT32_MIN);
+    TEST_ASSERT_EQUAL(sizeof(expected), frame_writer_finish(&writer));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, buf, sizeof(expected));
+}
+
+static void build_snapshot(frame_writer_t* w, void* ctx)
+{
+    // Slots 0, 9, 31 and 32 of 40 are set.
+    static const uint32_t bits[2] = {0x80000201, 0x00000001};
+    frame_header(w, STATE_FRAME_SNAPSHOT, STATE_FRAME_QUANTITIES, "ab", 300);
+    frame_bits(w, bits, 40);
+    frame_varint(w, 1);
+    frame_svarint(w, -3);
+}
+
+static void test_snapshot_frame(void)
+{
+    static const uint8_t expected[] = {
+        STATE_FRAME_VERSION, STATE_FRAME_SNAPSHOT | STATE_FRAME_QUANTITIES, 0x02, 'a', 'b', 0xac, 0x02,
+        0x28, 0x01, 0x02, 0x00, 0x80, 0x01,
+        0x01, 0x05,
+    };
+    uint8_t buf[64];
+    TEST_ASSERT_EQUAL(sizeof(expected), frame_build(buf, sizeof(buf), build_snapshot, NULL));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, buf, sizeof(expected));
+}
+
+static void test_length_only_and_overflow(void)
+{
+    uint8_t buf[8];
+    TEST_ASSERT_EQUAL(15, frame_build(NULL, 0, build_snapshot, NULL));
+    TEST_ASSERT_EQUAL(-1, frame_build(buf, sizeof(buf), build_snapshot, NULL));
+}
+
+void run_state_frame_tests(void)
+{
+    RUN_TEST(test_varints);
+    RUN_TEST(test_snapshot_frame);
+    RUN_TEST(test_length_only_and_overflow);
+}
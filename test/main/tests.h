@@ -0,0 +1,22 @@
+/* Test groups of the host test project, every one runs its tests with RUN_TEST */
+#ifndef _TESTS_H_
+#define _TESTS_H_
+
+void run_bt_parser_tests(void);
+void run_json_writer_tests(void);
+void run_state_frame_tests(void);
+void run_config_parser_tests(void);
+void run_load_filter_tests(void);
+void run_button_events_tests(void);
+void run_slot_scanner_tests(void);
+void run_dlog_ring_tests(void);
+void run_config_store_tests(void);
+void run_journal_tests(void);
+void run_http_tests(void);
+void run_heap_gate_tests(void);
+void run_ota_tests(void);
+
+/* Prints one line per benchmark, nothing is asserted */
+void run_benchmarks(void);
+
+#endif